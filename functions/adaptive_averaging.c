@@ -0,0 +1,136 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adaptive_averaging.h"
+#include "t2_fit.h"
+
+int adapt_init(adaptive_avg * ad, uint32_t echoes, double echo_time_us,
+		double snr_target, double t2_rel_target, uint32_t min_scans,
+		uint32_t check_every, uint32_t ph_cycl_en)
+{
+	uint32_t e;
+
+	memset(ad, 0, sizeof(adaptive_avg));
+	if (snr_target <= 0 && t2_rel_target <= 0)
+	{
+		printf("\t[WARNING] adaptive averaging has no snr or T2 target, every scan is run\n");
+		return -1;
+	}
+	if (echoes < 2 * ADAPT_SIGNAL_ECHOES)
+	{
+		printf("\t[WARNING] adaptive averaging needs at least %d echoes, every scan is run\n",
+				2 * ADAPT_SIGNAL_ECHOES);
+		return -1;
+	}
+	ad->snr_target = snr_target;
+	ad->t2_rel_target = t2_rel_target;
+	ad->echoes = echoes;
+	ad->check_every = (check_every > 0) ? check_every : 1;
+	if (ph_cycl_en && ad->check_every % 2)
+	{ // only whole phase-cycle pairs cancel the offsets
+		ad->check_every++;
+	}
+	ad->min_scans = (min_scans > ad->check_every) ? min_scans : ad->check_every;
+
+	ad->decay_sum = (double *) calloc(2 * echoes, sizeof(double));
+	ad->decay = (float *) malloc(2 * echoes * sizeof(float));
+	ad->t = (double *) malloc(echoes * sizeof(double));
+	ad->y = (double *) malloc(echoes * sizeof(double));
+	if (ad->decay_sum == NULL || ad->decay == NULL || ad->t == NULL
+			|| ad->y == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the adaptive averaging\n");
+		adapt_free(ad);
+		return -1;
+	}
+	for (e = 0; e < echoes; e++)
+		ad->t[e] = (e + 1) * echo_time_us;
+
+	return 0;
+}
+
+double adapt_decay_snr(const float * decay, uint32_t echoes, double * y)
+{
+	// snr of the complex echo amplitudes (interleaved IQ). y gets the phased decay (echoes)
+	double ph = t2_fit_phase(decay, echoes, y);
+	double c = cos(ph), s = sin(ph), q, noise = 0, signal = 0;
+	uint32_t e;
+
+	// the phase makes the sum of the quadrature part 0, so its rms has echoes-1 degrees of freedom
+	for (e = 0; e < echoes; e++)
+	{
+		q = decay[2 * e + 1] * c - decay[2 * e] * s;
+		noise += q * q;
+	}
+	noise = sqrt(noise / (echoes - 1));
+	for (e = 0; e < ADAPT_SIGNAL_ECHOES && e < echoes; e++)
+		signal += y[e];
+	signal /= e;
+
+	return (noise > 0) ? signal / noise : 0;
+}
+
+static void adapt_check(adaptive_avg * ad)
+{
+	t2_fit_result fit;
+	uint32_t e, met = 0;
+
+	for (e = 0; e < 2 * ad->echoes; e++)
+		ad->decay[e] = (float) ad->decay_sum[e];
+	ad->checked_scans = ad->scans;
+
+	ad->snr = adapt_decay_snr(ad->decay, ad->echoes, ad->y);
+	if (ad->snr_target > 0 && ad->snr >= ad->snr_target)
+		met = 1;
+
+	ad->t2 = 0;
+	ad->t2_rel_err = 0;
+	if (ad->t2_rel_target > 0
+			&& t2_fit(T2_MONO, ad->t, ad->y, ad->echoes, &fit) == 0)
+	{
+		ad->t2 = fit.p[1];
+		ad->t2_rel_err = fit.sigma[1] / fit.p[1];
+		if (ad->t2_rel_err <= ad->t2_rel_target)
+			met = 1;
+	}
+
+	if (met)
+		__atomic_store_n(&ad->reached, ad->scans, __ATOMIC_RELEASE);
+}
+
+void adapt_add_scan(adaptive_avg * ad, const float * scan_decay)
+{
+	// scan_decay: echo amplitudes of one complete scan, with the sign of the phase cycle already applied
+	uint32_t e;
+
+	for (e = 0; e < 2 * ad->echoes; e++)
+		ad->decay_sum[e] += scan_decay[e];
+	ad->scans++;
+
+	if (!__atomic_load_n(&ad->reached, __ATOMIC_RELAXED)
+			&& ad->scans >= ad->min_scans && ad->scans % ad->check_every == 0)
+	{
+		adapt_check(ad);
+	}
+}
+
+uint32_t adapt_reached(adaptive_avg * ad)
+{
+	// the scans it took to reach the target, 0 while it is not reached
+	return __atomic_load_n(&ad->reached, __ATOMIC_ACQUIRE);
+}
+
+void adapt_free(adaptive_avg * ad)
+{
+	free(ad->decay_sum);
+	free(ad->decay);
+	free(ad->t);
+	free(ad->y);
+	ad->decay_sum = NULL;
+	ad->decay = NULL;
+	ad->t = NULL;
+	ad->y = NULL;
+}
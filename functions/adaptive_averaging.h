@@ -0,0 +1,48 @@
+/*
+ * adaptive_averaging.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_ADAPTIVE_AVERAGING_H_
+#define FUNCTIONS_ADAPTIVE_AVERAGING_H_
+
+#include <stdint.h>
+
+#define ADAPT_SIGNAL_ECHOES	4	// the signal of the snr is the mean of this many first echoes
+
+// stop averaging as soon as the decay is good enough. The echo amplitudes of every scan (see echo_integrator) are summed
+// into a running decay, which is checked every check_every scans (a whole phase-cycle pair) once min_scans are summed:
+// - snr: mean of the first ADAPT_SIGNAL_ECHOES echoes of the phased decay over the rms of its quadrature part, which has
+//   no signal after the phase correction and is the noise of the echo integrals
+// - relative uncertainty of the T2 of the mono-exponential fit
+// The target is reached when any of the targets that are set (> 0) is met. adapt_add_scan may run in the scan pipeline
+// worker: the acquisition only polls adapt_reached.
+typedef struct
+{
+	double snr_target;		// 0: not used
+	double t2_rel_target;	// 0: not used
+	uint32_t min_scans;
+	uint32_t check_every;
+	uint32_t echoes;
+	double *decay_sum;		// running sum of the echo amplitudes (interleaved IQ)
+	float *decay;			// decay_sum of the last check
+	double *t;				// echo times (us)
+	double *y;				// phased decay of the last check
+	uint32_t scans;			// scans in decay_sum
+	uint32_t checked_scans;	// scans in decay_sum at the last check
+	double snr;				// of the last check
+	double t2;				// of the last check (0: no fit)
+	double t2_rel_err;
+	uint32_t reached;		// scans in decay_sum when the target was reached (0: not yet)
+} adaptive_avg;
+
+int adapt_init(adaptive_avg * ad, uint32_t echoes, double echo_time_us,
+		double snr_target, double t2_rel_target, uint32_t min_scans,
+		uint32_t check_every, uint32_t ph_cycl_en);
+void adapt_add_scan(adaptive_avg * ad, const float * scan_decay);
+uint32_t adapt_reached(adaptive_avg * ad);
+double adapt_decay_snr(const float * decay, uint32_t echoes, double * y);
+void adapt_free(adaptive_avg * ad);
+
+#endif /* FUNCTIONS_ADAPTIVE_AVERAGING_H_ */
@@ -0,0 +1,285 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rt_functions.h"
+#include "spsc_ring.h"
+#include "async_writer.h"
+
+static double async_wr_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+static void * async_wr_thread(void * arg)
+{
+	async_writer *wr = (async_writer *) arg;
+	scan_log_record *rec;
+	uint32_t *front, first, run, slot, k;
+	int n;
+	double t0, dt;
+
+	while (1)
+	{
+		while (sem_wait(&wr->filled) != 0 && errno == EINTR)
+			;
+
+		front = (uint32_t *) spsc_ring_front(&wr->queue);
+		if (front == NULL)
+		{ // the extra post from async_wr_close: every record is written
+			break;
+		}
+
+		// every queued record that follows in the pool goes into the same write
+		first = *front;
+		slot = first & (wr->num_bufs - 1);
+		run = spsc_ring_count(&wr->queue);
+		if (run > wr->num_bufs - slot)
+		{
+			run = wr->num_bufs - slot;
+		}
+
+		t0 = async_wr_now_us();
+		for (k = 0; k < run; k++)
+		{
+			rec = (scan_log_record *) (wr->pool + (size_t) (slot + k) * wr->stride);
+			wr->data_bytes += rec->length;
+			if (wr->compress)
+			{ // kept as it is when the encoding is not shorter
+				n = scan_codec_encode(&wr->codec, rec + 1, rec->length / sizeof(uint32_t),
+						wr->codec_type, wr->scratch, wr->scratch_size);
+				if (n > 0 && (uint32_t) n < rec->length)
+				{
+					memcpy(rec + 1, wr->scratch, n);
+					rec->length = n;
+					rec->encoding = SCAN_LOG_ENC_CODEC;
+				}
+			}
+			wr->stored_bytes += rec->length;
+			wr->bytes += scan_log_record_size(&wr->log, rec->length);
+		}
+		dt = async_wr_now_us() - t0;
+		wr->codec_us_sum += dt;
+
+		t0 = async_wr_now_us();
+		if (scan_log_write(&wr->log, wr->pool + (size_t) slot * wr->stride,
+				wr->stride, run) != 0)
+		{
+			wr->errors++;
+		}
+		dt = async_wr_now_us() - t0;
+		wr->writes++;
+		wr->write_us_sum += dt;
+		if (dt > wr->write_us_max)
+		{
+			wr->write_us_max = dt;
+		}
+
+		for (k = 0; k < run; k++)
+		{ // the buffers can be reused from now on
+			spsc_ring_pop(&wr->queue);
+		}
+		for (k = 1; k < run; k++)
+		{ // the posts of the other records of the write (each follows its push)
+			while (sem_wait(&wr->filled) != 0 && errno == EINTR)
+				;
+		}
+	}
+
+	return NULL;
+}
+
+int async_wr_open(async_writer * wr, char * pathname, char * kind,
+		uint32_t max_length, uint32_t num_bufs, uint32_t expected_records,
+		uint8_t direct, uint8_t drop_when_full, int io_cpu)
+{
+	// the scan log is opened as scan_log_open does. num_bufs: scans that can wait for the i/o thread (rounded up to a power of 2).
+	// io_cpu -1 leaves the i/o thread unpinned
+	uint32_t capacity = 1;
+	int err;
+
+	memset(wr, 0, sizeof(async_writer));
+	while (capacity < num_bufs)
+	{
+		capacity <<= 1;
+	}
+	if (capacity > ASYNC_WR_MAX_BUFS)
+	{
+		capacity = ASYNC_WR_MAX_BUFS;
+	}
+	wr->num_bufs = capacity;
+	wr->drop_when_full = drop_when_full;
+
+	if (scan_log_open(&wr->log, pathname, kind, max_length, expected_records,
+			direct) != 0)
+	{
+		return -1;
+	}
+	wr->stride = wr->log.stride;
+
+	if (spsc_ring_init(&wr->queue, wr->items, sizeof(uint32_t), capacity) != 0
+			|| posix_memalign((void **) &wr->pool, SCAN_LOG_BLOCK,
+					(size_t) capacity * wr->stride) != 0)
+	{
+		printf("\t[ERROR] cannot allocate the buffers of the scan writer\n");
+		scan_log_close(&wr->log);
+		wr->pool = NULL;
+		return -1;
+	}
+	memset(wr->pool, 0, (size_t) capacity * wr->stride);
+
+	if (sem_init(&wr->filled, 0, 0) != 0)
+	{
+		printf("\t[ERROR] scan writer semaphore cannot be created\n");
+		scan_log_close(&wr->log);
+		free(wr->pool);
+		wr->pool = NULL;
+		return -1;
+	}
+	err = pthread_create(&wr->thread, NULL, async_wr_thread, wr);
+	if (err != 0)
+	{
+		printf("\t[ERROR] scan writer thread cannot be created (error %d)\n", err);
+		sem_destroy(&wr->filled);
+		scan_log_close(&wr->log);
+		free(wr->pool);
+		wr->pool = NULL;
+		return -1;
+	}
+	if (io_cpu >= 0)
+	{
+		pin_thread_to_cpu(wr->thread, io_cpu);
+	}
+
+	return 0;
+}
+
+int async_wr_submit(async_writer * wr, volatile void * data, uint32_t length,
+		uint32_t seq, uint32_t word_offset, uint32_t flags)
+{
+	// copies length bytes of data into the next free buffer and queues it. word_offset: words of scan seq before data,
+	// when the scan is handed over in segments. Only one thread may submit
+	uint32_t queued = spsc_ring_count(&wr->queue);
+	uint32_t index = wr->records;
+	uint32_t polls = 0;
+	scan_log_record *rec;
+
+	if (length > wr->stride - sizeof(scan_log_record))
+	{
+		printf("\t[ERROR] scan of %d bytes does not fit in the scan writer records\n", length);
+		return -1;
+	}
+
+	wr->sum_queued += queued;
+	if (queued > wr->max_queued)
+	{
+		wr->max_queued = queued;
+	}
+	if (queued >= wr->num_bufs)
+	{
+		if (wr->drop_when_full)
+		{
+			wr->drops++;
+			return -1;
+		}
+		wr->stalls++;
+		while (spsc_ring_count(&wr->queue) >= wr->num_bufs)
+		{ // the i/o thread is behind: wait for the oldest buffer
+			rt_backoff(&polls);
+		}
+	}
+
+	rec = (scan_log_record *) (wr->pool
+			+ (size_t) (index & (wr->num_bufs - 1)) * wr->stride);
+	scan_log_stamp(rec, index, seq, word_offset, flags, wr->freq, length);
+	memcpy(rec + 1, (const void *) data, length);
+
+	spsc_ring_push(&wr->queue, &index);
+	wr->records++;
+	sem_post(&wr->filled);
+	return 0;
+}
+
+int async_wr_compress(async_writer * wr, scan_codec_type type,
+		uint32_t echo_len)
+{
+	// before the first submit: the scans are 32-bit words of that type, echo_len samples per echo (see scan_codec_init)
+	uint32_t words = (wr->stride - sizeof(scan_log_record)) / sizeof(uint32_t);
+
+	if (scan_codec_init(&wr->codec, words, echo_len) != 0)
+	{
+		return -1;
+	}
+	wr->scratch_size = scan_codec_bound(words);
+	wr->scratch = (uint8_t *) malloc(wr->scratch_size);
+	if (wr->scratch == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the buffer of the scan codec\n");
+		scan_codec_free(&wr->codec);
+		return -1;
+	}
+	wr->codec_type = type;
+	wr->compress = 1;
+	wr->log.sparse = 1; // the encoded records leave the rest of their stride unwritten
+	return 0;
+}
+
+void async_wr_close(async_writer * wr)
+{
+	// writes whatever is queued, then the index of the scan log
+	if (wr->pool == NULL)
+	{
+		return;
+	}
+	sem_post(&wr->filled);
+	pthread_join(wr->thread, NULL);
+	sem_destroy(&wr->filled);
+
+	if (scan_log_close(&wr->log) != 0)
+	{
+		wr->errors++;
+	}
+	free(wr->pool);
+	wr->pool = NULL;
+	if (wr->compress)
+	{
+		scan_codec_free(&wr->codec);
+		free(wr->scratch);
+		wr->scratch = NULL;
+	}
+}
+
+void async_wr_report(async_writer * wr, FILE * fp)
+{
+	// "key = value" lines, like acqu.par
+	fprintf(fp, "scanWrRecords = %d\n", wr->records);
+	fprintf(fp, "scanWrRecordStride = %d\n", wr->stride);
+	fprintf(fp, "scanWrCompress = %d\n", wr->compress);
+	fprintf(fp, "scanWrRatio = %.3f\n",
+			wr->stored_bytes ? (double) wr->data_bytes / wr->stored_bytes : 0);
+	fprintf(fp, "scanWrFileRatio = %.3f\n",
+			wr->bytes ? (double) wr->data_bytes / wr->bytes : 0);
+	if (wr->compress)
+		fprintf(fp, "scanWrMeanCodecUsPerScan = %.1f\n",
+				wr->records ? wr->codec_us_sum / wr->records : 0);
+	fprintf(fp, "scanWrDirect = %d\n", wr->log.direct);
+	fprintf(fp, "scanWrBuffers = %d\n", wr->num_bufs);
+	fprintf(fp, "scanWrMaxQueued = %d\n", wr->max_queued);
+	fprintf(fp, "scanWrMeanQueued = %.2f\n",
+			(wr->records + wr->drops) ?
+					(double) wr->sum_queued / (wr->records + wr->drops) : 0);
+	fprintf(fp, "scanWrStalls = %d\n", wr->stalls);
+	fprintf(fp, "scanWrDrops = %d\n", wr->drops);
+	fprintf(fp, "scanWrWrites = %d\n", wr->writes);
+	fprintf(fp, "scanWrMeanWriteUs = %.1f\n",
+			wr->writes ? wr->write_us_sum / wr->writes : 0);
+	fprintf(fp, "scanWrMaxWriteUs = %.1f\n", wr->write_us_max);
+	fprintf(fp, "scanWrErrors = %d\n", wr->errors);
+}
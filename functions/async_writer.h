@@ -0,0 +1,70 @@
+/*
+ * async_writer.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_ASYNC_WRITER_H_
+#define FUNCTIONS_ASYNC_WRITER_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "scan_codec.h"
+#include "scan_log.h"
+#include "spsc_ring.h"
+
+#define ASYNC_WR_MAX_BUFS	SCAN_LOG_MAX_BATCH
+
+// background writer of the individual scans: the acquisition copies a scan into the next free buffer of a pool, already
+// as a scan_log record, and goes on. An i/o thread appends the queued buffers to the scan log, several records per write
+// when they are contiguous in the pool (and fill their stride). A full queue stalls the acquisition (or drops the scan).
+// With async_wr_compress the i/o thread also encodes every record with scan_codec (in its buffer) before it is written,
+// so the codec runs on the core of the i/o thread and not on the acquisition.
+typedef struct
+{
+	scan_log log;				// only touched by the i/o thread once it runs
+	uint8_t drop_when_full;
+	uint32_t stride;			// bytes per buffer (log.stride)
+	uint32_t num_bufs;			// power of 2
+	uint8_t *pool;				// num_bufs records, record n in buffer n % num_bufs
+	spsc_ring queue;			// record numbers waiting to be written
+	uint32_t items[ASYNC_WR_MAX_BUFS];
+	pthread_t thread;
+	sem_t filled;				// posted for every record queued, and once more to stop the thread
+	uint32_t records;			// records queued (the next record number)
+	double freq;				// MHz, stamped into the records submitted from now on
+	uint8_t compress;
+	scan_codec_type codec_type;
+	scan_codec codec;
+	uint8_t *scratch;			// encoded record, before it goes back into its buffer
+	uint32_t scratch_size;
+
+	// statistics
+	uint32_t drops;				// scans not written because the queue was full
+	uint32_t stalls;			// scans that waited for a free buffer
+	uint32_t max_queued;
+	uint64_t sum_queued;		// queue level at every submit, for the mean
+	uint32_t writes;			// write calls of the i/o thread
+	uint64_t bytes;				// written, with the record headers and padding
+	uint64_t data_bytes;		// of the scans as submitted
+	uint64_t stored_bytes;		// of the scans as written (encoded or not)
+	double codec_us_sum;
+	double write_us_max;
+	double write_us_sum;
+	uint32_t errors;
+} async_writer;
+
+int async_wr_open(async_writer * wr, char * pathname, char * kind,
+		uint32_t max_length, uint32_t num_bufs, uint32_t expected_records,
+		uint8_t direct, uint8_t drop_when_full, int io_cpu);
+int async_wr_submit(async_writer * wr, volatile void * data, uint32_t length,
+		uint32_t seq, uint32_t word_offset, uint32_t flags);
+int async_wr_compress(async_writer * wr, scan_codec_type type,
+		uint32_t echo_len);
+void async_wr_close(async_writer * wr);
+void async_wr_report(async_writer * wr, FILE * fp);
+
+#endif /* FUNCTIONS_ASYNC_WRITER_H_ */
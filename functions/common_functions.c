@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <hwlib.h>
+#include <limits.h>
 #include <math.h>
 #include <socal/alt_gpio.h>
 #include <socal/hps.h>
@@ -17,36 +18,189 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 #include "AlteraIP/altera_avalon_fifo_regs.h"
+#include "rt_functions.h"
+
+void rd_FIFO_block(void *FIFO_data_addr, int * buf32, unsigned int length)
+{
+	// read length words from the fifo data port. The caller makes sure the fifo holds at least length words.
+	// the port is one constant address, so there is nothing to gain from wide (neon) loads: every word is still one
+	// bus read. Unrolling keeps the loop overhead out of the way of the back-to-back reads.
+	volatile unsigned int *port = (volatile unsigned int *) FIFO_data_addr;
+	unsigned int i = 0;
+
+	for (; i + 8 <= length; i += 8)
+	{
+		buf32[i] = *port;
+		buf32[i + 1] = *port;
+		buf32[i + 2] = *port;
+		buf32[i + 3] = *port;
+		buf32[i + 4] = *port;
+		buf32[i + 5] = *port;
+		buf32[i + 6] = *port;
+		buf32[i + 7] = *port;
+	}
+	for (; i < length; i++)
+	{
+		buf32[i] = *port;
+	}
+}
+
+unsigned int rd_FIFO_bulk(volatile unsigned int *FIFO_status_addr,
+		void *FIFO_data_addr, int * buf32, unsigned int length,
+		double * words_per_sec)
+{
+	// read whatever is in the fifo (at most length words). The level is read once per block, and the block is read without any
+	// status access in between. Returns the number of words read and, if words_per_sec is not NULL, the read throughput.
+
+	// local variables
+	uint32_t fifo_mem_level; // the fill level of fifo memory
+	unsigned int i = 0;
+	struct timespec t_start, t_end;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+	while (i < length)
+	{
+		fifo_mem_level = alt_read_word(
+				FIFO_status_addr + ALTERA_AVALON_FIFO_LEVEL_REG); // the fill level of FIFO memory
+		if (fifo_mem_level == 0)
+		{
+			break;
+		}
+		if (fifo_mem_level > length - i)
+		{
+			fifo_mem_level = length - i; // do not overrun the buffer
+		}
+		rd_FIFO_block(FIFO_data_addr, buf32 + i, fifo_mem_level);
+		i += fifo_mem_level;
+	}
+
+	if (words_per_sec != NULL)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t_end);
+		elapsed = (double) (t_end.tv_sec - t_start.tv_sec)
+				+ (double) (t_end.tv_nsec - t_start.tv_nsec) * 1e-9;
+		*words_per_sec = (elapsed > 0) ? (double) i / elapsed : 0;
+	}
+
+	return i;
+}
 
 unsigned int rd_FIFO(volatile unsigned int *FIFO_status_addr,
 		void *FIFO_data_addr, int * buf32)
 {
+	// read everything in the fifo (FIFO is 32-bit, while 1-sample is only 16-bit. FIFO organize this automatically)
+	return rd_FIFO_bulk(FIFO_status_addr, FIFO_data_addr, buf32, UINT_MAX,
+			NULL);
+}
+
+static double rd_FIFO_idle_ms(struct timespec * since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - since->tv_sec) * 1e3
+			+ (double) (now.tv_nsec - since->tv_nsec) * 1e-6;
+}
+
+unsigned int rd_FIFO_stream(volatile unsigned int *FIFO_status_addr,
+		void *FIFO_data_addr, int * buf32, unsigned int length,
+		unsigned int almostfull_lvl, void *fsm_status_addr, uint32_t fsm_run_msk,
+		unsigned int timeout_ms, uint8_t * fifo_ovf)
+{
+	// drains the fifo while the fsm is still running, so the scan is not limited by the fifo depth.
+	// the fifo is read in blocks every time it crosses the almost-full threshold, and whatever is left is read when the fsm stops.
+	// reading stops once length words are read, or when the fsm has stopped and the fifo is empty.
+	// it gives up (and returns the words read so far) when for timeout_ms no word came and the fsm did not change state,
+	// e.g. the fsm never started
 
 	// local variables
 	uint32_t fifo_mem_level; // the fill level of fifo memory
-	unsigned int i;
+	uint8_t fsm_seen_running = 0;
+	uint8_t fsm_running, fsm_was_running = 0;
+	unsigned int i = 0;
+	uint32_t polls = 0; // since the last block (see rt_backoff)
+	struct timespec progress; // last word read or fsm state change
 
-	// PRINT # of DATAS in FIFO
-	// fifo_mem_level = alt_read_word(h2p_adc_fifo_status_addr+ALTERA_AVALON_FIFO_LEVEL_REG); // the fill level of FIFO memory
-	// printf("num of data in fifo: %d\n",fifo_mem_level);
+	clock_gettime(CLOCK_MONOTONIC, &progress);
 
-	// READING DATA FROM FIFO
-	fifo_mem_level = alt_read_word(
-			FIFO_status_addr + ALTERA_AVALON_FIFO_LEVEL_REG); // the fill level of FIFO memory
-	for (i = 0; fifo_mem_level > 0; i++)
-	{ // FIFO is 32-bit, while 1-sample is only 16-bit. FIFO organize this automatically. So, fetch only amount_of_data shifted by 2 to get amount_of_data/2.
-		buf32[i] = alt_read_word(FIFO_data_addr);
+	alt_write_word(FIFO_status_addr + ALTERA_AVALON_FIFO_EVENT_REG,
+			ALTERA_AVALON_FIFO_EVENT_ALL); // clear the sticky events from the previous scan
+	alt_write_word(FIFO_status_addr + ALTERA_AVALON_FIFO_ALMOSTFULL_REG,
+			almostfull_lvl); // set the block size
 
-		fifo_mem_level--;
+	while (i < length)
+	{
+		fsm_running = (alt_read_word(fsm_status_addr) & fsm_run_msk) ? 1 : 0;
+		fsm_seen_running |= fsm_running;
+		if (fsm_running != fsm_was_running)
+		{
+			fsm_was_running = fsm_running;
+			clock_gettime(CLOCK_MONOTONIC, &progress);
+		}
+		else if (rd_FIFO_idle_ms(&progress) > timeout_ms)
+		{
+			printf("[ERROR] no fifo data for %d ms (fsm %s, %d of %d words read)\n",
+					timeout_ms, fsm_seen_running ? "stuck" : "never started", i, length);
+			break;
+		}
+
+		if (fsm_running
+				&& !(alt_read_word(FIFO_status_addr + ALTERA_AVALON_FIFO_STATUS_REG)
+						& ALTERA_AVALON_FIFO_STATUS_AF_MSK))
+		{
+			rt_backoff(&polls);
+			continue; // keep acquiring until a full block is available
+		}
+
+		fifo_mem_level = alt_read_word(
+				FIFO_status_addr + ALTERA_AVALON_FIFO_LEVEL_REG); // the fill level of FIFO memory
 		if (fifo_mem_level == 0)
 		{
-			fifo_mem_level = alt_read_word(
-					FIFO_status_addr + ALTERA_AVALON_FIFO_LEVEL_REG);
+			if (!fsm_running && (fsm_seen_running || i > 0))
+			{ // the fsm has stopped: give the last words in the pipeline a chance to land in the fifo
+				usleep(1);
+				fifo_mem_level = alt_read_word(
+						FIFO_status_addr + ALTERA_AVALON_FIFO_LEVEL_REG);
+				if (fifo_mem_level == 0)
+				{
+					break;
+				}
+			}
+			else
+			{
+				rt_backoff(&polls);
+				continue; // the fsm has not started yet
+			}
 		}
-		//usleep(1);
+
+		if (fifo_mem_level > length - i)
+		{
+			fifo_mem_level = length - i; // do not overrun the buffer
+		}
+		rd_FIFO_block(FIFO_data_addr, buf32 + i, fifo_mem_level);
+		i += fifo_mem_level;
+		polls = 0;
+		clock_gettime(CLOCK_MONOTONIC, &progress);
+	}
+
+	if (alt_read_word(FIFO_status_addr + ALTERA_AVALON_FIFO_EVENT_REG)
+			& ALTERA_AVALON_FIFO_EVENT_OVF_MSK)
+	{
+		*fifo_ovf = 1;
+		alt_write_word(FIFO_status_addr + ALTERA_AVALON_FIFO_EVENT_REG,
+				ALTERA_AVALON_FIFO_EVENT_OVF_MSK); // clear the overflow event
+	}
+	else
+	{
+		*fifo_ovf = 0;
 	}
-	usleep(100);
 
 	return i;
 }
@@ -55,8 +209,21 @@ void buf32_to_buf16(int * buf32, unsigned int * buf16, unsigned int length)
 {
 	unsigned int i, j;
 
+	i = 0;
 	j = 0;
-	for (i = 0; i < (length); i++)
+#ifdef __ARM_NEON
+	// 4 words are 8 samples: as uint16 lanes they are already in sample order (low half of every word first)
+	const uint16x8_t mask = vdupq_n_u16(0x3FFF);
+	uint16x8_t d;
+	for (; i + 4 <= length; i += 4, j += 8)
+	{
+		d = vandq_u16(vreinterpretq_u16_u32(vld1q_u32((uint32_t *) buf32 + i)),
+				mask);
+		vst1q_u32(buf16 + j, vmovl_u16(vget_low_u16(d)));
+		vst1q_u32(buf16 + j + 4, vmovl_u16(vget_high_u16(d)));
+	}
+#endif
+	for (; i < (length); i++)
 	{
 		buf16[j++] = ((unsigned int) buf32[i] & 0x3FFF); // 14 significant bit
 		buf16[j++] = ((unsigned int) (buf32[i] >> 16) & 0x3FFF); // 14 significant bit
@@ -64,6 +231,57 @@ void buf32_to_buf16(int * buf32, unsigned int * buf16, unsigned int length)
 
 }
 
+void accumulate_scan(volatile unsigned int * src, float * sum,
+		unsigned int length, float scale)
+{
+	// fused readback and accumulate: sum += scale * src in one pass, reading straight from the (uncached) sdram window
+	// so the scan is never copied into an intermediate buffer.
+	// scale carries both the phase-cycle sign and the 1/number_of_iteration averaging factor.
+	unsigned int i;
+	int d0, d1, d2, d3;
+
+	for (i = 0; i + 4 <= length; i += 4)
+	{ // issue the 4 bridge reads back to back before doing the float math
+		d0 = (int) src[i];
+		d1 = (int) src[i + 1];
+		d2 = (int) src[i + 2];
+		d3 = (int) src[i + 3];
+		sum[i] += (float) d0 * scale;
+		sum[i + 1] += (float) d1 * scale;
+		sum[i + 2] += (float) d2 * scale;
+		sum[i + 3] += (float) d3 * scale;
+	}
+	for (; i < length; i++)
+	{
+		sum[i] += (float) ((int) src[i]) * scale;
+	}
+}
+
+void accumulate_scan_raw(volatile unsigned int * src, float * sum,
+		unsigned int length, float scale)
+{
+	// same as accumulate_scan for the raw adc words: every 32-bit word carries two 14-bit samples,
+	// unpacked the same way as buf32_to_buf16. length is in words, sum has 2*length samples.
+	unsigned int i;
+	uint32_t w0, w1;
+
+	for (i = 0; i + 2 <= length; i += 2)
+	{
+		w0 = src[i];
+		w1 = src[i + 1];
+		sum[2 * i] += (float) (w0 & 0x3FFF) * scale;
+		sum[2 * i + 1] += (float) ((w0 >> 16) & 0x3FFF) * scale;
+		sum[2 * i + 2] += (float) (w1 & 0x3FFF) * scale;
+		sum[2 * i + 3] += (float) ((w1 >> 16) & 0x3FFF) * scale;
+	}
+	if (i < length)
+	{
+		w0 = src[i];
+		sum[2 * i] += (float) (w0 & 0x3FFF) * scale;
+		sum[2 * i + 1] += (float) ((w0 >> 16) & 0x3FFF) * scale;
+	}
+}
+
 void wr_File(char * pathname, unsigned int length, int * buf,
 		char binary_OR_ascii)
 {
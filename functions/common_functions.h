@@ -8,9 +8,21 @@
 #ifndef FUNCTIONS_COMMON_FUNCTIONS_H_
 #define FUNCTIONS_COMMON_FUNCTIONS_H_
 
+void rd_FIFO_block(void *FIFO_data_addr, int * buf32, unsigned int length);
+unsigned int rd_FIFO_bulk(volatile unsigned int *FIFO_status_addr,
+		void *FIFO_data_addr, int * buf32, unsigned int length,
+		double * words_per_sec);
 unsigned int rd_FIFO(volatile unsigned int *FIFO_status_addr,
 		void *FIFO_data_addr, int * buf32);
+unsigned int rd_FIFO_stream(volatile unsigned int *FIFO_status_addr,
+		void *FIFO_data_addr, int * buf32, unsigned int length,
+		unsigned int almostfull_lvl, void *fsm_status_addr, uint32_t fsm_run_msk,
+		unsigned int timeout_ms, uint8_t * fifo_ovf);
 void buf32_to_buf16(int * buf32, unsigned int * buf16, unsigned int length);
+void accumulate_scan(volatile unsigned int * src, float * sum,
+		unsigned int length, float scale);
+void accumulate_scan_raw(volatile unsigned int * src, float * sum,
+		unsigned int length, float scale);
 void wr_File(char * pathname, unsigned int length, int* buf,
 		char binary_OR_ascii);
 void print_progress(int iterate, int number_of_iteration);
@@ -0,0 +1,352 @@
+#include <hwlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "ddc_functions.h"
+
+int ddc_design_lowpass(int16_t * coeff, unsigned int taps, unsigned int dec)
+{
+	// hamming-windowed sinc lowpass with the cutoff at the decimated nyquist frequency (fs/(2*dec)),
+	// quantized so the taps sum to exactly DDC_COEFF_GAIN
+	unsigned int k;
+	double M = (double) taps - 1;
+	double fc = 0.5 / (double) dec; // cycles per input sample
+	double t, sum = 0;
+	double *h;
+	int qsum = 0;
+
+	if (taps == 0 || dec == 0)
+	{
+		printf("\t[ERROR] the ddc filter needs at least 1 tap and a decimation of at least 1\n");
+		return -1;
+	}
+
+	h = (double *) malloc(taps * sizeof(double));
+	if (h == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the ddc filter design buffer\n");
+		return -1;
+	}
+
+	for (k = 0; k < taps; k++)
+	{
+		t = (double) k - M / 2;
+		h[k] = (t == 0) ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+		if (taps > 1)
+			h[k] *= 0.54 - 0.46 * cos(2 * M_PI * k / M);
+		sum += h[k];
+	}
+	for (k = 0; k < taps; k++)
+	{
+		coeff[k] = (int16_t) lround(h[k] / sum * DDC_COEFF_GAIN);
+		qsum += coeff[k];
+	}
+	coeff[taps / 2] += DDC_COEFF_GAIN - qsum; // the rounding error goes into the center tap
+
+	free(h);
+	return 0;
+}
+
+int ddc_init(ddc_engine * ddc, unsigned int dec, unsigned int samples_per_echo,
+		const int16_t * coeff, unsigned int taps, unsigned int out_shift)
+{
+	// coeff = NULL designs the default filter of DDC_TAPS_PER_DEC*dec taps (taps is ignored).
+	// Loading the coefficients of the fpga fir (and its output shift) gives a bit-comparable reference of the fpga dconv data
+	int16_t *h = NULL;
+	unsigned int j, L;
+	long abs_sum = 0, sum = 0;
+
+	ddc->h_even = NULL;
+	ddc->h_odd = NULL;
+	ddc->mix_i = NULL;
+	ddc->mix_q = NULL;
+
+	if (dec == 0 || samples_per_echo % dec != 0 || samples_per_echo % 2 != 0)
+	{
+		printf("\t[ERROR] ddc needs an even samples_per_echo (%d) that is a multiple of the decimation (%d)\n",
+				samples_per_echo, dec);
+		return -1;
+	}
+
+	if (coeff == NULL)
+	{
+		taps = DDC_TAPS_PER_DEC * dec;
+		h = (int16_t *) malloc(taps * sizeof(int16_t));
+		if (h == NULL || ddc_design_lowpass(h, taps, dec) < 0)
+		{
+			free(h);
+			return -1;
+		}
+		coeff = h;
+	}
+	if (taps == 0)
+	{
+		printf("\t[ERROR] the ddc filter needs at least 1 tap\n");
+		return -1;
+	}
+
+	// the mixed samples are at most 2^13 in magnitude, so the int32 sum of the products is exact for sum|h| <= 2^17
+	for (j = 0; j < taps; j++)
+	{
+		abs_sum += abs(coeff[j]);
+		sum += coeff[j];
+	}
+	if (abs_sum > (1L << 17))
+	{
+		printf("\t[ERROR] the ddc filter gain (sum of |taps| = %ld) would overflow the int32 accumulator\n",
+				abs_sum);
+		free(h);
+		return -1;
+	}
+
+	L = (((taps + 1) / 2) + 3) & ~3u;
+	ddc->dec = dec;
+	ddc->samples_per_echo = samples_per_echo;
+	ddc->taps = taps;
+	ddc->phase_len = L;
+	ddc->dc = DDC_ADC_MIDSCALE;
+	ddc->out_shift = out_shift;
+	ddc->gain = (int32_t) sum;
+
+	ddc->h_even = (int16_t *) calloc(L, sizeof(int16_t));
+	ddc->h_odd = (int16_t *) calloc(L, sizeof(int16_t));
+	ddc->mix_i = (int16_t *) calloc(L + samples_per_echo / 2, sizeof(int16_t));
+	ddc->mix_q = (int16_t *) calloc(L + samples_per_echo / 2, sizeof(int16_t));
+	if (ddc->h_even == NULL || ddc->h_odd == NULL || ddc->mix_i == NULL
+			|| ddc->mix_q == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the ddc buffers\n");
+		free(h);
+		ddc_free(ddc);
+		return -1;
+	}
+
+	// tap 2j (2j+1) of the filter multiplies the sample j words before the newest one, so the branches are stored reversed
+	for (j = 0; 2 * j < taps; j++)
+	{
+		ddc->h_even[L - 1 - j] = coeff[2 * j];
+	}
+	for (j = 0; 2 * j + 1 < taps; j++)
+	{
+		ddc->h_odd[L - 1 - j] = coeff[2 * j + 1];
+	}
+
+	free(h);
+	return 0;
+}
+
+static int32_t ddc_dot(const int16_t * h, const int16_t * x, unsigned int len)
+{
+	// len is a multiple of 4
+	unsigned int j;
+#ifdef __ARM_NEON
+	int32x4_t acc = vdupq_n_s32(0);
+
+	for (j = 0; j < len; j += 4)
+	{
+		acc = vmlal_s16(acc, vld1_s16(h + j), vld1_s16(x + j));
+	}
+	return vgetq_lane_s32(acc, 0) + vgetq_lane_s32(acc, 1)
+			+ vgetq_lane_s32(acc, 2) + vgetq_lane_s32(acc, 3);
+#else
+	int32_t acc = 0;
+
+	for (j = 0; j < len; j++)
+	{
+		acc += (int32_t) h[j] * x[j];
+	}
+	return acc;
+#endif
+}
+
+unsigned int ddc_echo(ddc_engine * ddc, volatile unsigned int * raw, int * iq)
+{
+	// downconvert one echo of samples_per_echo/2 packed adc words into samples_per_echo/dec IQ pairs.
+	// Returns the number of words written to iq
+	const unsigned int *src = (const unsigned int *) raw;
+	unsigned int L = ddc->phase_len;
+	unsigned int words = ddc->samples_per_echo / 2;
+	unsigned int outputs = ddc->samples_per_echo / ddc->dec;
+	int16_t *mi = ddc->mix_i + L; // the L words before are the zero history
+	int16_t *mq = ddc->mix_q + L;
+	unsigned int k = 0, m, p;
+
+	// mix: word k holds sample 2k (low half, cos = (-1)^k) and sample 2k+1 (high half, -sin = -(-1)^k)
+#ifdef __ARM_NEON
+	const int16_t sign[4] =
+	{ 1, -1, 1, -1 };
+	int16x4_t sign_i = vld1_s16(sign);
+	int16x4_t sign_q = vneg_s16(sign_i);
+	int16x4_t dc = vdup_n_s16(ddc->dc);
+	uint32x4_t mask = vdupq_n_u32(0x3FFF);
+	uint32x4_t w;
+
+	for (; k + 4 <= words; k += 4)
+	{
+		w = vld1q_u32(src + k);
+		vst1_s16(mi + k,
+				vmul_s16(
+						vsub_s16(vreinterpret_s16_u16(vmovn_u32(vandq_u32(w, mask))),
+								dc), sign_i));
+		vst1_s16(mq + k,
+				vmul_s16(
+						vsub_s16(
+								vreinterpret_s16_u16(
+										vmovn_u32(vandq_u32(vshrq_n_u32(w, 16), mask))),
+								dc), sign_q));
+	}
+#endif
+	for (; k < words; k++)
+	{
+		mi[k] = (int16_t) ((int) (src[k] & 0x3FFF) - ddc->dc);
+		mq[k] = (int16_t) (ddc->dc - (int) ((src[k] >> 16) & 0x3FFF));
+		if (k & 1)
+		{
+			mi[k] = -mi[k];
+			mq[k] = -mq[k];
+		}
+	}
+
+	// filter: output m is taken at the last sample p of its block of dec samples.
+	// I uses the taps of the same parity as p, Q the taps of the other parity
+	for (m = 0; m < outputs; m++)
+	{
+		p = m * ddc->dec + ddc->dec - 1;
+		if (p & 1)
+		{
+			iq[2 * m] = ddc_dot(ddc->h_odd, mi + (p - 1) / 2 + 1 - L, L)
+					>> ddc->out_shift;
+			iq[2 * m + 1] = ddc_dot(ddc->h_even, mq + (p - 1) / 2 + 1 - L, L)
+					>> ddc->out_shift;
+		}
+		else
+		{
+			iq[2 * m] = ddc_dot(ddc->h_even, mi + p / 2 + 1 - L, L)
+					>> ddc->out_shift;
+			iq[2 * m + 1] = ddc_dot(ddc->h_odd, mq + p / 2 - L, L)
+					>> ddc->out_shift;
+		}
+	}
+
+	return 2 * outputs;
+}
+
+unsigned int ddc_scan(ddc_engine * ddc, volatile unsigned int * raw,
+		unsigned int echoes, int * iq)
+{
+	// downconvert a whole scan of echoes, laid out like the fpga dconv data (samples_per_echo*echoes*2/dec words)
+	unsigned int e, n = 0;
+
+	for (e = 0; e < echoes; e++)
+	{
+		n += ddc_echo(ddc, raw + e * (ddc->samples_per_echo / 2), iq + n);
+	}
+	return n;
+}
+
+void ddc_free(ddc_engine * ddc)
+{
+	free(ddc->h_even);
+	free(ddc->h_odd);
+	free(ddc->mix_i);
+	free(ddc->mix_q);
+	ddc->h_even = NULL;
+	ddc->h_odd = NULL;
+	ddc->mix_i = NULL;
+	ddc->mix_q = NULL;
+}
+
+unsigned int ddc_read_fir(volatile unsigned int * fir_addr, int16_t * coeff,
+		unsigned int max_taps)
+{
+	// the coefficients of an fpga fir (fir compiler ii with its coefficient interface in read mode: coefficient k in word k).
+	// Returns the number of taps, without the zero taps at the end
+	unsigned int k, taps = 0;
+
+	for (k = 0; k < max_taps; k++)
+	{
+		coeff[k] = (int16_t) (alt_read_word(fir_addr + k) & 0xFFFF);
+		if (coeff[k] != 0)
+		{
+			taps = k + 1;
+		}
+	}
+	return taps;
+}
+
+int ddc_sum_init(ddc_sum * ds, unsigned int dec, unsigned int samples_per_echo,
+		unsigned int echoes, uint32_t max_words, const int16_t * coeff,
+		unsigned int taps)
+{
+	// max_words: the longest piece of a scan given to ddc_sum_add, a multiple of samples_per_echo/2 (coeff as in ddc_init)
+	ds->iq = NULL;
+	ds->echo_words = samples_per_echo / 2;
+	if (ds->echo_words == 0 || max_words % ds->echo_words != 0)
+	{
+		printf("\t[ERROR] the ddc needs whole echoes (%d words) at a time, not %d words\n",
+				ds->echo_words, max_words);
+		return -1;
+	}
+	if (ddc_init(&ds->ddc, dec, samples_per_echo, coeff, taps, 0) < 0) // full precision, scaled once at the end
+	{
+		return -1;
+	}
+	if (ds->ddc.gain <= 0)
+	{
+		printf("\t[ERROR] the ddc filter has no dc gain (sum of the taps = %d)\n",
+				ds->ddc.gain);
+		ddc_free(&ds->ddc);
+		return -1;
+	}
+	ds->iq_per_echo = samples_per_echo * 2 / dec;
+	ds->max_words = max_words;
+	ds->iq = (int *) malloc(max_words / ds->echo_words * ds->iq_per_echo * sizeof(int));
+	if (ds->iq == NULL
+			|| int_acc_init(&ds->acc, echoes * ds->iq_per_echo, 31) < 0)
+	{
+		printf("\t[ERROR] cannot allocate the ddc sum\n");
+		free(ds->iq);
+		ds->iq = NULL;
+		ddc_free(&ds->ddc);
+		return -1;
+	}
+	return 0;
+}
+
+int ddc_sum_add(ddc_sum * ds, volatile unsigned int * raw, uint32_t pos,
+		uint32_t length, uint8_t negate)
+{
+	// downconverts length packed words, pos words into the scan, and adds (subtracts) them to the sum.
+	// pos and length are whole echoes. The caller ends every scan with int_acc_scan_done(&ds->acc)
+	uint32_t n;
+
+	if (pos % ds->echo_words != 0 || length % ds->echo_words != 0
+			|| length > ds->max_words)
+	{
+		return -1;
+	}
+	n = ddc_scan(&ds->ddc, raw, length / ds->echo_words, ds->iq);
+	int_acc_add_words(&ds->acc, (volatile unsigned int *) ds->iq,
+			pos / ds->echo_words * ds->iq_per_echo, n, negate);
+	return 0;
+}
+
+void ddc_sum_result(ddc_sum * ds, float * dst, double scale)
+{
+	// dst = scale * sum, in adc units (the filter gain divided out)
+	int_acc_result(&ds->acc, dst, scale / ds->ddc.gain);
+}
+
+void ddc_sum_free(ddc_sum * ds)
+{
+	int_acc_free(&ds->acc);
+	free(ds->iq);
+	ds->iq = NULL;
+	ddc_free(&ds->ddc);
+}
@@ -0,0 +1,69 @@
+/*
+ * ddc_functions.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_DDC_FUNCTIONS_H_
+#define FUNCTIONS_DDC_FUNCTIONS_H_
+
+#include <stdint.h>
+
+#include "int_accumulator.h"
+
+#define DDC_ADC_MIDSCALE	8192	// the 14-bit adc word of a 0 V input
+#define DDC_COEFF_GAIN		16384	// dc gain of the default (Q14) filter, so a single-tap filter (dec = 1) still fits in int16
+#define DDC_TAPS_PER_DEC	8		// length of the default filter per unit of decimation
+
+// software downconverter for raw adc data sampled at 4x the carrier (adc_ltc1746_freq = 4 * cpmg_freq).
+// At fs/4 the nco is the sequence cos = 1,0,-1,0 and -sin = 0,-1,0,1, so the even samples only feed I and the odd
+// samples only feed Q, which are exactly the low and the high half of every packed adc word. The mixing is a sign flip and
+// the lowpass decimator only needs the even taps or the odd taps of the filter for every output (2-phase polyphase FIR),
+// evaluated only at the decimated outputs.
+// Every echo is filtered on its own (zero history, nco phase 0 at the first sample of the echo) and gives
+// samples_per_echo/dec IQ pairs interleaved as I,Q,I,Q,.. like the fpga dconv stream.
+typedef struct
+{
+	unsigned int dec;				// decimation factor (dconv_fact)
+	unsigned int samples_per_echo;
+	unsigned int taps;
+	unsigned int phase_len;			// taps per polyphase branch, rounded up to a multiple of 4
+	int16_t *h_even;				// taps 0,2,4,.. reversed, zero-padded at the front to phase_len
+	int16_t *h_odd;					// taps 1,3,5,.. reversed, zero-padded at the front to phase_len
+	int16_t *mix_i;					// mixed even samples of one echo, after phase_len words of zero history
+	int16_t *mix_q;					// mixed odd samples of one echo, after phase_len words of zero history
+	int16_t dc;						// adc offset removed before mixing
+	unsigned int out_shift;			// right shift of the filter output (14 gives unity gain with the default filter)
+	int32_t gain;					// sum of the taps: dc gain of the filter before out_shift
+} ddc_engine;
+
+// exact sum of the downconverted scans. A scan can be added in segments (of whole echoes), so the slots of the sdram
+// ring are downconverted as they come in
+typedef struct
+{
+	ddc_engine ddc;
+	int_accumulator acc;			// IQ words of a scan, interleaved like the fpga dconv data
+	int *iq;						// downconverted words of one ddc_sum_add
+	uint32_t max_words;				// packed adc words per ddc_sum_add
+	uint32_t echo_words;			// packed adc words per echo
+	uint32_t iq_per_echo;			// IQ words per echo
+} ddc_sum;
+
+int ddc_design_lowpass(int16_t * coeff, unsigned int taps, unsigned int dec);
+int ddc_init(ddc_engine * ddc, unsigned int dec, unsigned int samples_per_echo,
+		const int16_t * coeff, unsigned int taps, unsigned int out_shift);
+unsigned int ddc_echo(ddc_engine * ddc, volatile unsigned int * raw, int * iq);
+unsigned int ddc_scan(ddc_engine * ddc, volatile unsigned int * raw,
+		unsigned int echoes, int * iq);
+void ddc_free(ddc_engine * ddc);
+unsigned int ddc_read_fir(volatile unsigned int * fir_addr, int16_t * coeff,
+		unsigned int max_taps);
+int ddc_sum_init(ddc_sum * ds, unsigned int dec, unsigned int samples_per_echo,
+		unsigned int echoes, uint32_t max_words, const int16_t * coeff,
+		unsigned int taps);
+int ddc_sum_add(ddc_sum * ds, volatile unsigned int * raw, uint32_t pos,
+		uint32_t length, uint8_t negate);
+void ddc_sum_result(ddc_sum * ds, float * dst, double scale);
+void ddc_sum_free(ddc_sum * ds);
+
+#endif /* FUNCTIONS_DDC_FUNCTIONS_H_ */
@@ -0,0 +1,207 @@
+#include <hwlib.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "AlteraIP/altera_avalon_fifo_regs.h"
+#include "avalon_dma.h"
+#include "dma_functions.h"
+#include "dma_emul.h"
+
+static double dma_emul_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+static void dma_emul_event(dma_emul * emu, uint32_t set)
+{
+	// the fifo event register is write-1-to-clear, which plain memory is not: a value in the register other than the one
+	// last put there is a write by the host, and the bits it wrote are cleared. The compare-and-swap keeps a host write
+	// that comes in between from being overwritten. OVF is always set together with F, so the host clearing OVF alone
+	// (as sdram_ring does) is told apart from the emulated register
+	uint32_t ev, upd;
+
+	if (emu->fifo_csr == NULL)
+	{
+		return;
+	}
+	do
+	{
+		ev = alt_read_word(emu->fifo_csr + ALTERA_AVALON_FIFO_EVENT_REG);
+		if (ev != emu->event)
+		{
+			emu->event &= ~ev;
+		}
+		upd = emu->event | set;
+	} while (ev != upd
+			&& !__atomic_compare_exchange_n(emu->fifo_csr + ALTERA_AVALON_FIFO_EVENT_REG,
+					&ev, upd, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+	emu->event = upd;
+}
+
+static void dma_emul_fill(dma_emul * emu)
+{
+	// the words the fsm has put out since the last call go into the fifo, or are lost when it is full
+	uint64_t target;
+	double dt;
+	uint32_t lost = 0;
+
+	pthread_mutex_lock(&emu->lock);
+	dt = (dma_emul_now_us() - emu->scan_t0_us) * emu->words_per_us;
+	target = emu->scan_start
+			+ ((dt < emu->scan_words) ? (uint64_t) dt : emu->scan_words);
+	pthread_mutex_unlock(&emu->lock);
+
+	while (emu->produced < target)
+	{
+		if (emu->fifo_level < emu->fifo_depth)
+		{
+			emu->fifo[(emu->fifo_rd + emu->fifo_level) % emu->fifo_depth] =
+					(uint32_t) emu->produced;
+			emu->fifo_level++;
+		}
+		else
+		{
+			lost++;
+		}
+		emu->produced++;
+	}
+	emu->lost += lost;
+	dma_emul_event(emu, lost ? ALTERA_AVALON_FIFO_EVENT_OVF_MSK | ALTERA_AVALON_FIFO_EVENT_F_MSK : 0);
+}
+
+static void * dma_emul_thread(void * arg)
+{
+	dma_emul *emu = (dma_emul *) arg;
+	volatile unsigned int *dst = NULL;
+	uint32_t ctrl = 0, remaining = 0, offset, moved;
+	uint8_t active = 0;
+
+	while (!__atomic_load_n(&emu->stop, __ATOMIC_ACQUIRE))
+	{
+		dma_emul_fill(emu);
+
+		if (active && alt_read_word(emu->dma_addr + DMA_STATUS_OFST) == 0)
+		{ // the host reset the dma (fifo_to_sdram_dma_trf_ctrl clears the status), e.g. to give up a transfer that cannot finish
+			active = 0;
+		}
+		if (!active && (alt_read_word(emu->dma_addr + DMA_CONTROL_OFST) & DMA_CTRL_GO_MSK))
+		{ // a new transfer: the registers are set up before GO
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			ctrl = alt_read_word(emu->dma_addr + DMA_CONTROL_OFST);
+			alt_write_word(emu->dma_addr + DMA_CONTROL_OFST,
+					ctrl & ~DMA_CTRL_GO_MSK);
+			offset = (alt_read_word(emu->dma_addr + DMA_WRITEADDR_OFST)
+					- emu->sdram_base) / 4;
+			remaining = alt_read_word(emu->dma_addr + DMA_LENGTH_OFST) / 4;
+			if (offset + remaining > emu->sdram_words)
+			{
+				printf("\t[ERROR] emulated dma writes past the sdram window (word %d + %d)\n",
+						offset, remaining);
+				remaining = (offset < emu->sdram_words) ? emu->sdram_words - offset : 0;
+			}
+			dst = emu->sdram_addr + offset;
+			alt_write_word(emu->dma_addr + DMA_STATUS_OFST, DMA_STAT_BUSY_MSK);
+			active = 1;
+		}
+
+		moved = 0;
+		if (active)
+		{
+			while (remaining > 0 && emu->fifo_level > 0)
+			{
+				moved++;
+				*dst++ = emu->fifo[emu->fifo_rd];
+				emu->fifo_rd = (emu->fifo_rd + 1) % emu->fifo_depth;
+				emu->fifo_level--;
+				remaining--;
+			}
+			if (moved > 0)
+			{ // only written when it changes, so it does not overwrite the length of the next transfer after a reset
+				alt_write_word(emu->dma_addr + DMA_LENGTH_OFST, remaining * 4);
+			}
+			if (remaining == 0)
+			{ // the data is written before DONE can be seen
+				__atomic_thread_fence(__ATOMIC_RELEASE);
+				alt_write_word(emu->dma_addr + DMA_STATUS_OFST,
+						DMA_STAT_DONE_MSK | DMA_STAT_LEN_MSK);
+				active = 0;
+				emu->transfers++;
+				if (emu->irq != NULL && (ctrl & DMA_CTRL_I_EN_MSK))
+					dma_irq_notify(emu->irq);
+			}
+		}
+		if (moved == 0)
+		{ // nothing to do until the fsm puts out more words (or the next transfer is started)
+			usleep(5);
+		}
+	}
+
+	return NULL;
+}
+
+int dma_emul_start(dma_emul * emu, volatile unsigned int * dma_addr,
+		volatile unsigned int * sdram_addr, uint32_t sdram_base,
+		uint32_t sdram_words, volatile unsigned int * fifo_csr,
+		uint32_t fifo_depth, double words_per_us, dma_irq * irq)
+{
+	// the thread runs until dma_emul_stop. No scan runs until dma_emul_scan
+	int err;
+
+	memset(emu, 0, sizeof(dma_emul));
+	emu->dma_addr = dma_addr;
+	emu->sdram_addr = sdram_addr;
+	emu->sdram_base = sdram_base;
+	emu->sdram_words = sdram_words;
+	emu->fifo_csr = fifo_csr;
+	emu->fifo_depth = fifo_depth;
+	emu->words_per_us = words_per_us;
+	emu->irq = irq;
+
+	emu->fifo = (uint32_t *) malloc(fifo_depth * sizeof(uint32_t));
+	if (emu->fifo == NULL || fifo_depth == 0)
+	{
+		printf("\t[ERROR] cannot allocate the emulated fifo\n");
+		free(emu->fifo);
+		return -1;
+	}
+	alt_write_word(dma_addr + DMA_STATUS_OFST, 0);
+	alt_write_word(dma_addr + DMA_CONTROL_OFST, 0);
+	alt_write_word(dma_addr + DMA_LENGTH_OFST, 0);
+
+	pthread_mutex_init(&emu->lock, NULL);
+	err = pthread_create(&emu->thread, NULL, dma_emul_thread, emu);
+	if (err != 0)
+	{
+		printf("\t[ERROR] emulated dma thread cannot be created (error %d)\n", err);
+		pthread_mutex_destroy(&emu->lock);
+		free(emu->fifo);
+		return -1;
+	}
+	return 0;
+}
+
+void dma_emul_scan(dma_emul * emu, uint32_t words)
+{
+	// like start_fsm: a scan of words starts filling the fifo. The previous scan counts as finished
+	pthread_mutex_lock(&emu->lock);
+	emu->scan_start += emu->scan_words;
+	emu->scan_words = words;
+	emu->scan_t0_us = dma_emul_now_us();
+	pthread_mutex_unlock(&emu->lock);
+}
+
+void dma_emul_stop(dma_emul * emu)
+{
+	__atomic_store_n(&emu->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(emu->thread, NULL);
+	pthread_mutex_destroy(&emu->lock);
+	free(emu->fifo);
+	emu->fifo = NULL;
+}
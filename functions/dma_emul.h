@@ -0,0 +1,60 @@
+/*
+ * dma_emul.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_DMA_EMUL_H_
+#define FUNCTIONS_DMA_EMUL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "dma_functions.h"
+
+// stand-in for the fifo-to-sdram dma and the fifo it reads, in plain memory, so that the code driving the dma
+// (sdram_ring, wait_dma) can be run without the fpga. A thread plays the hardware:
+// - the fsm: dma_emul_scan starts a scan, which fills the fifo with words_per_us words every us. The value of every word
+//   is its position in the stream of all the scans, so a reader can tell a word that was lost (a gap) from one that was read twice.
+//   When the fifo is full the incoming words are lost and the overflow bit of the fifo event register is set
+//   (write-1-to-clear like on the fpga, see dma_emul_event).
+// - the dma: once GO is written into the control register it moves the number of bytes in the length register from the
+//   fifo to the write address (relative to sdram_base, into sdram_addr), counting the length register down.
+//   Then it sets DONE and, with DMA_CTRL_I_EN_MSK, signals irq (an eventfd, see dma_irq_open_eventfd).
+//   Like the real dma it waits for words that never come, until it is reset (the status register cleared) or restarted.
+typedef struct
+{
+	volatile unsigned int *dma_addr;	// register map of the dma (DMA_CONTROL_OFST + 1 words at least)
+	volatile unsigned int *sdram_addr;	// memory standing in for the sdram window
+	uint32_t sdram_base;				// avalon address of sdram_addr as seen by the dma write master
+	uint32_t sdram_words;
+	volatile unsigned int *fifo_csr;	// register map of the fifo (ALTERA_AVALON_FIFO_EVENT_REG + 1 words at least, NULL: none)
+	uint32_t fifo_depth;				// words
+	double words_per_us;				// fifo fill rate while a scan runs
+	dma_irq *irq;						// NULL: no irq
+
+	pthread_t thread;
+	pthread_mutex_t lock;				// the scan below, set by the host thread
+	uint8_t stop;
+	uint64_t scan_start;				// stream position of the first word of the current scan
+	uint32_t scan_words;
+	double scan_t0_us;
+
+	// owned by the thread
+	uint32_t *fifo;
+	uint32_t fifo_rd;
+	uint32_t fifo_level;
+	uint32_t event;						// fifo event register as last written by the thread
+	uint64_t produced;					// stream position of the next word into the fifo
+	uint32_t lost;						// words lost to fifo overflows
+	uint32_t transfers;
+} dma_emul;
+
+int dma_emul_start(dma_emul * emu, volatile unsigned int * dma_addr,
+		volatile unsigned int * sdram_addr, uint32_t sdram_base,
+		uint32_t sdram_words, volatile unsigned int * fifo_csr,
+		uint32_t fifo_depth, double words_per_us, dma_irq * irq);
+void dma_emul_scan(dma_emul * emu, uint32_t words);
+void dma_emul_stop(dma_emul * emu);
+
+#endif /* FUNCTIONS_DMA_EMUL_H_ */
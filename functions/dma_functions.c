@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <hwlib.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "avalon_dma.h"
+#include "general.h"
+#include "rt_functions.h"
+#include "dma_functions.h"
+
+void check_dma(volatile unsigned int * dma_addr, uint8_t en_mesg)
+{
+	// this function waits until the dma addressed finishes its operation
+	unsigned int dma_status;
+	uint32_t polls = 0;
+	do
+	{
+		dma_status = alt_read_word(dma_addr + DMA_STATUS_OFST);
+		if (en_mesg)
+		{
+			printf("\tDMA Status reg: 0x%x\n", dma_status);
+			if (!(dma_status & DMA_STAT_DONE_MSK))
+			{
+				printf("\tDMA transaction is not done.\n");
+			}
+			if (dma_status & DMA_STAT_BUSY_MSK)
+			{
+				printf("\tDMA is busy.\n");
+
+				// print length register
+				printf("\t--> DMA length register: %d\n",
+						alt_read_word(dma_addr + DMA_LENGTH_OFST));	// set transfer length (in byte, so multiply by 4 to get word-addressing));
+
+				// wait time in case of DMA busy. Only valid under ENABLE_MESSAGE because the loop needs to be fast otherwise
+				unsigned int wait_time_ms = 500;
+				usleep(wait_time_ms * 1000); // wait time to prevent overloading the DMA bus arbitration request only if the dma is busy
+				printf("\t---> waiting for %d ms ...\n", wait_time_ms);
+			}
+		}
+		else if (!(dma_status & DMA_STAT_DONE_MSK)
+				|| (dma_status & DMA_STAT_BUSY_MSK))
+		{ // a long transfer does not hold the cpu (see rt_backoff)
+			rt_backoff(&polls);
+		}
+	} while (!(dma_status & DMA_STAT_DONE_MSK)
+			|| (dma_status & DMA_STAT_BUSY_MSK)); // keep in the loop when the 'DONE' bit is '0' and 'BUSY' bit is '1'
+	if (en_mesg)
+	{
+		if (dma_status & DMA_STAT_REOP_MSK)
+		{
+			printf(
+					"\tDMA transaction completed due to end-of-packet on read side.\n");
+		}
+		if (dma_status & DMA_STAT_WEOP_MSK)
+		{
+			printf(
+					"\tDMA transaction completed due to end-of-packet on write side.\n");
+		}
+		if (dma_status & DMA_STAT_LEN_MSK)
+		{
+			printf(
+					"\tDMA transaction completed due to length-register decrements to 0.\n");
+		}
+	}
+}
+
+void fifo_to_sdram_dma_trf_ctrl(volatile unsigned int * dma_addr,
+		uint32_t rd_addr, uint32_t wr_addr, uint32_t transfer_length,
+		uint32_t ctrl_extra)
+{
+	// ctrl_extra is or-ed into the control register, e.g. DMA_CTRL_I_EN_MSK to raise an irq when the transfer is done
+	alt_write_word(dma_addr + DMA_CONTROL_OFST, DMA_CTRL_SWRST_MSK); // write twice to do software reset
+	alt_write_word(dma_addr + DMA_CONTROL_OFST, DMA_CTRL_SWRST_MSK); // software resetted
+	alt_write_word(dma_addr + DMA_STATUS_OFST, 0x0); 	// clear the DONE bit
+	alt_write_word(dma_addr + DMA_READADDR_OFST, rd_addr); // set DMA read address
+	alt_write_word(dma_addr + DMA_WRITEADDR_OFST, wr_addr);	// set DMA write address
+	alt_write_word(dma_addr + DMA_LENGTH_OFST, transfer_length * 4);// set transfer length (in byte, so multiply by 4 to get word-addressing)
+	alt_write_word(dma_addr + DMA_CONTROL_OFST,
+			(DMA_CTRL_WORD_MSK | DMA_CTRL_LEEN_MSK | DMA_CTRL_RCON_MSK | ctrl_extra)); // set settings for transfer
+	alt_write_word(dma_addr + DMA_CONTROL_OFST,
+			(DMA_CTRL_WORD_MSK | DMA_CTRL_LEEN_MSK | DMA_CTRL_RCON_MSK
+					| ctrl_extra | DMA_CTRL_GO_MSK)); // set settings & also enable transfer
+}
+
+void fifo_to_sdram_dma_trf(volatile unsigned int * dma_addr, uint32_t rd_addr,
+		uint32_t wr_addr, uint32_t transfer_length)
+{
+	// the original conventional code
+	fifo_to_sdram_dma_trf_ctrl(dma_addr, rd_addr, wr_addr, transfer_length, 0);
+	//
+
+	/* burst method (tested. Doesn't really work with large data due to slow reinitialization. Generally burst mode only works and faster when the amount of data is less than max burst size. Otherwise It doesn't work)
+	 uint32_t burst_size = 1024; // the max burst size is set in QSYS in DMA section
+	 uint32_t transfer_remain = transfer_length*4; // multiplied by 4 to get word-addressing
+	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	DMA_CTRL_SWRST_MSK); 	// write twice to do software reset
+	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	DMA_CTRL_SWRST_MSK); 	// software resetted
+	 alt_write_word(dma_addr+DMA_READADDR_OFST,	rd_addr); 				// set DMA read address (fifo)
+	 uint32_t iaddr = 0;
+	 while (transfer_remain>burst_size) { // transfer with burst_size when remaining data is larger than burst_size
+	 alt_write_word(dma_addr+DMA_WRITEADDR_OFST,	wr_addr + iaddr);		// set DMA write address
+	 alt_write_word(dma_addr+DMA_LENGTH_OFST, burst_size);				// set transfer length (in byte, so multiply by 4 to get word-addressing)
+	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	(DMA_CTRL_WORD_MSK|DMA_CTRL_LEEN_MSK|DMA_CTRL_RCON_MSK)); // set settings for transfer
+	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	(DMA_CTRL_WORD_MSK|DMA_CTRL_LEEN_MSK|DMA_CTRL_RCON_MSK|DMA_CTRL_GO_MSK)); // set settings & also enable transfer
+	 transfer_remain -= burst_size;
+	 iaddr += (burst_size/4);
+	 check_dma(dma_addr, DISABLE_MESSAGE); // wait for the dma operation to complete
+	 }
+	 if (transfer_remain>0) { // transfer with the remaining data
+	 alt_write_word(dma_addr+DMA_WRITEADDR_OFST,	wr_addr + iaddr);		// set DMA write address
+	 alt_write_word(dma_addr+DMA_LENGTH_OFST, transfer_remain);			// set transfer length (in byte, so multiply by 4 to get word-addressing)
+	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	(DMA_CTRL_WORD_MSK|DMA_CTRL_LEEN_MSK|DMA_CTRL_RCON_MSK)); // set settings for transfer
+	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	(DMA_CTRL_WORD_MSK|DMA_CTRL_LEEN_MSK|DMA_CTRL_RCON_MSK|DMA_CTRL_GO_MSK)); // set settings & also enable transfer
+	 check_dma(dma_addr, DISABLE_MESSAGE); // wait for the dma operation to complete
+	 }
+	 */
+}
+
+void reset_dma(volatile unsigned int * dma_addr)
+{
+	alt_write_word(dma_addr + DMA_CONTROL_OFST, DMA_CTRL_SWRST_MSK); // write twice to do software reset
+	alt_write_word(dma_addr + DMA_CONTROL_OFST, DMA_CTRL_SWRST_MSK); // software resetted
+}
+
+int dma_irq_open_uio(dma_irq * irq, const char * dev, int timeout_ms)
+{
+	// the dma irq is exposed by a uio device (uio_pdrv_genirq): read() blocks until the irq fires and writing 1 re-enables it.
+	// when the device cannot be opened, fd is left at -1 and wait_dma falls back to polling the status register
+	irq->fd = open(dev, O_RDWR);
+	irq->is_uio = 1;
+	irq->timeout_ms = timeout_ms;
+	if (irq->fd < 0)
+	{
+		printf("\t[WARNING] could not open %s (%s). DMA completion falls back to polling.\n",
+				dev, strerror(errno));
+		return -1;
+	}
+	dma_irq_arm(irq);
+	return 0;
+}
+
+int dma_irq_open_eventfd(dma_irq * irq, int timeout_ms)
+{
+	// stand-in irq source: whoever emulates the dma sets the DONE bit and calls dma_irq_notify
+	irq->fd = eventfd(0, 0);
+	irq->is_uio = 0;
+	irq->timeout_ms = timeout_ms;
+	if (irq->fd < 0)
+	{
+		printf("\t[WARNING] eventfd() failed (%s)\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+void dma_irq_close(dma_irq * irq)
+{
+	if (irq->fd >= 0)
+	{
+		close(irq->fd);
+	}
+	irq->fd = -1;
+}
+
+void dma_irq_arm(dma_irq * irq)
+{
+	// uio disables the irq line every time it fires, so it has to be re-enabled before the next transfer
+	uint32_t irq_on = 1;
+
+	if (irq->fd >= 0 && irq->is_uio)
+	{
+		if (write(irq->fd, &irq_on, sizeof(irq_on)) != sizeof(irq_on))
+		{
+			printf("\t[WARNING] could not re-enable the DMA irq (%s)\n",
+					strerror(errno));
+		}
+	}
+}
+
+void dma_irq_notify(dma_irq * irq)
+{
+	// signal the stand-in irq source (eventfd only)
+	uint64_t one = 1;
+
+	if (irq->fd >= 0 && !irq->is_uio)
+	{
+		if (write(irq->fd, &one, sizeof(one)) != sizeof(one))
+		{
+			printf("\t[WARNING] could not signal the DMA irq (%s)\n",
+					strerror(errno));
+		}
+	}
+}
+
+int dma_irq_wait(dma_irq * irq)
+{
+	// sleeps until the irq fires. Returns 1 when an irq is received, 0 on timeout and -1 on error
+	struct pollfd pfd;
+	uint32_t uio_count;
+	uint64_t efd_count;
+	ssize_t rd_len;
+	int ret;
+
+	pfd.fd = irq->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	do
+	{
+		ret = poll(&pfd, 1, irq->timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+	if (ret <= 0)
+	{
+		return ret;
+	}
+
+	// consume the event
+	if (irq->is_uio)
+	{
+		rd_len = read(irq->fd, &uio_count, sizeof(uio_count));
+		ret = (rd_len == sizeof(uio_count)) ? 1 : -1;
+	}
+	else
+	{
+		rd_len = read(irq->fd, &efd_count, sizeof(efd_count));
+		ret = (rd_len == sizeof(efd_count)) ? 1 : -1;
+	}
+
+	return ret;
+}
+
+uint32_t dma_irq_ctrl(dma_irq * irq)
+{
+	// extra control bits for fifo_to_sdram_dma_trf_ctrl
+	return (irq != NULL && irq->fd >= 0) ? DMA_CTRL_I_EN_MSK : 0;
+}
+
+void wait_dma(volatile unsigned int * dma_addr, dma_irq * irq, uint8_t en_mesg)
+{
+	// waits until the dma finishes, sleeping on the irq instead of spinning on the status register.
+	// falls back to check_dma when no irq is available or when the irq does not come within the timeout
+	unsigned int dma_status;
+
+	if (irq == NULL || irq->fd < 0)
+	{
+		check_dma(dma_addr, en_mesg);
+		return;
+	}
+
+	dma_status = alt_read_word(dma_addr + DMA_STATUS_OFST);
+	while (!(dma_status & DMA_STAT_DONE_MSK) || (dma_status & DMA_STAT_BUSY_MSK))
+	{
+		if (dma_irq_wait(irq) <= 0)
+		{
+			if (en_mesg)
+			{
+				printf("\tDMA irq did not arrive, polling the status register.\n");
+			}
+			check_dma(dma_addr, en_mesg);
+			break;
+		}
+		dma_status = alt_read_word(dma_addr + DMA_STATUS_OFST); // the done bit is checked again as the irq line may be shared
+	}
+
+	alt_write_word(dma_addr + DMA_STATUS_OFST, 0x0); // clear the DONE bit, which also deasserts the irq
+	dma_irq_arm(irq);
+}
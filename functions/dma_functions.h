@@ -0,0 +1,40 @@
+/*
+ * dma_functions.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_DMA_FUNCTIONS_H_
+#define FUNCTIONS_DMA_FUNCTIONS_H_
+
+#include <stdint.h>
+
+// completion irq of a dma controller.
+// fd is a uio device on the board, or an eventfd standing in for the hardware irq. fd = -1 means the status register is polled
+typedef struct
+{
+	int fd;
+	uint8_t is_uio;		// 1: uio device (4-byte read, re-enabled by writing 1), 0: eventfd (8-byte read)
+	int timeout_ms;		// poll() timeout before falling back to polling the status register (-1 waits forever)
+} dma_irq;
+
+#define DMA_IRQ_NONE	{ -1, 0, 0 }
+
+void check_dma(volatile unsigned int * dma_addr, uint8_t en_mesg);
+void fifo_to_sdram_dma_trf(volatile unsigned int * dma_addr, uint32_t rd_addr,
+		uint32_t wr_addr, uint32_t transfer_length);
+void fifo_to_sdram_dma_trf_ctrl(volatile unsigned int * dma_addr,
+		uint32_t rd_addr, uint32_t wr_addr, uint32_t transfer_length,
+		uint32_t ctrl_extra);
+void reset_dma(volatile unsigned int * dma_addr);
+
+int dma_irq_open_uio(dma_irq * irq, const char * dev, int timeout_ms);
+int dma_irq_open_eventfd(dma_irq * irq, int timeout_ms);
+void dma_irq_close(dma_irq * irq);
+void dma_irq_arm(dma_irq * irq);
+void dma_irq_notify(dma_irq * irq);
+int dma_irq_wait(dma_irq * irq);
+uint32_t dma_irq_ctrl(dma_irq * irq);
+void wait_dma(volatile unsigned int * dma_addr, dma_irq * irq, uint8_t en_mesg);
+
+#endif /* FUNCTIONS_DMA_FUNCTIONS_H_ */
@@ -0,0 +1,168 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "echo_integrator.h"
+
+int echo_int_init(echo_integrator * ei, unsigned int points,
+		unsigned int echoes, unsigned int start, unsigned int width)
+{
+	// width = 0 takes the window from start to the end of the echo
+	unsigned int k;
+
+	if (width == 0 && start < points)
+	{
+		width = points - start;
+	}
+	if (width == 0 || start + width > points)
+	{
+		printf("\t[ERROR] echo window [%d, %d) is outside the %d points of the echo\n",
+				start, start + width, points);
+		return -1;
+	}
+
+	ei->points = points;
+	ei->echoes = echoes;
+	ei->start = start;
+	ei->width = width;
+	ei->w = (float *) malloc(2 * width * sizeof(float));
+	if (ei->w == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the echo weights\n");
+		return -1;
+	}
+
+	for (k = 0; k < width; k++)
+	{ // boxcar
+		ei->w[2 * k] = 1.0f / width;
+		ei->w[2 * k + 1] = 0;
+	}
+
+	return 0;
+}
+
+void echo_int_set_weights(echo_integrator * ei, const float * w)
+{
+	// w holds width complex weights, interleaved re,im
+	memcpy(ei->w, w, 2 * ei->width * sizeof(float));
+}
+
+int echo_int_matched(echo_integrator * ei, const float * iq)
+{
+	// matched filter from the averaged data iq (points*echoes IQ pairs): with s the echo shape averaged over all echoes and
+	// m the mean of s over the window, w[k] = conj(s[k]) * m / sum|s|^2.
+	// Returns -1 and keeps the current weights when the data has no echo to match
+	unsigned int e, k;
+	double s_re, s_im, m_re = 0, m_im = 0, energy = 0;
+	const float *x;
+	float *s = (float *) calloc(2 * ei->width, sizeof(float));
+
+	if (s == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the echo shape\n");
+		return -1;
+	}
+
+	for (e = 0; e < ei->echoes; e++)
+	{
+		x = iq + 2 * (e * ei->points + ei->start);
+		for (k = 0; k < 2 * ei->width; k++)
+		{
+			s[k] += x[k];
+		}
+	}
+	for (k = 0; k < ei->width; k++)
+	{
+		s_re = s[2 * k] / ei->echoes;
+		s_im = s[2 * k + 1] / ei->echoes;
+		s[2 * k] = (float) s_re;
+		s[2 * k + 1] = (float) s_im;
+		m_re += s_re;
+		m_im += s_im;
+		energy += s_re * s_re + s_im * s_im;
+	}
+	m_re /= ei->width;
+	m_im /= ei->width;
+
+	if (energy == 0)
+	{
+		printf("\t[WARNING] no echo to build the matched filter from, the window is averaged instead\n");
+		free(s);
+		return -1;
+	}
+
+	for (k = 0; k < ei->width; k++)
+	{ // conj(s) * m / energy
+		s_re = s[2 * k];
+		s_im = -s[2 * k + 1];
+		ei->w[2 * k] = (float) ((s_re * m_re - s_im * m_im) / energy);
+		ei->w[2 * k + 1] = (float) ((s_re * m_im + s_im * m_re) / energy);
+	}
+
+	free(s);
+	return 0;
+}
+
+void echo_int_apply(echo_integrator * ei, const float * iq, float * decay)
+{
+	// decay gets echoes complex amplitudes (interleaved re,im) of the averaged data iq
+	unsigned int e, k;
+	const float *x;
+	float a_re, a_im;
+
+	for (e = 0; e < ei->echoes; e++)
+	{
+		x = iq + 2 * (e * ei->points + ei->start);
+		a_re = 0;
+		a_im = 0;
+		for (k = 0; k < ei->width; k++)
+		{
+			a_re += ei->w[2 * k] * x[2 * k] - ei->w[2 * k + 1] * x[2 * k + 1];
+			a_im += ei->w[2 * k] * x[2 * k + 1] + ei->w[2 * k + 1] * x[2 * k];
+		}
+		decay[2 * e] = a_re;
+		decay[2 * e + 1] = a_im;
+	}
+}
+
+void echo_int_add_words(echo_integrator * ei, volatile unsigned int * src,
+		uint32_t offset, uint32_t length, float scale, float * decay)
+{
+	// add scale * the amplitudes of the signed 32-bit dconv words offset..offset+length-1 of a scan (src holds word offset)
+	// to decay. A scan can be added in any number of pieces, e.g. one sdram ring segment at a time
+	const int32_t *s = (const int32_t *) src;
+	uint32_t end = offset + length;
+	uint32_t echo_words = 2 * ei->points;
+	uint32_t e, q, lo, hi, base;
+	const float *w;
+	float x;
+
+	for (e = offset / echo_words; e < ei->echoes && e * echo_words < end; e++)
+	{
+		base = e * echo_words + 2 * ei->start;
+		lo = (base > offset) ? base : offset;
+		hi = (base + 2 * ei->width < end) ? base + 2 * ei->width : end;
+		for (q = lo; q < hi; q++)
+		{
+			x = scale * (float) s[q - offset];
+			w = ei->w + ((q - base) & ~1u);
+			if ((q - base) & 1)
+			{ // Q
+				decay[2 * e] -= w[1] * x;
+				decay[2 * e + 1] += w[0] * x;
+			}
+			else
+			{ // I
+				decay[2 * e] += w[0] * x;
+				decay[2 * e + 1] += w[1] * x;
+			}
+		}
+	}
+}
+
+void echo_int_free(echo_integrator * ei)
+{
+	free(ei->w);
+	ei->w = NULL;
+}
@@ -0,0 +1,34 @@
+/*
+ * echo_integrator.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_ECHO_INTEGRATOR_H_
+#define FUNCTIONS_ECHO_INTEGRATOR_H_
+
+#include <stdint.h>
+
+// reduces every echo of the downconverted data (points IQ pairs per echo, interleaved I,Q like the dconv stream)
+// to one complex amplitude: a[e] = sum_k w[k] * x[e][start+k] over a window of width IQ pairs.
+// The default weights average the window (boxcar). The matched filter weights the window with the shape of the averaged echo,
+// scaled so an echo that has exactly that shape gives the same amplitude as the boxcar.
+typedef struct
+{
+	unsigned int points;	// IQ pairs per echo
+	unsigned int echoes;
+	unsigned int start;		// first IQ pair of the window
+	unsigned int width;		// IQ pairs in the window
+	float *w;				// complex weights of the window, interleaved re,im
+} echo_integrator;
+
+int echo_int_init(echo_integrator * ei, unsigned int points,
+		unsigned int echoes, unsigned int start, unsigned int width);
+void echo_int_set_weights(echo_integrator * ei, const float * w);
+int echo_int_matched(echo_integrator * ei, const float * iq);
+void echo_int_apply(echo_integrator * ei, const float * iq, float * decay);
+void echo_int_add_words(echo_integrator * ei, volatile unsigned int * src,
+		uint32_t offset, uint32_t length, float scale, float * decay);
+void echo_int_free(echo_integrator * ei);
+
+#endif /* FUNCTIONS_ECHO_INTEGRATOR_H_ */
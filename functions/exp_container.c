@@ -0,0 +1,296 @@
+#define _FILE_OFFSET_BITS 64	// multi-GB runs on the 32-bit hps
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "exp_container.h"
+
+static uint64_t exp_cont_pad(uint64_t length)
+{
+	return (length + EXP_CONT_ALIGN - 1) & ~(uint64_t) (EXP_CONT_ALIGN - 1);
+}
+
+static int exp_cont_add_entry(exp_container * ec, const exp_cont_chunk * ch,
+		uint64_t offset)
+{
+	exp_cont_entry *e;
+
+	if (ec->entries == ec->capacity)
+	{
+		e = (exp_cont_entry *) realloc(ec->index,
+				(ec->capacity ? 2 * ec->capacity : 64) * sizeof(exp_cont_entry));
+		if (e == NULL)
+		{
+			printf("\t[ERROR] cannot grow the index of the experiment container\n");
+			return -1;
+		}
+		ec->index = e;
+		ec->capacity = ec->capacity ? 2 * ec->capacity : 64;
+	}
+	e = &ec->index[ec->entries++];
+	e->type = ch->type;
+	e->dtype = ch->dtype;
+	e->seq = ch->seq;
+	e->word_offset = ch->word_offset;
+	e->offset = offset;
+	e->length = ch->length;
+	return 0;
+}
+
+static int exp_cont_load(exp_container * ec, const exp_cont_header * hdr)
+{
+	// index of an existing file: from its index chunk, or by walking the chunks when the file was not closed.
+	// The next chunk overwrites the old index (or whatever is left after the last whole chunk)
+	exp_cont_chunk ch;
+	uint64_t pos = hdr->header_size, size, n;
+
+	fseeko(ec->fp, 0, SEEK_END);
+	size = (uint64_t) ftello(ec->fp);
+
+	if (hdr->index_offset != 0)
+	{
+		if (fseeko(ec->fp, (off_t) hdr->index_offset, SEEK_SET) != 0
+				|| fread(&ch, sizeof(ch), 1, ec->fp) != 1
+				|| ch.type != EXP_CHUNK_INDEX)
+		{
+			printf("\t[ERROR] the index of the experiment container is damaged\n");
+			return -1;
+		}
+		n = ch.length / sizeof(exp_cont_entry);
+		ec->index = (exp_cont_entry *) malloc((n ? n : 1) * sizeof(exp_cont_entry));
+		if (ec->index == NULL || fread(ec->index, sizeof(exp_cont_entry), n, ec->fp) != n)
+		{
+			printf("\t[ERROR] cannot read the index of the experiment container\n");
+			return -1;
+		}
+		ec->entries = ec->capacity = (uint32_t) n;
+		ec->end = hdr->index_offset;
+		fflush(ec->fp);
+		if (ftruncate(fileno(ec->fp), (off_t) ec->end) != 0)
+		{ // otherwise the old index would be walked as chunks if this run does not close the file
+			printf("\t[ERROR] cannot remove the old index of the experiment container\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	while (pos + sizeof(ch) <= size)
+	{
+		if (fseeko(ec->fp, (off_t) pos, SEEK_SET) != 0
+				|| fread(&ch, sizeof(ch), 1, ec->fp) != 1
+				|| pos + sizeof(ch) + ch.length > size)
+		{
+			break; // the last chunk was not completely written
+		}
+		if (exp_cont_add_entry(ec, &ch, pos + sizeof(ch)) < 0)
+			return -1;
+		pos += sizeof(ch) + exp_cont_pad(ch.length);
+	}
+	ec->end = pos;
+	return 0;
+}
+
+static int exp_cont_write_header(exp_container * ec, exp_cont_header * hdr)
+{
+	if (fseeko(ec->fp, 0, SEEK_SET) != 0
+			|| fwrite(hdr, sizeof(exp_cont_header), 1, ec->fp) != 1)
+	{
+		printf("\t[ERROR] cannot write the header of the experiment container\n");
+		return -1;
+	}
+	return 0;
+}
+
+int exp_cont_open(exp_container * ec, char * pathname, char * kind)
+{
+	// creates pathname, or opens it to append more chunks. kind is only used for a new file
+	exp_cont_header hdr;
+
+	memset(ec, 0, sizeof(exp_container));
+	ec->fp = fopen(pathname, "r+b");
+	if (ec->fp != NULL)
+	{
+		if (fread(&hdr, sizeof(hdr), 1, ec->fp) != 1 || hdr.magic != EXP_CONT_MAGIC
+				|| hdr.version != EXP_CONT_VERSION
+				|| hdr.chunk_header_size != sizeof(exp_cont_chunk))
+		{
+			printf("\t[ERROR] %s is not an experiment container\n", pathname);
+			fclose(ec->fp);
+			ec->fp = NULL;
+			return -1;
+		}
+		if (exp_cont_load(ec, &hdr) < 0)
+		{ // left as it is
+			fclose(ec->fp);
+			free(ec->index);
+			memset(ec, 0, sizeof(exp_container));
+			return -1;
+		}
+		hdr.index_offset = 0; // open for writing
+		hdr.index_entries = 0;
+		return exp_cont_write_header(ec, &hdr);
+	}
+
+	ec->fp = fopen(pathname, "w+b");
+	if (ec->fp == NULL)
+	{
+		printf("\t[ERROR] cannot create the experiment container %s\n", pathname);
+		return -1;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = EXP_CONT_MAGIC;
+	hdr.version = EXP_CONT_VERSION;
+	hdr.header_size = sizeof(exp_cont_header);
+	hdr.chunk_header_size = sizeof(exp_cont_chunk);
+	strncpy(hdr.kind, kind, sizeof(hdr.kind) - 1);
+	hdr.created = (int64_t) time(NULL);
+	ec->end = sizeof(exp_cont_header);
+	return exp_cont_write_header(ec, &hdr);
+}
+
+static exp_cont_param *exp_cont_new_param(exp_container * ec, const char * key)
+{
+	exp_cont_param *p;
+
+	if (ec->fp == NULL)
+		return NULL;
+	if (ec->num_params == ec->params_capacity)
+	{
+		p = (exp_cont_param *) realloc(ec->params,
+				(ec->params_capacity ? 2 * ec->params_capacity : 32)
+						* sizeof(exp_cont_param));
+		if (p == NULL)
+		{
+			printf("\t[ERROR] cannot store the parameter %s in the experiment container\n", key);
+			return NULL;
+		}
+		ec->params = p;
+		ec->params_capacity = ec->params_capacity ? 2 * ec->params_capacity : 32;
+	}
+	p = &ec->params[ec->num_params++];
+	memset(p, 0, sizeof(exp_cont_param));
+	strncpy(p->key, key, EXP_CONT_KEY_LEN - 1);
+	return p;
+}
+
+void exp_cont_param_d(exp_container * ec, const char * key, double value)
+{
+	exp_cont_param *p = exp_cont_new_param(ec, key);
+	if (p != NULL)
+	{
+		p->dtype = EXP_DT_F64;
+		p->v.d = value;
+	}
+}
+
+void exp_cont_param_i(exp_container * ec, const char * key, int64_t value)
+{
+	exp_cont_param *p = exp_cont_new_param(ec, key);
+	if (p != NULL)
+	{
+		p->dtype = EXP_DT_I64;
+		p->v.i = value;
+	}
+}
+
+int exp_cont_flush_params(exp_container * ec)
+{
+	// the parameters set since the last flush go into one PARM chunk. A later value of the same key replaces the earlier one
+	int ret = 0;
+
+	if (ec->fp == NULL)
+		return -1;
+	if (ec->num_params > 0)
+	{
+		ret = exp_cont_write(ec, EXP_CHUNK_PARAMS, EXP_DT_PARAM, 0, ec->params,
+				(uint64_t) ec->num_params * sizeof(exp_cont_param));
+		ec->num_params = 0;
+	}
+	if (fflush(ec->fp) != 0 || fsync(fileno(ec->fp)) != 0)
+	{ // on the disk, so they survive a crash of the run
+		printf("\t[WARNING] the parameters of the experiment container may not be on the disk\n");
+	}
+	return ret;
+}
+
+int exp_cont_write(exp_container * ec, uint32_t type, exp_dtype dtype,
+		uint32_t seq, const void * data, uint64_t length)
+{
+	// appends one chunk of length bytes
+	return exp_cont_write_at(ec, type, dtype, seq, 0, data, length);
+}
+
+int exp_cont_write_at(exp_container * ec, uint32_t type, exp_dtype dtype,
+		uint32_t seq, uint32_t word_offset, const volatile void * data,
+		uint64_t length)
+{
+	// same as exp_cont_write, for a chunk that holds the part of scan seq after word_offset words
+	static const uint8_t zeros[EXP_CONT_ALIGN] = { 0 };
+	exp_cont_chunk ch;
+	uint64_t pad = exp_cont_pad(length) - length;
+
+	if (ec->fp == NULL)
+		return -1;
+
+	ch.type = type;
+	ch.dtype = dtype;
+	ch.seq = seq;
+	ch.word_offset = word_offset;
+	ch.length = length;
+	if (fseeko(ec->fp, (off_t) ec->end, SEEK_SET) != 0
+			|| fwrite(&ch, sizeof(ch), 1, ec->fp) != 1
+			|| (length > 0 && fwrite((const void *) data, 1, length, ec->fp) != length)
+			|| (pad > 0 && fwrite(zeros, 1, pad, ec->fp) != pad))
+	{
+		printf("\t[ERROR] cannot write a chunk into the experiment container\n");
+		return -1;
+	}
+	if (exp_cont_add_entry(ec, &ch, ec->end + sizeof(ch)) < 0)
+		return -1;
+	ec->end += sizeof(ch) + length + pad;
+	return 0;
+}
+
+int exp_cont_close(exp_container * ec)
+{
+	// writes the pending parameters and the index, then points the header to the index
+	exp_cont_header hdr;
+	exp_cont_chunk ch;
+	int ret = -1;
+
+	if (ec->fp != NULL && exp_cont_flush_params(ec) == 0)
+	{
+		ch.type = EXP_CHUNK_INDEX;
+		ch.dtype = EXP_DT_BYTES;
+		ch.seq = 0;
+		ch.word_offset = 0;
+		ch.length = (uint64_t) ec->entries * sizeof(exp_cont_entry);
+		if (fseeko(ec->fp, (off_t) ec->end, SEEK_SET) == 0
+				&& fwrite(&ch, sizeof(ch), 1, ec->fp) == 1
+				&& fwrite(ec->index, sizeof(exp_cont_entry), ec->entries, ec->fp)
+						== ec->entries
+				&& fseeko(ec->fp, 0, SEEK_SET) == 0
+				&& fread(&hdr, sizeof(hdr), 1, ec->fp) == 1)
+		{
+			hdr.index_offset = ec->end;
+			hdr.index_entries = ec->entries;
+			ret = exp_cont_write_header(ec, &hdr);
+		}
+		else
+		{
+			printf("\t[ERROR] cannot write the index of the experiment container\n");
+		}
+	}
+
+	if (ec->fp != NULL)
+		fclose(ec->fp);
+	free(ec->index);
+	free(ec->params);
+	memset(ec, 0, sizeof(exp_container));
+	return ret;
+}
@@ -0,0 +1,116 @@
+/*
+ * exp_container.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_EXP_CONTAINER_H_
+#define FUNCTIONS_EXP_CONTAINER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// one binary file per experiment:
+//   exp_cont_header (at offset 0)
+//   chunks, each an exp_cont_chunk followed by its payload, padded to 8 bytes
+//   the index chunk: one exp_cont_entry per chunk before it
+// The header points to the index, so a reader maps the file, reads the index and goes straight to any chunk.
+// Every payload is 8-byte aligned and in the byte order of the board (little endian).
+// While the file is being written the index offset is 0: the chunks can still be walked one by one, which is also how
+// exp_cont_open rebuilds the index of a run that did not close its file. Opening an existing file appends after its last
+// chunk and rewrites the index when it is closed.
+
+#define EXP_CONT_MAGIC		0x58524D4E	// "NMRX"
+#define EXP_CONT_VERSION	1
+#define EXP_CONT_ALIGN		8
+#define EXP_CONT_KEY_LEN	32
+
+#define EXP_FOURCC(a,b,c,d)	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define EXP_CHUNK_PARAMS		EXP_FOURCC('P','A','R','M')	// exp_cont_param records
+#define EXP_CHUNK_AVERAGE		EXP_FOURCC('A','V','R','G')	// averaged scan (asum or dconv)
+#define EXP_CHUNK_DECAY			EXP_FOURCC('D','C','A','Y')	// echo amplitudes of the average
+#define EXP_CHUNK_SCAN_DECAY	EXP_FOURCC('S','D','C','Y')	// echo amplitudes of one scan, seq is the 0-based scan
+#define EXP_CHUNK_SCAN			EXP_FOURCC('S','C','A','N')	// data of one scan (or segment, see word_offset), seq is the 0-based scan
+#define EXP_CHUNK_INDEX			EXP_FOURCC('I','N','D','X')	// exp_cont_entry records
+
+typedef enum
+{
+	EXP_DT_BYTES = 0,
+	EXP_DT_F32,
+	EXP_DT_F64,
+	EXP_DT_I16,
+	EXP_DT_I32,
+	EXP_DT_I64,
+	EXP_DT_CF32,	// interleaved re,im float
+	EXP_DT_PARAM,	// exp_cont_param
+	EXP_DT_RAW14	// 32-bit words of 2 14-bit adc samples, low half first
+} exp_dtype;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;		// offset of the first chunk
+	uint32_t chunk_header_size;
+	uint64_t index_offset;		// offset of the index chunk, 0 while the file is open
+	uint64_t index_entries;
+	char kind[16];				// type of experiment, e.g. "cpmg"
+	int64_t created;			// unix time
+	uint8_t reserved[8];
+} exp_cont_header;
+
+typedef struct
+{
+	uint32_t type;
+	uint32_t dtype;
+	uint32_t seq;
+	uint32_t word_offset;		// words of scan seq before this chunk (0 unless a scan is written in segments)
+	uint64_t length;			// payload bytes, without the padding
+} exp_cont_chunk;
+
+typedef struct
+{
+	uint32_t type;
+	uint32_t dtype;
+	uint32_t seq;
+	uint32_t word_offset;
+	uint64_t offset;			// of the payload
+	uint64_t length;
+} exp_cont_entry;
+
+typedef struct
+{
+	char key[EXP_CONT_KEY_LEN];	// same names as acqu.par
+	uint32_t dtype;				// EXP_DT_F64 or EXP_DT_I64
+	uint32_t reserved;
+	union
+	{
+		double d;
+		int64_t i;
+	} v;
+} exp_cont_param;
+
+typedef struct
+{
+	FILE *fp;
+	uint64_t end;				// where the next chunk goes
+	exp_cont_entry *index;
+	uint32_t entries;
+	uint32_t capacity;
+	exp_cont_param *params;		// parameters not yet written (one PARM chunk per flush)
+	uint32_t num_params;
+	uint32_t params_capacity;
+} exp_container;
+
+int exp_cont_open(exp_container * ec, char * pathname, char * kind);
+void exp_cont_param_d(exp_container * ec, const char * key, double value);
+void exp_cont_param_i(exp_container * ec, const char * key, int64_t value);
+int exp_cont_flush_params(exp_container * ec);
+int exp_cont_write(exp_container * ec, uint32_t type, exp_dtype dtype,
+		uint32_t seq, const void * data, uint64_t length);
+int exp_cont_write_at(exp_container * ec, uint32_t type, exp_dtype dtype,
+		uint32_t seq, uint32_t word_offset, const volatile void * data,
+		uint64_t length);
+int exp_cont_close(exp_container * ec);
+
+#endif /* FUNCTIONS_EXP_CONTAINER_H_ */
@@ -0,0 +1,313 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "fft_functions.h"
+
+static fft_plan *fft_plans[FFT_MAX_PLANS];
+static unsigned int fft_plans_next = 0; // the slot replaced when the cache is full
+
+static void fft_plan_free(fft_plan * plan)
+{
+	free(plan->rev);
+	free(plan->tw);
+	free(plan->work);
+	free(plan);
+}
+
+void fft_plans_release(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < FFT_MAX_PLANS; i++)
+	{
+		if (fft_plans[i] != NULL)
+		{
+			fft_plan_free(fft_plans[i]);
+			fft_plans[i] = NULL;
+		}
+	}
+	fft_plans_next = 0;
+}
+
+fft_plan *fft_plan_get(unsigned int n)
+{
+	// returns the cached plan of length n (a power of 2), building it the first time
+	fft_plan *plan;
+	unsigned int i, k, m, log2n = 0, r;
+	float *tw;
+	double a;
+
+	for (i = 0; i < FFT_MAX_PLANS; i++)
+	{
+		if (fft_plans[i] != NULL && fft_plans[i]->n == n)
+			return fft_plans[i];
+	}
+
+	while ((1u << log2n) < n && log2n < FFT_MAX_LOG2N)
+		log2n++;
+	if (n < 2 || (1u << log2n) != n)
+	{
+		printf("\t[ERROR] fft length %d is not a power of 2 (2 to 2^%d)\n", n,
+				FFT_MAX_LOG2N);
+		return NULL;
+	}
+
+	plan = (fft_plan *) malloc(sizeof(fft_plan));
+	if (plan == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the fft plan\n");
+		return NULL;
+	}
+	plan->n = n;
+	plan->log2n = log2n;
+	plan->rev = (unsigned int *) malloc(n * sizeof(unsigned int));
+	plan->tw = (float *) malloc(4 * n * sizeof(float)); // the quarter lengths of all the stages add up to less than n
+	plan->work = (float *) malloc(2 * n * sizeof(float));
+	if (plan->rev == NULL || plan->tw == NULL || plan->work == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the fft plan of length %d\n", n);
+		fft_plan_free(plan);
+		return NULL;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		r = 0;
+		for (k = 0; k < log2n; k++)
+			r |= ((i >> k) & 1) << (log2n - 1 - k);
+		plan->rev[i] = r;
+	}
+
+	// twiddles of the block of 4m: W2 = exp(-2 pi j k / 4m) and W1 = W2^2
+	tw = plan->tw;
+	for (m = (log2n & 1) ? 2 : 1; 4 * m <= n; m *= 4)
+	{
+		for (k = 0; k < m; k++)
+		{
+			a = -2 * M_PI * k / (4 * m);
+			tw[k] = (float) cos(2 * a);
+			tw[m + k] = (float) sin(2 * a);
+			tw[2 * m + k] = (float) cos(a);
+			tw[3 * m + k] = (float) sin(a);
+		}
+		tw += 4 * m;
+	}
+
+	if (fft_plans[fft_plans_next] != NULL)
+		fft_plan_free(fft_plans[fft_plans_next]);
+	fft_plans[fft_plans_next] = plan;
+	fft_plans_next = (fft_plans_next + 1) % FFT_MAX_PLANS;
+
+	return plan;
+}
+
+static void fft_radix4_stage(float * x, unsigned int n, unsigned int m,
+		const float * tw)
+{
+	// combines the four sub-transforms of length m of every block of 4m
+	const float *w1r = tw, *w1i = tw + m, *w2r = tw + 2 * m, *w2i = tw + 3 * m;
+	unsigned int base, k = 0;
+	float *p0, *p1, *p2, *p3;
+	float t1r, t1i, t3r, t3i, b0r, b0i, b1r, b1i, b2r, b2i, b3r, b3i;
+	float u2r, u2i, u3r, u3i;
+
+	for (base = 0; base < n; base += 4 * m)
+	{
+		p0 = x + 2 * base;
+		p1 = p0 + 2 * m;
+		p2 = p1 + 2 * m;
+		p3 = p2 + 2 * m;
+		k = 0;
+#ifdef __ARM_NEON
+		for (; k + 4 <= m; k += 4)
+		{
+			float32x4x2_t x0 = vld2q_f32(p0 + 2 * k), x1 = vld2q_f32(p1 + 2 * k);
+			float32x4x2_t x2 = vld2q_f32(p2 + 2 * k), x3 = vld2q_f32(p3 + 2 * k);
+			float32x4_t wr = vld1q_f32(w1r + k), wi = vld1q_f32(w1i + k);
+			float32x4_t vt1r = vmlsq_f32(vmulq_f32(x1.val[0], wr), x1.val[1], wi);
+			float32x4_t vt1i = vmlaq_f32(vmulq_f32(x1.val[0], wi), x1.val[1], wr);
+			float32x4_t vt3r = vmlsq_f32(vmulq_f32(x3.val[0], wr), x3.val[1], wi);
+			float32x4_t vt3i = vmlaq_f32(vmulq_f32(x3.val[0], wi), x3.val[1], wr);
+			float32x4_t vb0r = vaddq_f32(x0.val[0], vt1r), vb0i = vaddq_f32(x0.val[1], vt1i);
+			float32x4_t vb1r = vsubq_f32(x0.val[0], vt1r), vb1i = vsubq_f32(x0.val[1], vt1i);
+			float32x4_t vb2r = vaddq_f32(x2.val[0], vt3r), vb2i = vaddq_f32(x2.val[1], vt3i);
+			float32x4_t vb3r = vsubq_f32(x2.val[0], vt3r), vb3i = vsubq_f32(x2.val[1], vt3i);
+			wr = vld1q_f32(w2r + k);
+			wi = vld1q_f32(w2i + k);
+			float32x4_t vu2r = vmlsq_f32(vmulq_f32(vb2r, wr), vb2i, wi);
+			float32x4_t vu2i = vmlaq_f32(vmulq_f32(vb2r, wi), vb2i, wr);
+			// W2*b3*(-j)
+			float32x4_t vu3r = vmlaq_f32(vmulq_f32(vb3r, wi), vb3i, wr);
+			float32x4_t vu3i = vnegq_f32(vmlsq_f32(vmulq_f32(vb3r, wr), vb3i, wi));
+			x0.val[0] = vaddq_f32(vb0r, vu2r);
+			x0.val[1] = vaddq_f32(vb0i, vu2i);
+			x2.val[0] = vsubq_f32(vb0r, vu2r);
+			x2.val[1] = vsubq_f32(vb0i, vu2i);
+			x1.val[0] = vaddq_f32(vb1r, vu3r);
+			x1.val[1] = vaddq_f32(vb1i, vu3i);
+			x3.val[0] = vsubq_f32(vb1r, vu3r);
+			x3.val[1] = vsubq_f32(vb1i, vu3i);
+			vst2q_f32(p0 + 2 * k, x0);
+			vst2q_f32(p1 + 2 * k, x1);
+			vst2q_f32(p2 + 2 * k, x2);
+			vst2q_f32(p3 + 2 * k, x3);
+		}
+#endif
+		for (; k < m; k++)
+		{
+			t1r = p1[2 * k] * w1r[k] - p1[2 * k + 1] * w1i[k];
+			t1i = p1[2 * k] * w1i[k] + p1[2 * k + 1] * w1r[k];
+			t3r = p3[2 * k] * w1r[k] - p3[2 * k + 1] * w1i[k];
+			t3i = p3[2 * k] * w1i[k] + p3[2 * k + 1] * w1r[k];
+			b0r = p0[2 * k] + t1r;
+			b0i = p0[2 * k + 1] + t1i;
+			b1r = p0[2 * k] - t1r;
+			b1i = p0[2 * k + 1] - t1i;
+			b2r = p2[2 * k] + t3r;
+			b2i = p2[2 * k + 1] + t3i;
+			b3r = p2[2 * k] - t3r;
+			b3i = p2[2 * k + 1] - t3i;
+			u2r = b2r * w2r[k] - b2i * w2i[k];
+			u2i = b2r * w2i[k] + b2i * w2r[k];
+			u3r = b3r * w2i[k] + b3i * w2r[k]; // W2*b3*(-j)
+			u3i = -(b3r * w2r[k] - b3i * w2i[k]);
+			p0[2 * k] = b0r + u2r;
+			p0[2 * k + 1] = b0i + u2i;
+			p2[2 * k] = b0r - u2r;
+			p2[2 * k + 1] = b0i - u2i;
+			p1[2 * k] = b1r + u3r;
+			p1[2 * k + 1] = b1i + u3i;
+			p3[2 * k] = b1r - u3r;
+			p3[2 * k + 1] = b1i - u3i;
+		}
+	}
+}
+
+void fft_forward(const fft_plan * plan, float * x)
+{
+	// X[k] = sum_i x[i] exp(-2 pi j i k / n), in place
+	unsigned int n = plan->n, i, r, m;
+	const float *tw = plan->tw;
+	float tr, ti;
+
+	for (i = 0; i < n; i++)
+	{
+		r = plan->rev[i];
+		if (r > i)
+		{
+			tr = x[2 * i];
+			ti = x[2 * i + 1];
+			x[2 * i] = x[2 * r];
+			x[2 * i + 1] = x[2 * r + 1];
+			x[2 * r] = tr;
+			x[2 * r + 1] = ti;
+		}
+	}
+
+	if (plan->log2n & 1)
+	{ // radix-2 stage
+		for (i = 0; i < 2 * n; i += 4)
+		{
+			tr = x[i + 2];
+			ti = x[i + 3];
+			x[i + 2] = x[i] - tr;
+			x[i + 3] = x[i + 1] - ti;
+			x[i] += tr;
+			x[i + 1] += ti;
+		}
+	}
+
+	for (m = (plan->log2n & 1) ? 2 : 1; 4 * m <= n; m *= 4)
+	{
+		fft_radix4_stage(x, n, m, tw);
+		tw += 4 * m;
+	}
+}
+
+unsigned int fft_length(unsigned int samples, unsigned int zero_fill)
+{
+	// the power of 2 that holds samples, times zero_fill (rounded up to a power of 2)
+	unsigned int n = 2;
+
+	while (n < samples)
+		n <<= 1;
+	while (zero_fill > 1)
+	{
+		n <<= 1;
+		zero_fill = (zero_fill + 1) >> 1;
+	}
+	return n;
+}
+
+float *fft_spectrum(fft_plan * plan, const float * re, const float * im,
+		unsigned int samples, fft_apod apod, double apod_param, double dwell_us)
+{
+	// apodizes samples points of re (and im, NULL for real data), zero-fills them to the plan length and transforms them
+	// into plan->work, which is returned
+	float *x = plan->work;
+	unsigned int i;
+	double t, w = 1;
+	double lb = M_PI * apod_param * 1e-3; // kHz to rad/us
+
+	if (samples > plan->n)
+		samples = plan->n;
+
+	for (i = 0; i < samples; i++)
+	{
+		t = i * dwell_us;
+		switch (apod)
+		{
+		case FFT_APOD_EXP:
+			w = exp(-lb * t);
+			break;
+		case FFT_APOD_GAUSS:
+			w = exp(-(lb * t) * (lb * t) / (4 * M_LN2));
+			break;
+		case FFT_APOD_HANN:
+			w = 0.5 * (1 + cos(M_PI * i / samples));
+			break;
+		default:
+			w = 1;
+			break;
+		}
+		x[2 * i] = (float) (re[i] * w);
+		x[2 * i + 1] = (im != NULL) ? (float) (im[i] * w) : 0;
+	}
+	memset(x + 2 * samples, 0, 2 * (plan->n - samples) * sizeof(float));
+
+	fft_forward(plan, x);
+	return x;
+}
+
+int fft_write_spectrum(char * pathname, const float * spec, unsigned int n,
+		double samp_freq, double center_freq)
+{
+	// ascii "frequency magnitude phase" per line, from -samp_freq/2 to samp_freq/2 around center_freq.
+	// The frequencies are in the unit of samp_freq (MHz in the tree), the phase in degrees
+	FILE *fp = fopen(pathname, "w");
+	unsigned int i, k;
+	double re, im;
+
+	if (fp == NULL)
+	{
+		printf("\t[ERROR] cannot open %s\n", pathname);
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		k = (i + n / 2) % n; // dc in the middle
+		re = spec[2 * k];
+		im = spec[2 * k + 1];
+		fprintf(fp, "%f\t%f\t%f\n",
+				center_freq + ((double) i - n / 2) * samp_freq / n,
+				sqrt(re * re + im * im), atan2(im, re) * 180 / M_PI);
+	}
+	fclose(fp);
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * fft_functions.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_FFT_FUNCTIONS_H_
+#define FUNCTIONS_FFT_FUNCTIONS_H_
+
+#define FFT_MAX_PLANS	8			// plans kept by fft_plan_get (one per length)
+#define FFT_MAX_LOG2N	24
+
+typedef enum
+{
+	FFT_APOD_NONE = 0,	// rectangular
+	FFT_APOD_EXP,		// exponential line broadening of apod_param kHz
+	FFT_APOD_GAUSS,		// gaussian line broadening of apod_param kHz (fwhm)
+	FFT_APOD_HANN		// half hann window, from 1 at the first sample to 0 after the last one
+} fft_apod;
+
+// complex fft of a power-of-2 length, in place on interleaved re,im floats.
+// The input is put in bit-reversed order and the radix-2 stages are fused in pairs (radix-2^2 butterflies),
+// so every pass over the data does the work of a radix-4 stage. A single radix-2 stage goes first when log2(n) is odd.
+// Everything a transform needs (twiddles, bit-reversal table, a work buffer for fft_spectrum) is in the plan,
+// so running a plan does not allocate. A plan stays valid until FFT_MAX_PLANS other lengths have been requested.
+typedef struct
+{
+	unsigned int n;
+	unsigned int log2n;
+	unsigned int *rev;	// bit-reversed index of every sample
+	float *tw;			// per radix-4 stage of quarter length m: W1 re[m], W1 im[m], W2 re[m], W2 im[m]
+	float *work;		// 2n floats, the output of fft_spectrum
+} fft_plan;
+
+fft_plan *fft_plan_get(unsigned int n);
+void fft_plans_release(void);
+void fft_forward(const fft_plan * plan, float * x);
+unsigned int fft_length(unsigned int samples, unsigned int zero_fill);
+float *fft_spectrum(fft_plan * plan, const float * re, const float * im,
+		unsigned int samples, fft_apod apod, double apod_param, double dwell_us);
+int fft_write_spectrum(char * pathname, const float * spec, unsigned int n,
+		double samp_freq, double center_freq);
+
+#endif /* FUNCTIONS_FFT_FUNCTIONS_H_ */
@@ -138,3 +138,5 @@
 
 #define SAV_BINARY		1 // save data in binary format
 #define SAV_ASCII		0 // save data in ascii format
+
+#define FSM_TIMEOUT_MS	10000 // the acquisition gives up on a scan that shows no progress (no data, no fsm state change) for this long
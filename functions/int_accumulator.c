@@ -0,0 +1,212 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "int_accumulator.h"
+
+int int_acc_init(int_accumulator * acc, uint32_t length,
+		unsigned int sample_bits)
+{
+	// every sample added is smaller than 2^sample_bits in magnitude (e.g. 14 for the raw adc data)
+	acc->length = length;
+	acc->scans = 0;
+	acc->scans_since_spill = 0;
+	acc->acc32 = NULL;
+	acc->spill_every = 0;
+
+	acc->acc64 = (int64_t *) calloc(length, sizeof(int64_t));
+	if (acc->acc64 == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the integer accumulator\n");
+		return -1;
+	}
+	if (sample_bits <= 30)
+	{
+		acc->acc32 = (int32_t *) calloc(length, sizeof(int32_t));
+		if (acc->acc32 == NULL)
+		{
+			printf("\t[ERROR] cannot allocate the integer accumulator\n");
+			free(acc->acc64);
+			acc->acc64 = NULL;
+			return -1;
+		}
+		acc->spill_every = (1u << (31 - sample_bits)) - 1; // |sum| < 2^31 after this many scans
+	}
+
+	return 0;
+}
+
+void int_acc_add_words(int_accumulator * acc, volatile unsigned int * src,
+		uint32_t offset, uint32_t length, uint8_t negate)
+{
+	// add (or subtract) length signed 32-bit samples of src to the samples offset.. of the sum (e.g. the downconverted data)
+	const int32_t *s = (const int32_t *) src;
+	uint32_t i = 0;
+
+	if (acc->acc32 != NULL)
+	{
+		// int32 lanes are summed modulo 2^32, which is exact as long as the spill keeps the true sum within int32
+		int32_t *a = acc->acc32 + offset;
+#ifdef __ARM_NEON
+		if (negate)
+		{
+			for (; i + 4 <= length; i += 4)
+				vst1q_s32(a + i, vsubq_s32(vld1q_s32(a + i), vld1q_s32(s + i)));
+		}
+		else
+		{
+			for (; i + 4 <= length; i += 4)
+				vst1q_s32(a + i, vaddq_s32(vld1q_s32(a + i), vld1q_s32(s + i)));
+		}
+#endif
+		if (negate)
+		{
+			for (; i < length; i++)
+				a[i] = (int32_t) ((uint32_t) a[i] - (uint32_t) s[i]);
+		}
+		else
+		{
+			for (; i < length; i++)
+				a[i] = (int32_t) ((uint32_t) a[i] + (uint32_t) s[i]);
+		}
+	}
+	else
+	{
+		int64_t *a = acc->acc64 + offset;
+#ifdef __ARM_NEON
+		int32x4_t d;
+		if (negate)
+		{
+			for (; i + 4 <= length; i += 4)
+			{
+				d = vld1q_s32(s + i);
+				vst1q_s64(a + i, vsubw_s32(vld1q_s64(a + i), vget_low_s32(d)));
+				vst1q_s64(a + i + 2,
+						vsubw_s32(vld1q_s64(a + i + 2), vget_high_s32(d)));
+			}
+		}
+		else
+		{
+			for (; i + 4 <= length; i += 4)
+			{
+				d = vld1q_s32(s + i);
+				vst1q_s64(a + i, vaddw_s32(vld1q_s64(a + i), vget_low_s32(d)));
+				vst1q_s64(a + i + 2,
+						vaddw_s32(vld1q_s64(a + i + 2), vget_high_s32(d)));
+			}
+		}
+#endif
+		if (negate)
+		{
+			for (; i < length; i++)
+				a[i] -= s[i];
+		}
+		else
+		{
+			for (; i < length; i++)
+				a[i] += s[i];
+		}
+	}
+}
+
+void int_acc_add_raw(int_accumulator * acc, volatile unsigned int * src,
+		uint32_t offset, uint32_t length, uint8_t negate)
+{
+	// add (or subtract) length raw adc words, every word carrying two 14-bit samples (unpacked like buf32_to_buf16).
+	// offset and length are in words: the samples go to 2*offset.. of the sum. Needs the int32 sum (sample_bits 14)
+	const uint32_t *s = (const uint32_t *) src;
+	uint32_t *a = (uint32_t *) acc->acc32 + 2 * offset; // modulo 2^32, same as int32 two's complement
+	uint32_t i = 0;
+
+#ifdef __ARM_NEON
+	// 4 words are 8 samples: as uint16 lanes they are already in sample order (low half of every word first)
+	const uint16x8_t mask = vdupq_n_u16(0x3FFF);
+	uint16x8_t d;
+	if (negate)
+	{
+		for (; i + 4 <= length; i += 4)
+		{
+			d = vandq_u16(vreinterpretq_u16_u32(vld1q_u32(s + i)), mask);
+			vst1q_u32(a + 2 * i, vsubw_u16(vld1q_u32(a + 2 * i), vget_low_u16(d)));
+			vst1q_u32(a + 2 * i + 4,
+					vsubw_u16(vld1q_u32(a + 2 * i + 4), vget_high_u16(d)));
+		}
+	}
+	else
+	{
+		for (; i + 4 <= length; i += 4)
+		{
+			d = vandq_u16(vreinterpretq_u16_u32(vld1q_u32(s + i)), mask);
+			vst1q_u32(a + 2 * i, vaddw_u16(vld1q_u32(a + 2 * i), vget_low_u16(d)));
+			vst1q_u32(a + 2 * i + 4,
+					vaddw_u16(vld1q_u32(a + 2 * i + 4), vget_high_u16(d)));
+		}
+	}
+#endif
+	if (negate)
+	{
+		for (; i < length; i++)
+		{
+			a[2 * i] -= s[i] & 0x3FFF;
+			a[2 * i + 1] -= (s[i] >> 16) & 0x3FFF;
+		}
+	}
+	else
+	{
+		for (; i < length; i++)
+		{
+			a[2 * i] += s[i] & 0x3FFF;
+			a[2 * i + 1] += (s[i] >> 16) & 0x3FFF;
+		}
+	}
+}
+
+void int_acc_scan_done(int_accumulator * acc)
+{
+	// call once every whole scan has been added
+	acc->scans++;
+	if (acc->acc32 != NULL && ++acc->scans_since_spill >= acc->spill_every)
+	{
+		int_acc_spill(acc);
+	}
+}
+
+void int_acc_spill(int_accumulator * acc)
+{
+	uint32_t i;
+
+	if (acc->acc32 == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < acc->length; i++)
+	{
+		acc->acc64[i] += acc->acc32[i];
+		acc->acc32[i] = 0;
+	}
+	acc->scans_since_spill = 0;
+}
+
+void int_acc_result(int_accumulator * acc, float * dst, double scale)
+{
+	// dst = scale * sum (e.g. scale = 1/number_of_iteration for the average)
+	uint32_t i;
+
+	int_acc_spill(acc);
+	for (i = 0; i < acc->length; i++)
+	{
+		dst[i] = (float) ((double) acc->acc64[i] * scale);
+	}
+}
+
+void int_acc_free(int_accumulator * acc)
+{
+	free(acc->acc32);
+	free(acc->acc64);
+	acc->acc32 = NULL;
+	acc->acc64 = NULL;
+}
@@ -0,0 +1,37 @@
+/*
+ * int_accumulator.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_INT_ACCUMULATOR_H_
+#define FUNCTIONS_INT_ACCUMULATOR_H_
+
+#include <stdint.h>
+
+// exact running sum of scans. The scans are added (or subtracted, for the phase cycle) as integers and the sum is
+// scaled to float only once, at the end, so it does not lose precision over thousands of scans.
+// Samples of up to 30 bits are summed in int32 (2 NEON lanes more per instruction than int64) and spilled into the
+// int64 sum before the int32 sum could overflow. Wider samples are summed in int64 directly.
+typedef struct
+{
+	int32_t *acc32;			// sum since the last spill (NULL: samples are added to acc64 directly)
+	int64_t *acc64;			// sum of everything spilled
+	uint32_t length;		// samples
+	uint32_t spill_every;	// scans that fit in acc32
+	uint32_t scans_since_spill;
+	uint32_t scans;
+} int_accumulator;
+
+int int_acc_init(int_accumulator * acc, uint32_t length,
+		unsigned int sample_bits);
+void int_acc_add_words(int_accumulator * acc, volatile unsigned int * src,
+		uint32_t offset, uint32_t length, uint8_t negate);
+void int_acc_add_raw(int_accumulator * acc, volatile unsigned int * src,
+		uint32_t offset, uint32_t length, uint8_t negate);
+void int_acc_scan_done(int_accumulator * acc);
+void int_acc_spill(int_accumulator * acc);
+void int_acc_result(int_accumulator * acc, float * dst, double scale);
+void int_acc_free(int_accumulator * acc);
+
+#endif /* FUNCTIONS_INT_ACCUMULATOR_H_ */
@@ -0,0 +1,78 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "lockin_functions.h"
+
+#define LOCKIN_RENORM	64	// samples between exact recomputations of the rotating phasors
+
+void lockin_tone(volatile unsigned int * raw, unsigned int samples,
+		double freq, double samp_freq, lockin_window window,
+		lockin_result * res)
+{
+	// raw is the packed adc data as it comes from the dma: sample 2k in the low half of word k, sample 2k+1 in the high half.
+	// One pass accumulates S = sum w x e, P = sum w e, M = sum w x and W = sum w with e = exp(-j theta n) and the window w,
+	// so the mean can be taken out at the end: (S - P M/W) * 2/W is the complex amplitude of the tone
+	double theta = 2 * M_PI * freq / samp_freq;
+	double hann = (samples > 1) ? 2 * M_PI / (samples - 1) : 0;
+	double c = 1, s = 0, dc = cos(theta), ds = sin(theta); // e = c - j s
+	double hc = 1, hs = 0, dhc = cos(hann), dhs = sin(hann); // w = 0.5 - 0.5 hc
+	double Sr = 0, Si = 0, Pr = 0, Pi = 0, M = 0, W = 0;
+	double x, w, t;
+	unsigned int n, word = 0;
+
+	res->re = 0;
+	res->im = 0;
+	res->mag = 0;
+	res->phase = 0;
+	if (samples < 2 || samp_freq <= 0)
+	{
+		printf("\t[ERROR] lock-in needs at least 2 samples and a sampling frequency\n");
+		return;
+	}
+
+	for (n = 0; n < samples; n++)
+	{
+		if ((n & 1) == 0)
+			word = raw[n >> 1];
+		x = (double) ((n & 1) ? (word >> 16) & 0x3FFF : word & 0x3FFF);
+		w = (window == LOCKIN_HANN) ? 0.5 - 0.5 * hc : 1;
+
+		M += w * x;
+		W += w;
+		Sr += w * x * c;
+		Si -= w * x * s;
+		Pr += w * c;
+		Pi -= w * s;
+
+		// step the phasors, exactly every LOCKIN_RENORM samples so the rounding does not pile up over long acquisitions
+		if ((n + 1) % LOCKIN_RENORM == 0)
+		{
+			c = cos(theta * (n + 1));
+			s = sin(theta * (n + 1));
+			hc = cos(hann * (n + 1));
+			hs = sin(hann * (n + 1));
+		}
+		else
+		{
+			t = c * dc - s * ds;
+			s = s * dc + c * ds;
+			c = t;
+			t = hc * dhc - hs * dhs;
+			hs = hs * dhc + hc * dhs;
+			hc = t;
+		}
+	}
+
+	res->re = (Sr - Pr * M / W) * 2 / W;
+	res->im = (Si - Pi * M / W) * 2 / W;
+	res->mag = sqrt(res->re * res->re + res->im * res->im);
+	res->phase = atan2(res->im, res->re) * 180 / M_PI;
+}
+
+double lockin_db(const lockin_result * res)
+{
+	// magnitude relative to a full-scale adc sine
+	if (res->mag <= 0)
+		return -INFINITY;
+	return 20 * log10(res->mag / LOCKIN_FULL_SCALE);
+}
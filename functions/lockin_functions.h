@@ -0,0 +1,34 @@
+/*
+ * lockin_functions.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_LOCKIN_FUNCTIONS_H_
+#define FUNCTIONS_LOCKIN_FUNCTIONS_H_
+
+#define LOCKIN_FULL_SCALE	8192.0	// amplitude of a full-scale 14-bit adc sine, the 0 dB of lockin_db
+
+typedef enum
+{
+	LOCKIN_RECT = 0, LOCKIN_HANN
+} lockin_window;
+
+// complex amplitude of one known tone in the adc samples: the samples (without their mean) are multiplied by
+// exp(-j 2 pi freq n / samp_freq) and summed, like a single DFT bin that does not have to fall on the bin grid.
+// The hann window keeps the leakage of the dc, the harmonics and the noise away from the tone when it does not
+// fit a whole number of cycles in the acquisition.
+typedef struct
+{
+	double re;		// the tone is mag*cos(2 pi freq t + phase) with t = 0 at the first sample,
+	double im;		// and re + j im = mag*exp(j phase)
+	double mag;		// adc units (peak)
+	double phase;	// degrees
+} lockin_result;
+
+void lockin_tone(volatile unsigned int * raw, unsigned int samples,
+		double freq, double samp_freq, lockin_window window,
+		lockin_result * res);
+double lockin_db(const lockin_result * res);
+
+#endif /* FUNCTIONS_LOCKIN_FUNCTIONS_H_ */
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rt_functions.h"
+
+int pin_thread_to_cpu(pthread_t thread, int cpu)
+{
+	cpu_set_t cpuset;
+	int err;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	err = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
+	if (err != 0)
+	{
+		printf("\t[WARNING] cannot pin the thread to cpu %d (error %d)\n", cpu,
+				err);
+		return -1;
+	}
+	return 0;
+}
+
+int unpin_thread(pthread_t thread)
+{
+	// let the thread run on every cpu again
+	cpu_set_t cpuset;
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	long cpu;
+	int err;
+
+	CPU_ZERO(&cpuset);
+	for (cpu = 0; cpu < cpus && cpu < CPU_SETSIZE; cpu++)
+	{
+		CPU_SET(cpu, &cpuset);
+	}
+	err = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
+	if (err != 0)
+	{
+		printf("\t[WARNING] cannot unpin the thread (error %d)\n", err);
+		return -1;
+	}
+	return 0;
+}
+
+static void rt_prefault_stack()
+{
+	// touch the stack the acquisition is going to use, so it does not page-fault in the middle of a scan
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	size_t i;
+
+	for (i = 0; i < RT_STACK_PREFAULT; i += sysconf(_SC_PAGESIZE))
+	{
+		stack[i] = 0;
+	}
+	(void) stack[0];
+}
+
+int rt_enter(int cpu, int priority)
+{
+	// run the calling thread as SCHED_FIFO on cpu with every page of the process locked in memory.
+	// needs root (or CAP_SYS_NICE and CAP_IPC_LOCK). Whatever cannot be set is reported and the rest is still applied.
+	// the busy-waits for the dma and the fsm back off to short sleeps (see rt_backoff), so the other threads of that cpu
+	// still run during a long scan
+	struct sched_param param;
+	int ret = 0;
+	int err;
+
+	if (pin_thread_to_cpu(pthread_self(), cpu) != 0)
+	{
+		ret = -1;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err != 0)
+	{
+		printf("\t[WARNING] cannot switch to SCHED_FIFO priority %d (error %d)\n",
+				priority, err);
+		ret = -1;
+	}
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{ // MCL_CURRENT faults in every page mapped so far, MCL_FUTURE does the same for the later allocations
+		printf("\t[WARNING] cannot lock the memory (%s)\n", strerror(errno));
+		ret = -1;
+	}
+	rt_prefault_stack();
+
+	return ret;
+}
+
+void rt_leave()
+{
+	// back to the normal scheduler. The cpu pinning is kept (see unpin_thread)
+	struct sched_param param;
+
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+	munlockall();
+}
+
+void rt_prefault(void * buf, size_t bytes)
+{
+	// write every page of buf once so the page faults happen now and not during a scan (the content is kept)
+	volatile unsigned char *p = (volatile unsigned char *) buf;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	if (buf == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < bytes; i += page)
+	{
+		p[i] = p[i];
+	}
+	if (bytes > 0)
+	{
+		p[bytes - 1] = p[bytes - 1];
+	}
+}
+
+void rt_backoff(uint32_t * polls)
+{
+	// called on every unsuccessful poll of a busy-wait, with *polls set to 0 before the wait. The first RT_SPIN_POLLS polls
+	// spin, so a short wait keeps its latency. After that every poll sleeps RT_BACKOFF_US: under SCHED_FIFO, sched_yield only
+	// lets threads of the same priority run, a sleep lets every other thread on the cpu run
+	struct timespec ts;
+
+	if (*polls < RT_SPIN_POLLS)
+	{
+		(*polls)++;
+		return;
+	}
+	ts.tv_sec = 0;
+	ts.tv_nsec = RT_BACKOFF_US * 1000;
+	nanosleep(&ts, NULL);
+}
+
+int scan_jitter_init(scan_jitter * jit, uint32_t num_of_scans,
+		double period_us, double tolerance_us)
+{
+	jit->interval_us = (float *) calloc(num_of_scans, sizeof(float));
+	if (jit->interval_us == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the scan jitter record\n");
+		jit->capacity = 0;
+		return -1;
+	}
+	jit->capacity = num_of_scans;
+	jit->count = 0;
+	jit->period_us = period_us;
+	jit->tolerance_us = tolerance_us;
+	jit->min_us = 0;
+	jit->max_us = 0;
+	jit->sum_us = 0;
+	jit->sumsq_us = 0;
+	jit->late = 0;
+
+	return 0;
+}
+
+void scan_jitter_record(scan_jitter * jit)
+{
+	// call right before a scan starts
+	struct timespec now;
+	double interval;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (jit->count > 0 && jit->count <= jit->capacity)
+	{
+		interval = (double) (now.tv_sec - jit->last.tv_sec) * 1e6
+				+ (double) (now.tv_nsec - jit->last.tv_nsec) * 1e-3;
+		jit->interval_us[jit->count - 1] = (float) interval;
+		if (jit->count == 1 || interval < jit->min_us)
+		{
+			jit->min_us = interval;
+		}
+		if (jit->count == 1 || interval > jit->max_us)
+		{
+			jit->max_us = interval;
+		}
+		jit->sum_us += interval;
+		jit->sumsq_us += interval * interval;
+		if (interval > jit->period_us + jit->tolerance_us)
+		{
+			jit->late++;
+		}
+	}
+	jit->last = now;
+	jit->count++;
+}
+
+void scan_jitter_report(scan_jitter * jit, char * pathname)
+{
+	// print the summary and write the interval before every scan (in us) to pathname, one per line
+	uint32_t n = (jit->count > jit->capacity) ? jit->capacity : jit->count;
+	uint32_t k;
+	double mean, std;
+	FILE *fptr;
+
+	if (n < 2)
+	{
+		return;
+	}
+	n--; // number of intervals
+
+	mean = jit->sum_us / n;
+	std = sqrt(fabs(jit->sumsq_us / n - mean * mean));
+	printf("\tscan start interval: mean %.1f us, std %.1f us, min %.1f us, max %.1f us (scan_spacing_us %.0f us)\n",
+			mean, std, jit->min_us, jit->max_us, jit->period_us);
+	if (jit->late)
+	{
+		printf("\t[WARNING] %d of %d scans started more than %.0f us late\n",
+				jit->late, n, jit->tolerance_us);
+	}
+
+	if (pathname != NULL)
+	{
+		fptr = fopen(pathname, "w");
+		if (fptr == NULL)
+		{
+			printf("\t[ERROR] cannot open %s\n", pathname);
+			return;
+		}
+		for (k = 0; k < n; k++)
+		{
+			fprintf(fptr, "%.3f\n", jit->interval_us[k]);
+		}
+		fclose(fptr);
+	}
+}
+
+void scan_jitter_free(scan_jitter * jit)
+{
+	free(jit->interval_us);
+	jit->interval_us = NULL;
+	jit->capacity = 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * rt_functions.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_RT_FUNCTIONS_H_
+#define FUNCTIONS_RT_FUNCTIONS_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define RT_STACK_PREFAULT	(256*1024)	// bytes of stack touched when entering the real-time mode
+#define RT_SPIN_POLLS		2000		// polls of a busy-wait before it starts to sleep between the polls
+#define RT_BACKOFF_US		20			// sleep between two polls of a busy-wait after RT_SPIN_POLLS
+
+// start-to-start interval of every scan, compared to the intended scan spacing
+typedef struct
+{
+	float *interval_us;		// interval before every scan (the first scan has none)
+	uint32_t capacity;
+	uint32_t count;			// scans recorded
+	struct timespec last;	// start of the previous scan
+	double period_us;		// intended interval
+	double tolerance_us;	// intervals longer than period_us + tolerance_us are late
+	double min_us;
+	double max_us;
+	double sum_us;
+	double sumsq_us;
+	uint32_t late;
+} scan_jitter;
+
+int pin_thread_to_cpu(pthread_t thread, int cpu);
+int unpin_thread(pthread_t thread);
+int rt_enter(int cpu, int priority);
+void rt_leave();
+void rt_prefault(void * buf, size_t bytes);
+void rt_backoff(uint32_t * polls);
+int scan_jitter_init(scan_jitter * jit, uint32_t num_of_scans,
+		double period_us, double tolerance_us);
+void scan_jitter_record(scan_jitter * jit);
+void scan_jitter_report(scan_jitter * jit, char * pathname);
+void scan_jitter_free(scan_jitter * jit);
+
+#endif /* FUNCTIONS_RT_FUNCTIONS_H_ */
@@ -0,0 +1,452 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "scan_codec.h"
+
+#define SCAN_CODEC_PRED_DELTA		0	// previous sample
+#define SCAN_CODEC_PRED_ECHO		1	// same sample of the previous echo
+#define SCAN_CODEC_PRED_ECHO_DELTA	2	// previous echo plus the step of the previous sample over its previous echo
+#define SCAN_CODEC_PRED_OFFSET		3	// mean of the block, given in its header (white noise: half the variance of the others)
+
+typedef struct
+{
+	uint8_t *out;
+	uint32_t cap;
+	uint32_t pos;				// bytes written (or that would have been)
+	uint64_t acc;
+	uint32_t bits;				// in acc, less than 32 between calls
+} scan_codec_writer;
+
+typedef struct
+{
+	const uint8_t *in;
+	uint32_t len;
+	uint32_t pos;				// bytes taken into acc (past len they are zeros)
+	uint64_t acc;
+	uint32_t bits;
+} scan_codec_reader;
+
+static void scan_codec_put(scan_codec_writer * bw, uint32_t v, uint32_t n)
+{
+	// n <= 32 bits, least significant first. v has nothing above its n bits
+	uint32_t w;
+
+	bw->acc |= (uint64_t) v << bw->bits;
+	bw->bits += n;
+	if (bw->bits >= 32)
+	{
+		w = (uint32_t) bw->acc;
+		if (bw->pos + 4 <= bw->cap)
+			memcpy(bw->out + bw->pos, &w, 4);
+		bw->pos += 4;
+		bw->acc >>= 32;
+		bw->bits -= 32;
+	}
+}
+
+static void scan_codec_fill(scan_codec_reader * br)
+{
+	uint32_t w;
+
+	while (br->bits <= 32)
+	{
+		w = 0;
+		if (br->pos + 4 <= br->len)
+			memcpy(&w, br->in + br->pos, 4);
+		br->pos += 4;
+		br->acc |= (uint64_t) w << br->bits;
+		br->bits += 32;
+	}
+}
+
+static uint32_t scan_codec_get(scan_codec_reader * br, uint32_t n)
+{
+	uint32_t v;
+
+	scan_codec_fill(br);
+	v = (n == 32) ? (uint32_t) br->acc : (uint32_t) br->acc & ((1u << n) - 1);
+	br->acc >>= n;
+	br->bits -= n;
+	return v;
+}
+
+static inline uint32_t scan_codec_zigzag(uint32_t r)
+{
+	return (r << 1) ^ (uint32_t) ((int32_t) r >> 31);
+}
+
+static inline uint32_t scan_codec_unzigzag(uint32_t u)
+{
+	return (u >> 1) ^ (0u - (u & 1));
+}
+
+static inline uint32_t scan_codec_predict(const uint32_t * x, uint32_t i,
+		uint32_t pred, uint32_t echo, uint32_t base)
+{
+	// the echo predictors fall back to the previous sample in the first echo
+	if (pred == SCAN_CODEC_PRED_OFFSET)
+		return base;
+	if (pred == SCAN_CODEC_PRED_DELTA || echo == 0 || i < echo)
+		return i ? x[i - 1] : 0;
+	if (pred == SCAN_CODEC_PRED_ECHO || i == echo)
+		return x[i - echo];
+	return x[i - echo] + x[i - 1] - x[i - 1 - echo];
+}
+
+static uint64_t scan_codec_residuals(const uint32_t * x, uint32_t i0, uint32_t n,
+		uint32_t pred, uint32_t echo, uint32_t base, uint32_t * u)
+{
+	// zigzag residuals of the samples i0..i0+n-1 into u (when not NULL), returns their sum
+	uint32_t full = (pred == SCAN_CODEC_PRED_OFFSET) ? 0 :
+					(pred == SCAN_CODEC_PRED_DELTA || echo == 0) ? 1 :
+					(pred == SCAN_CODEC_PRED_ECHO) ? echo : echo + 1;
+	uint32_t i = i0, end = i0 + n, r;
+	uint64_t sum = 0;
+
+	for (; i < end && i < full; i++)
+	{
+		r = scan_codec_zigzag(x[i] - scan_codec_predict(x, i, pred, echo, base));
+		sum += r;
+		if (u != NULL)
+			u[i - i0] = r;
+	}
+#ifdef __ARM_NEON
+	// the whole predictor from here on: 4 samples at a time, sums in 64-bit lanes
+	uint64x2_t acc = vdupq_n_u64(0);
+	uint32x4_t p, z;
+	for (; i + 4 <= end; i += 4)
+	{
+		if (pred == SCAN_CODEC_PRED_OFFSET)
+			p = vdupq_n_u32(base);
+		else if (pred == SCAN_CODEC_PRED_DELTA || echo == 0)
+			p = vld1q_u32(x + i - 1);
+		else if (pred == SCAN_CODEC_PRED_ECHO)
+			p = vld1q_u32(x + i - echo);
+		else
+			p = vsubq_u32(vaddq_u32(vld1q_u32(x + i - echo), vld1q_u32(x + i - 1)),
+					vld1q_u32(x + i - 1 - echo));
+		z = vsubq_u32(vld1q_u32(x + i), p);
+		z = veorq_u32(vshlq_n_u32(z, 1),
+				vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_u32(z), 31)));
+		if (u != NULL)
+			vst1q_u32(u + i - i0, z);
+		acc = vpadalq_u32(acc, z);
+	}
+	sum += vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+	for (; i < end; i++)
+	{
+		r = scan_codec_zigzag(x[i] - scan_codec_predict(x, i, pred, echo, base));
+		sum += r;
+		if (u != NULL)
+			u[i - i0] = r;
+	}
+	return sum;
+}
+
+static uint64_t scan_codec_rice_bits(const uint32_t * u, uint32_t n, uint32_t k,
+		uint32_t esc_bits)
+{
+	// exact length of the rice code of u with parameter k: quotient in unary and a stop bit, k bits of remainder,
+	// or SCAN_CODEC_ESC ones and the residual in esc_bits
+	uint64_t bits = (uint64_t) n * (k + 1);
+	uint32_t esc_extra = SCAN_CODEC_ESC + esc_bits - k - 1;
+	uint32_t i = 0, q;
+
+#ifdef __ARM_NEON
+	const int32x4_t shift = vdupq_n_s32(-(int32_t) k);
+	const uint32x4_t esc = vdupq_n_u32(SCAN_CODEC_ESC);
+	const uint32x4_t extra = vdupq_n_u32(esc_extra);
+	uint64x2_t acc = vdupq_n_u64(0);
+	uint32x4_t qv;
+	for (; i + 4 <= n; i += 4)
+	{
+		qv = vshlq_u32(vld1q_u32(u + i), shift);
+		acc = vpadalq_u32(acc, vbslq_u32(vcgeq_u32(qv, esc), extra, qv));
+	}
+	bits += vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+	for (; i < n; i++)
+	{
+		q = u[i] >> k;
+		bits += (q < SCAN_CODEC_ESC) ? q : esc_extra;
+	}
+	return bits;
+}
+
+int scan_codec_init(scan_codec * c, uint32_t max_words, uint32_t echo_len)
+{
+	// max_words: largest scan in 32-bit words. echo_len: samples per echo as the words unpack (2 per raw word), 0 without echoes
+	memset(c, 0, sizeof(scan_codec));
+	c->max_words = max_words;
+	c->echo_len = echo_len;
+	c->x = (uint32_t *) malloc(2 * (size_t) max_words * sizeof(uint32_t));
+	c->u = (uint32_t *) malloc(SCAN_CODEC_BLOCK * sizeof(uint32_t));
+	if (c->x == NULL || c->u == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the scan codec\n");
+		scan_codec_free(c);
+		return -1;
+	}
+	return 0;
+}
+
+uint32_t scan_codec_bound(uint32_t words)
+{
+	// largest encoding of a scan of that many words: every block verbatim
+	uint32_t blocks = (2 * words + SCAN_CODEC_BLOCK - 1) / SCAN_CODEC_BLOCK;
+	return sizeof(scan_codec_header) + 4 * words + 4 * ((blocks + 31) / 32) + 4;
+}
+
+int scan_codec_encode(scan_codec * c, volatile void * words, uint32_t n_words,
+		scan_codec_type type, uint8_t * out, uint32_t out_cap)
+{
+	// returns the bytes written to out, or -1 when the scan does not fit (out_cap >= scan_codec_bound is always enough)
+	const uint32_t *src = (const uint32_t *) words;
+	uint32_t *x = c->x, *u = c->u;
+	uint32_t n, echo, width, esc_bits, b, len, i, pred, best_pred, k, kk, q, base;
+	uint32_t high = 0, j = 0;
+	uint64_t sum, best, bits, best_bits;
+	int64_t total;
+	scan_codec_writer bw;
+	scan_codec_header hdr;
+
+	if (n_words > c->max_words || out_cap < sizeof(scan_codec_header))
+	{
+		printf("\t[ERROR] scan of %d words does not fit in the scan codec\n", n_words);
+		return -1;
+	}
+
+	echo = c->echo_len;
+	if (type == SCAN_CODEC_RAW14)
+	{ // the samples of the words in order (low half first), and whatever is above their 14 bits
+#ifdef __ARM_NEON
+		uint32x4_t hv = vdupq_n_u32(0), v;
+		uint16x8_t d;
+		for (; j + 4 <= n_words; j += 4)
+		{
+			v = vld1q_u32(src + j);
+			hv = vorrq_u32(hv, v);
+			d = vreinterpretq_u16_u32(v);
+			vst1q_u32(x + 2 * j, vmovl_u16(vget_low_u16(d)));
+			vst1q_u32(x + 2 * j + 4, vmovl_u16(vget_high_u16(d)));
+		}
+		high = vgetq_lane_u32(hv, 0) | vgetq_lane_u32(hv, 1)
+				| vgetq_lane_u32(hv, 2) | vgetq_lane_u32(hv, 3);
+#endif
+		for (; j < n_words; j++)
+		{
+			high |= src[j];
+			x[2 * j] = src[j] & 0xFFFF;
+			x[2 * j + 1] = src[j] >> 16;
+		}
+		if (high & 0xC000C000)
+		{ // not plain 14-bit samples: the words go through as they are
+			type = SCAN_CODEC_I32;
+			echo /= 2;
+		}
+	}
+	if (type == SCAN_CODEC_I32)
+	{
+		memcpy(x, src, n_words * sizeof(uint32_t));
+	}
+	n = (type == SCAN_CODEC_RAW14) ? 2 * n_words : n_words;
+	width = (type == SCAN_CODEC_RAW14) ? 14 : 32;
+	esc_bits = (type == SCAN_CODEC_RAW14) ? 16 : 32; // a 14-bit residual of the echo-delta predictor needs 16 bits after zigzag
+	if (echo >= n)
+		echo = 0;
+
+	bw.out = out + sizeof(scan_codec_header);
+	bw.cap = out_cap - sizeof(scan_codec_header);
+	bw.pos = 0;
+	bw.acc = 0;
+	bw.bits = 0;
+	for (b = 0; b < n; b += len)
+	{
+		len = (n - b < SCAN_CODEC_BLOCK) ? n - b : SCAN_CODEC_BLOCK;
+
+		total = 0;
+		for (i = b; i < b + len; i++)
+			total += (type == SCAN_CODEC_RAW14) ? (int64_t) x[i] : (int64_t) (int32_t) x[i];
+		base = (uint32_t) (total / len);
+
+		best_pred = SCAN_CODEC_PRED_OFFSET;
+		best = scan_codec_residuals(x, b, len, best_pred, echo, base, NULL);
+		for (pred = SCAN_CODEC_PRED_DELTA; pred <= SCAN_CODEC_PRED_ECHO_DELTA; pred++)
+		{
+			if (pred != SCAN_CODEC_PRED_DELTA && echo == 0)
+				break;
+			sum = scan_codec_residuals(x, b, len, pred, echo, base, NULL);
+			if (sum < best)
+			{
+				best = sum;
+				best_pred = pred;
+			}
+		}
+		scan_codec_residuals(x, b, len, best_pred, echo, base, u);
+
+		// rice parameter at log2 of the mean residual, or one step either side when that is shorter
+		k = 0;
+		while (k < 31 && ((uint64_t) len << (k + 1)) <= best)
+			k++;
+		kk = k;
+		best_bits = scan_codec_rice_bits(u, len, k, esc_bits);
+		if (k > 0 && (bits = scan_codec_rice_bits(u, len, k - 1, esc_bits)) < best_bits)
+		{
+			best_bits = bits;
+			kk = k - 1;
+		}
+		if (k < 31 && (bits = scan_codec_rice_bits(u, len, k + 1, esc_bits)) < best_bits)
+		{
+			best_bits = bits;
+			kk = k + 1;
+		}
+
+		if (best_pred == SCAN_CODEC_PRED_OFFSET)
+			best_bits += width;
+		if (7 + best_bits < (uint64_t) len * width)
+		{ // mode 0, predictor, rice parameter, (the mean), residuals
+			scan_codec_put(&bw, 0, 1);
+			scan_codec_put(&bw, best_pred, 2);
+			scan_codec_put(&bw, kk, 5);
+			if (best_pred == SCAN_CODEC_PRED_OFFSET)
+				scan_codec_put(&bw, base & (0xFFFFFFFF >> (32 - width)), width);
+			for (i = 0; i < len; i++)
+			{
+				q = u[i] >> kk;
+				if (q < SCAN_CODEC_ESC)
+				{
+					scan_codec_put(&bw, (1u << q) - 1, q + 1);
+					scan_codec_put(&bw, u[i] & ((1u << kk) - 1), kk);
+				}
+				else
+				{
+					scan_codec_put(&bw, 0xFFFFFFFF, SCAN_CODEC_ESC);
+					scan_codec_put(&bw, u[i], esc_bits);
+				}
+			}
+			c->blocks_rice++;
+		}
+		else
+		{ // mode 1, the samples at their width
+			scan_codec_put(&bw, 1, 1);
+			for (i = b; i < b + len; i++)
+				scan_codec_put(&bw, x[i], width);
+			c->blocks_verbatim++;
+		}
+	}
+	if (bw.bits > 0)
+		scan_codec_put(&bw, 0, 32 - bw.bits);
+	if (bw.pos > bw.cap)
+	{
+		printf("\t[ERROR] encoded scan does not fit in %d bytes\n", out_cap);
+		return -1;
+	}
+
+	hdr.magic = SCAN_CODEC_MAGIC;
+	hdr.version = SCAN_CODEC_VERSION;
+	hdr.type = type;
+	hdr.block = SCAN_CODEC_BLOCK;
+	hdr.words = n_words;
+	hdr.echo_len = echo;
+	hdr.payload = bw.pos;
+	hdr.reserved = 0;
+	memcpy(out, &hdr, sizeof(hdr));
+
+	c->in_bytes += n_words * sizeof(uint32_t);
+	c->out_bytes += sizeof(hdr) + bw.pos;
+	return sizeof(hdr) + bw.pos;
+}
+
+int scan_codec_decode(scan_codec * c, const uint8_t * in, uint32_t in_len,
+		uint32_t * words, uint32_t max_words)
+{
+	// returns the words written to words, or -1 when the stream is damaged
+	uint32_t *x = c->x;
+	uint32_t n, echo, width, esc_bits, b, len, i, pred, k, q, uz, low32, base;
+	scan_codec_reader br;
+	scan_codec_header hdr;
+
+	if (in_len < sizeof(hdr))
+		return -1;
+	memcpy(&hdr, in, sizeof(hdr));
+	if (hdr.magic != SCAN_CODEC_MAGIC || hdr.version != SCAN_CODEC_VERSION
+			|| (hdr.type != SCAN_CODEC_RAW14 && hdr.type != SCAN_CODEC_I32)
+			|| hdr.block == 0 || hdr.words > max_words || hdr.words > c->max_words
+			|| hdr.payload > in_len - sizeof(hdr))
+	{
+		printf("\t[ERROR] not a scan codec stream, or larger than the buffer\n");
+		return -1;
+	}
+	n = (hdr.type == SCAN_CODEC_RAW14) ? 2 * hdr.words : hdr.words;
+	width = (hdr.type == SCAN_CODEC_RAW14) ? 14 : 32;
+	esc_bits = (hdr.type == SCAN_CODEC_RAW14) ? 16 : 32;
+	echo = (hdr.echo_len < n) ? hdr.echo_len : 0;
+
+	br.in = in + sizeof(hdr);
+	br.len = hdr.payload;
+	br.pos = 0;
+	br.acc = 0;
+	br.bits = 0;
+	for (b = 0; b < n; b += len)
+	{
+		len = (n - b < hdr.block) ? n - b : hdr.block;
+		if (scan_codec_get(&br, 1))
+		{
+			for (i = b; i < b + len; i++)
+				x[i] = scan_codec_get(&br, width);
+		}
+		else
+		{
+			pred = scan_codec_get(&br, 2);
+			k = scan_codec_get(&br, 5);
+			base = (pred == SCAN_CODEC_PRED_OFFSET) ? scan_codec_get(&br, width) : 0;
+			for (i = b; i < b + len; i++)
+			{
+				scan_codec_fill(&br);
+				low32 = (uint32_t) br.acc;
+				if (low32 == 0xFFFFFFFF)
+				{ // escape
+					br.acc >>= SCAN_CODEC_ESC;
+					br.bits -= SCAN_CODEC_ESC;
+					uz = scan_codec_get(&br, esc_bits);
+				}
+				else
+				{
+					q = __builtin_ctz(~low32);
+					br.acc >>= q + 1;
+					br.bits -= q + 1;
+					uz = (q << k) | scan_codec_get(&br, k);
+				}
+				x[i] = scan_codec_predict(x, i, pred, echo, base) + scan_codec_unzigzag(uz);
+			}
+		}
+		if ((uint64_t) br.pos * 8 - br.bits > (uint64_t) br.len * 8)
+			return -1; // read past the end of the stream
+	}
+
+	if (hdr.type == SCAN_CODEC_RAW14)
+	{
+		for (i = 0; i < hdr.words; i++)
+			words[i] = x[2 * i] | (x[2 * i + 1] << 16);
+	}
+	else
+	{
+		memcpy(words, x, hdr.words * sizeof(uint32_t));
+	}
+	return hdr.words;
+}
+
+void scan_codec_free(scan_codec * c)
+{
+	free(c->x);
+	free(c->u);
+	c->x = NULL;
+	c->u = NULL;
+}
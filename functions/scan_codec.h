@@ -0,0 +1,65 @@
+/*
+ * scan_codec.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_SCAN_CODEC_H_
+#define FUNCTIONS_SCAN_CODEC_H_
+
+#include <stdint.h>
+
+#define SCAN_CODEC_MAGIC	0x43444353	// "SCDC" at the start of every encoded scan
+#define SCAN_CODEC_VERSION	1
+#define SCAN_CODEC_BLOCK	256			// samples per block: every block picks its own predictor and rice parameter
+#define SCAN_CODEC_ESC		32			// a rice quotient this large is written as an escape and the residual verbatim
+
+// lossless codec of one scan as it is stored (the 32-bit words of runFSM), for the scan log and the offload:
+// - the samples are unpacked to their real width: 2 14-bit adc samples per raw word, or the 32-bit dconv words
+// - every block of SCAN_CODEC_BLOCK samples is predicted from its mean (noise), from the previous sample, from the same
+//   sample of the previous echo, or from both (previous echo plus the change since the previous sample of the previous
+//   echo), whichever leaves the smallest residuals. The residuals are mapped to unsigned (zigzag) and rice coded, or the
+//   block keeps its samples at their real width when that is shorter.
+// The residuals are computed modulo 2^32, so the 32-bit words go through exactly. Raw words with anything above the
+// 14 bits of a sample are coded as 32-bit words, so decoding always gives back the same words.
+typedef enum
+{
+	SCAN_CODEC_RAW14 = 1,	// 2 samples per word, low half first
+	SCAN_CODEC_I32 = 2		// one 32-bit sample per word
+} scan_codec_type;
+
+typedef struct
+{
+	uint32_t magic;
+	uint8_t version;
+	uint8_t type;				// scan_codec_type the scan was coded as
+	uint16_t block;
+	uint32_t words;				// of the scan
+	uint32_t echo_len;			// samples per echo of the echo predictors (0: not used)
+	uint32_t payload;			// bytes of the bit stream after this header, a multiple of 4
+	uint32_t reserved;
+} scan_codec_header;
+
+typedef struct
+{
+	uint32_t max_words;
+	uint32_t echo_len;			// in samples, as the words unpack
+	uint32_t *x;				// unpacked samples, 2*max_words
+	uint32_t *u;				// zigzag residuals of a block
+
+	// statistics of every scan encoded
+	uint64_t in_bytes;
+	uint64_t out_bytes;
+	uint32_t blocks_rice;
+	uint32_t blocks_verbatim;
+} scan_codec;
+
+int scan_codec_init(scan_codec * c, uint32_t max_words, uint32_t echo_len);
+uint32_t scan_codec_bound(uint32_t words);
+int scan_codec_encode(scan_codec * c, volatile void * words, uint32_t n_words,
+		scan_codec_type type, uint8_t * out, uint32_t out_cap);
+int scan_codec_decode(scan_codec * c, const uint8_t * in, uint32_t in_len,
+		uint32_t * words, uint32_t max_words);
+void scan_codec_free(scan_codec * c);
+
+#endif /* FUNCTIONS_SCAN_CODEC_H_ */
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE // O_DIRECT, fallocate
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "scan_log.h"
+
+static int scan_log_write_header(scan_log * log)
+{
+	uint8_t block[SCAN_LOG_HDR_SIZE];
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, &log->hdr, sizeof(scan_log_header));
+	if (pwrite(log->fd, block, sizeof(block), 0) != sizeof(block))
+	{
+		printf("\t[ERROR] cannot write the header of the scan log\n");
+		return -1;
+	}
+	return 0;
+}
+
+int scan_log_open(scan_log * log, char * pathname, char * kind,
+		uint32_t max_length, uint32_t expected_records, uint8_t direct)
+{
+	// max_length: largest scan in bytes, sets the stride. expected_records > 0 preallocates the file for that many
+	// records at the first write (unless log->sparse is set by then)
+	int fl;
+
+	memset(log, 0, sizeof(scan_log));
+	log->align = direct ? SCAN_LOG_BLOCK : 8;
+	log->stride = scan_log_record_size(log, max_length);
+	log->expected = expected_records;
+	log->end = SCAN_LOG_HDR_SIZE;
+
+	log->fd = open(pathname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (log->fd < 0)
+	{
+		printf("\t[ERROR] cannot create %s\n", pathname);
+		return -1;
+	}
+	log->hdr.magic = SCAN_LOG_MAGIC;
+	log->hdr.version = SCAN_LOG_VERSION;
+	log->hdr.header_size = SCAN_LOG_HDR_SIZE;
+	log->hdr.record_header_size = sizeof(scan_log_record);
+	log->hdr.stride = log->stride;
+	strncpy(log->hdr.kind, kind, sizeof(log->hdr.kind) - 1);
+	log->hdr.created = (int64_t) time(NULL);
+	if (scan_log_write_header(log) < 0)
+	{
+		close(log->fd);
+		log->fd = -1;
+		return -1;
+	}
+
+	if (direct)
+	{ // only the records go around the page cache: the header and the index are not block sized
+		fl = fcntl(log->fd, F_GETFL);
+		if (fl < 0 || fcntl(log->fd, F_SETFL, fl | O_DIRECT) != 0)
+		{
+			printf("\t[WARNING] %s cannot be written with O_DIRECT, it is written through the page cache\n",
+					pathname);
+		}
+		else
+		{
+			log->direct = 1;
+		}
+	}
+	return 0;
+}
+
+void scan_log_stamp(scan_log_record * rec, uint32_t index, uint32_t seq,
+		uint32_t word_offset, uint32_t flags, double freq, uint32_t length)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec->magic = SCAN_LOG_REC_MAGIC;
+	rec->index = index;
+	rec->seq = seq;
+	rec->word_offset = word_offset;
+	rec->reserved = 0;
+	rec->flags = flags;
+	rec->length = length;
+	rec->encoding = SCAN_LOG_ENC_WORDS;
+	rec->timestamp_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->freq = freq;
+}
+
+uint32_t scan_log_record_size(scan_log * log, uint32_t length)
+{
+	// bytes written for a record with length bytes of data (at most the stride)
+	return (sizeof(scan_log_record) + length + log->align - 1) & ~(log->align - 1);
+}
+
+int scan_log_write(scan_log * log, uint8_t * records, uint32_t spacing, uint32_t n)
+{
+	// n stamped records, the next ones of the log, spacing bytes apart in memory (room for their padding). Consecutive
+	// records go in one write as long as they fill their stride. Records that could not be written keep their place,
+	// and are flagged SCAN_LOG_LOST in the index
+	struct iovec iov[SCAN_LOG_MAX_BATCH];
+	uint32_t lost[SCAN_LOG_MAX_BATCH];
+	scan_log_record *rec;
+	scan_log_entry *e;
+	uint64_t len;
+	uint32_t k, first, cap, size;
+	int ret = 0;
+
+	if (n > SCAN_LOG_MAX_BATCH)
+	{
+		printf("\t[ERROR] more than %d scan log records in one write\n", SCAN_LOG_MAX_BATCH);
+		return -1;
+	}
+	if (((const scan_log_record *) records)->index != log->records)
+	{
+		printf("\t[ERROR] scan log record %d written out of order (expected %d)\n",
+				((const scan_log_record *) records)->index, log->records);
+		return -1;
+	}
+	if (log->records + n > log->capacity)
+	{
+		cap = log->capacity ? 2 * log->capacity : 256;
+		while (cap < log->records + n)
+			cap *= 2;
+		e = (scan_log_entry *) realloc(log->index, cap * sizeof(scan_log_entry));
+		if (e == NULL)
+		{
+			printf("\t[ERROR] cannot grow the index of the scan log\n");
+			return -1;
+		}
+		log->index = e;
+		log->capacity = cap;
+	}
+	if (log->records == 0 && log->expected > 0 && !log->sparse
+			&& fallocate(log->fd, 0, 0,
+					SCAN_LOG_HDR_SIZE + (off_t) log->expected * log->stride) != 0)
+	{ // e.g. vfat: the file grows as it is written
+		printf("\t[WARNING] the scan log cannot be preallocated (error %d)\n", errno);
+	}
+
+	for (k = 0; k < n; k++)
+	{ // zero padding, so the file does not depend on what was in the buffers
+		rec = (scan_log_record *) (records + (size_t) k * spacing);
+		size = scan_log_record_size(log, rec->length);
+		memset((uint8_t *) (rec + 1) + rec->length, 0,
+				size - sizeof(scan_log_record) - rec->length);
+		iov[k].iov_base = rec;
+		iov[k].iov_len = size;
+	}
+	for (first = 0; first < n; first = k)
+	{ // a run of records ends with one that does not fill its stride
+		len = 0;
+		k = first;
+		do
+		{
+			len += iov[k].iov_len;
+		} while (iov[k++].iov_len == log->stride && k < n);
+		lost[first] = (pwritev(log->fd, iov + first, k - first,
+				SCAN_LOG_HDR_SIZE + (off_t) (log->records + first) * log->stride)
+				!= (ssize_t) len) ? SCAN_LOG_LOST : 0;
+		if (lost[first])
+			ret = -1;
+		while (++first < k)
+			lost[first] = lost[first - 1];
+	}
+
+	for (k = 0; k < n; k++)
+	{
+		rec = (scan_log_record *) iov[k].iov_base;
+		e = &log->index[log->records];
+		e->seq = rec->seq;
+		e->flags = rec->flags | lost[k];
+		e->length = rec->length;
+		e->encoding = rec->encoding;
+		e->word_offset = rec->word_offset;
+		e->reserved = 0;
+		e->offset = SCAN_LOG_HDR_SIZE + (uint64_t) log->records * log->stride;
+		e->timestamp_ns = rec->timestamp_ns;
+		e->freq = rec->freq;
+		log->records++;
+	}
+	log->end = SCAN_LOG_HDR_SIZE + (uint64_t) log->records * log->stride;
+	return ret;
+}
+
+int scan_log_close(scan_log * log)
+{
+	// the index goes after the last record, the file is cut behind it, and the header points to it
+	uint64_t end = log->end;
+	uint64_t len = (uint64_t) log->records * sizeof(scan_log_entry);
+	int fl, ret = -1;
+
+	if (log->fd < 0)
+		return -1;
+
+	if (log->direct)
+	{
+		fl = fcntl(log->fd, F_GETFL);
+		if (fl >= 0)
+			fcntl(log->fd, F_SETFL, fl & ~O_DIRECT);
+	}
+	if ((len == 0 || pwrite(log->fd, log->index, len, (off_t) end) == (ssize_t) len)
+			&& ftruncate(log->fd, (off_t) (end + len)) == 0)
+	{
+		log->hdr.records = log->records;
+		log->hdr.index_offset = end;
+		ret = scan_log_write_header(log);
+	}
+	else
+	{
+		printf("\t[ERROR] cannot write the index of the scan log\n");
+	}
+
+	close(log->fd);
+	free(log->index);
+	log->fd = -1;
+	log->index = NULL;
+	log->capacity = 0;
+	return ret;
+}
@@ -0,0 +1,101 @@
+/*
+ * scan_log.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_SCAN_LOG_H_
+#define FUNCTIONS_SCAN_LOG_H_
+
+#include <stdint.h>
+
+// one append-only file for all the scans of an experiment:
+//   scan_log_header, padded to SCAN_LOG_HDR_SIZE
+//   fixed-size records: record n is at header_size + n * stride, a scan_log_record and its data. The stride is the
+//   largest record (its header and max_length bytes of data), padded to 8 bytes (to SCAN_LOG_BLOCK with O_DIRECT)
+//   the index: one scan_log_entry per record, after the last record
+// So any record can be found from its number alone, even while the file is being written (index_offset 0; the magic of a
+// record that was never written is 0). The file is preallocated for the expected number of records and consecutive
+// full records go in with one write, so a run does not create a file (and its directory entry) per scan.
+// A record holds the words as acquired, or their scan_codec stream (encoding). A record shorter than the stride (e.g.
+// encoded) is only written up to its padded length: with sparse set the file is not preallocated and the rest of the
+// slot stays a hole, so the encoding still saves disk space.
+// Everything is in the byte order of the board (little endian).
+
+#define SCAN_LOG_MAGIC		0x474F4C53	// "SLOG" at the start of the file
+#define SCAN_LOG_REC_MAGIC	0x4E435341	// "ASCN" at the start of every record
+#define SCAN_LOG_VERSION	2
+#define SCAN_LOG_HDR_SIZE	4096		// the records start block aligned
+#define SCAN_LOG_BLOCK		4096		// record alignment with O_DIRECT
+#define SCAN_LOG_MAX_BATCH	64			// records in one scan_log_write
+
+#define SCAN_LOG_NEGATED	0x1			// record flag: the scan was acquired with the inverted phase of the phase cycle
+#define SCAN_LOG_LOST		0x80000000	// index flag: the write of the record failed
+
+#define SCAN_LOG_ENC_WORDS	0			// the data is the 32-bit words of the scan
+#define SCAN_LOG_ENC_CODEC	1			// the data is a scan_codec stream of them
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;		// offset of record 0
+	uint32_t record_header_size;
+	uint32_t stride;			// bytes from one record to the next
+	uint32_t records;			// written, valid once the index is written
+	uint64_t index_offset;		// 0 while the file is open
+	char kind[16];				// what the records hold, e.g. "cpmg_raw"
+	int64_t created;			// unix time
+} scan_log_header;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t index;				// record number
+	uint32_t seq;				// from the caller, e.g. the 0-based scan (a scan split into segments has several records)
+	uint32_t flags;				// SCAN_LOG_*
+	uint32_t length;			// bytes of data after this header
+	uint32_t encoding;			// SCAN_LOG_ENC_*
+	uint32_t word_offset;		// words of the scan seq before this record (0 unless the scan is split into segments)
+	uint32_t reserved;
+	uint64_t timestamp_ns;		// CLOCK_REALTIME when the scan was handed over
+	double freq;				// excitation frequency in MHz (0: not given)
+} scan_log_record;
+
+typedef struct
+{
+	uint32_t seq;
+	uint32_t flags;
+	uint32_t length;
+	uint32_t encoding;
+	uint32_t word_offset;
+	uint32_t reserved;
+	uint64_t offset;			// of the scan_log_record
+	uint64_t timestamp_ns;
+	double freq;
+} scan_log_entry;
+
+typedef struct
+{
+	int fd;
+	uint8_t direct;				// opened with O_DIRECT
+	uint32_t align;				// of the records
+	uint32_t stride;
+	uint8_t sparse;				// set before the first write: no preallocation, the unused end of a record stays a hole
+	uint32_t expected;			// records the file is preallocated for at the first write
+	uint64_t end;				// end of the last record
+	uint32_t records;			// the next record number
+	scan_log_entry *index;
+	uint32_t capacity;
+	scan_log_header hdr;
+} scan_log;
+
+int scan_log_open(scan_log * log, char * pathname, char * kind,
+		uint32_t max_length, uint32_t expected_records, uint8_t direct);
+void scan_log_stamp(scan_log_record * rec, uint32_t index, uint32_t seq,
+		uint32_t word_offset, uint32_t flags, double freq, uint32_t length);
+uint32_t scan_log_record_size(scan_log * log, uint32_t length);
+int scan_log_write(scan_log * log, uint8_t * records, uint32_t spacing, uint32_t n);
+int scan_log_close(scan_log * log);
+
+#endif /* FUNCTIONS_SCAN_LOG_H_ */
@@ -0,0 +1,201 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "general.h"
+#include "rt_functions.h"
+#include "sdram_ring.h"
+#include "spsc_ring.h"
+#include "scan_pipeline.h"
+
+static void * scan_pipeline_worker(void * arg)
+{
+	scan_pipeline *pipe = (scan_pipeline *) arg;
+	scan_pipeline_item *item;
+
+	while (1)
+	{
+		while (sem_wait(&pipe->filled) != 0 && errno == EINTR)
+			;
+
+		item = (scan_pipeline_item *) spsc_ring_front(&pipe->queue);
+		if (item == NULL)
+		{ // the extra post from scan_pipeline_stop: every item is done
+			break;
+		}
+
+		if (item->skip)
+		{
+			pipe->consume(NULL, item->skip, item->seq, pipe->ctx);
+		}
+		if (item->slot != NULL)
+		{
+			pipe->consume(item->slot, item->length, item->seq, pipe->ctx);
+		}
+
+		spsc_ring_pop(&pipe->queue); // the sdram ring can reuse the slot from now on
+	}
+
+	return NULL;
+}
+
+void scan_pipeline_forward(volatile unsigned int * slot, uint32_t length,
+		uint32_t seq, void * ctx)
+{
+	// sdram ring consumer on the acquisition thread: queue the slot for the worker
+	scan_pipeline *pipe = (scan_pipeline *) ctx;
+	scan_pipeline_item item;
+	uint32_t queued = spsc_ring_count(&pipe->queue);
+	uint32_t polls = 0;
+
+	if (queued > pipe->max_queued)
+	{
+		pipe->max_queued = queued;
+	}
+
+	if (pipe->unit_pos == 0)
+	{ // the drop is decided at the start of a unit only, so the kept units are whole (the phase cycle of a pair cancels)
+		pipe->dropping = pipe->drop_when_full && queued >= pipe->drop_lvl;
+	}
+	pipe->unit_pos += length;
+	if (pipe->unit_pos >= pipe->drop_unit)
+	{
+		pipe->unit_pos -= pipe->drop_unit;
+	}
+
+	if (pipe->dropping)
+	{ // the worker is behind: leave the slot to be overwritten rather than stall the next scan
+		pipe->skip += length;
+		pipe->drops++;
+		return;
+	}
+
+	item.slot = slot;
+	item.length = length;
+	item.seq = seq;
+	item.skip = pipe->skip;
+	while (spsc_ring_push(&pipe->queue, &item) != 0)
+	{ // not reached while the queue is at least as long as the sdram ring, as the ring waits for held slots before reusing them
+		rt_backoff(&polls);
+	}
+	pipe->skip = 0;
+	sem_post(&pipe->filled);
+}
+
+int scan_pipeline_holds(void * ctx, uint32_t seq)
+{
+	// called by the acquisition thread: is the slot of transfer seq (or of any transfer after it) still queued or being processed
+	scan_pipeline *pipe = (scan_pipeline *) ctx;
+	uint32_t tail = __atomic_load_n(&pipe->queue.tail, __ATOMIC_ACQUIRE);
+	scan_pipeline_item *oldest;
+
+	if (pipe->queue.head == tail)
+	{
+		return 0;
+	}
+	oldest = &pipe->items[tail & (pipe->queue.capacity - 1)];
+
+	return (int32_t) (seq - oldest->seq) >= 0;
+}
+
+int scan_pipeline_start(scan_pipeline * pipe, sdram_ring * ring,
+		sdram_ring_consumer consume, void * ctx, int worker_cpu,
+		uint8_t drop_when_full, uint32_t drop_unit)
+{
+	// moves the consumer of the sdram ring to a worker thread pinned to worker_cpu (-1 leaves it unpinned).
+	// drop_unit: words dropped as a whole when the worker is behind (whole scans, or pairs of them with the phase cycle)
+	uint32_t capacity = 1;
+	int err;
+
+	while (capacity < ring->num_slots)
+	{
+		capacity <<= 1;
+	}
+	if (capacity > SCAN_PIPELINE_MAX_ITEMS
+			|| spsc_ring_init(&pipe->queue, pipe->items,
+					sizeof(scan_pipeline_item), capacity) != 0)
+	{
+		return -1;
+	}
+
+	pipe->consume = consume;
+	pipe->ctx = ctx;
+	pipe->drop_when_full = drop_when_full;
+	pipe->drop_lvl = (ring->num_slots > 2) ? ring->num_slots - 2 : 1; // queued slots + the one being written by the dma fit in the ring
+	pipe->drop_unit = (drop_unit > 0) ? drop_unit : 1;
+	pipe->unit_pos = 0;
+	pipe->dropping = 0;
+	pipe->skip = 0;
+	pipe->drops = 0;
+	pipe->max_queued = 0;
+
+	if (sem_init(&pipe->filled, 0, 0) != 0)
+	{
+		printf("\t[ERROR] scan pipeline semaphore cannot be created\n");
+		return -1;
+	}
+	err = pthread_create(&pipe->thread, NULL, scan_pipeline_worker, pipe);
+	if (err != 0)
+	{
+		printf("\t[ERROR] scan pipeline worker cannot be created (error %d)\n",
+				err);
+		sem_destroy(&pipe->filled);
+		return -1;
+	}
+	if (worker_cpu >= 0)
+	{
+		pin_thread_to_cpu(pipe->thread, worker_cpu);
+	}
+
+	ring->consume = scan_pipeline_forward;
+	ring->ctx = pipe;
+	ring->slot_held = scan_pipeline_holds;
+	ring->hold_ctx = pipe;
+	ring->stalls = 0;
+
+	return 0;
+}
+
+void scan_pipeline_stop(scan_pipeline * pipe, sdram_ring * ring,
+		uint8_t en_mesg)
+{
+	// hands the rest of the ring to the worker, waits until it is done and gives the consumer back to the ring
+	scan_pipeline_item item;
+	uint32_t polls = 0;
+
+	sdram_ring_drain(ring);
+	if (pipe->skip)
+	{ // the words dropped after the last item still go to the consumer, so it knows the scans are missing
+		item.slot = NULL;
+		item.length = 0;
+		item.seq = ring->seq_consumed;
+		item.skip = pipe->skip;
+		while (spsc_ring_push(&pipe->queue, &item) != 0)
+			rt_backoff(&polls);
+		pipe->skip = 0;
+		sem_post(&pipe->filled);
+	}
+
+	sem_post(&pipe->filled);
+	pthread_join(pipe->thread, NULL);
+	sem_destroy(&pipe->filled);
+
+	if (en_mesg)
+	{
+		printf("\tscan pipeline: %d slots processed, %d dropped, %d stalls, queue peak %d of %d\n",
+				ring->seq_consumed - pipe->drops, pipe->drops, ring->stalls,
+				pipe->max_queued, pipe->queue.capacity);
+	}
+	if (pipe->drops)
+	{
+		printf("\t[WARNING] %d slots were dropped because the processing could not keep up\n",
+				pipe->drops);
+	}
+
+	ring->consume = pipe->consume;
+	ring->ctx = pipe->ctx;
+	ring->slot_held = NULL;
+	ring->hold_ctx = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * scan_pipeline.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_SCAN_PIPELINE_H_
+#define FUNCTIONS_SCAN_PIPELINE_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+
+#include "rt_functions.h"
+#include "sdram_ring.h"
+#include "spsc_ring.h"
+
+#define SCAN_PIPELINE_MAX_ITEMS	SDRAM_RING_MAX_SLOTS
+
+// one completed sdram ring slot handed from the acquisition thread to the processing thread
+typedef struct
+{
+	volatile unsigned int *slot;
+	uint32_t length;
+	uint32_t seq;
+	uint32_t skip;		// words dropped right before this slot
+} scan_pipeline_item;
+
+// producer/consumer split of the sdram ring: the acquisition thread only runs the fsm and the dma, and every completed
+// slot is processed (accumulated, converted, written) by a worker thread on the other core, straight from the sdram.
+// A slot stays in the queue until the worker is done with it, and the sdram ring does not reuse it before that (backpressure).
+typedef struct
+{
+	spsc_ring queue;
+	scan_pipeline_item items[SCAN_PIPELINE_MAX_ITEMS];
+	sdram_ring_consumer consume;	// run on the worker thread. slot = NULL hands over the number of dropped words
+	void *ctx;
+	pthread_t thread;
+	sem_t filled;					// posted for every item pushed, and once more to stop the worker
+	uint8_t drop_when_full;			// 1: drop slots instead of stalling the acquisition when the worker is behind
+	uint32_t drop_lvl;				// queued items at which slots are dropped
+	uint32_t drop_unit;				// words that are dropped (or kept) as a whole, e.g. a phase-cycle pair of scans
+	uint32_t unit_pos;				// words of the current unit already forwarded or dropped
+	uint8_t dropping;				// the current unit is dropped
+	uint32_t skip;					// words dropped since the last pushed item
+	uint32_t drops;					// slots dropped
+	uint32_t max_queued;			// highest queue level seen
+} scan_pipeline;
+
+int scan_pipeline_start(scan_pipeline * pipe, sdram_ring * ring,
+		sdram_ring_consumer consume, void * ctx, int worker_cpu,
+		uint8_t drop_when_full, uint32_t drop_unit);
+void scan_pipeline_stop(scan_pipeline * pipe, sdram_ring * ring,
+		uint8_t en_mesg);
+void scan_pipeline_forward(volatile unsigned int * slot, uint32_t length,
+		uint32_t seq, void * ctx);
+int scan_pipeline_holds(void * ctx, uint32_t seq);
+
+#endif /* FUNCTIONS_SCAN_PIPELINE_H_ */
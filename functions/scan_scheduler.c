@@ -0,0 +1,125 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "scan_scheduler.h"
+
+void timespec_add_us(struct timespec * t, long unsigned us)
+{
+	t->tv_sec += us / 1000000;
+	t->tv_nsec += (us % 1000000) * 1000;
+	if (t->tv_nsec >= 1000000000)
+	{
+		t->tv_nsec -= 1000000000;
+		t->tv_sec++;
+	}
+}
+
+static double timespec_diff_us(struct timespec * a, struct timespec * b)
+{
+	// a - b in us
+	return (double) (a->tv_sec - b->tv_sec) * 1e6
+			+ (double) (a->tv_nsec - b->tv_nsec) * 1e-3;
+}
+
+void scan_scheduler_reset(scan_scheduler * sched)
+{
+	// the next scan starts right away
+	sched->period_us = 0;
+	sched->armed = 0;
+	sched->scans = 0;
+	sched->overruns = 0;
+	sched->worst_overrun_us = 0;
+}
+
+void scan_scheduler_set_period(scan_scheduler * sched, long unsigned period_us)
+{
+	sched->period_us = period_us;
+}
+
+int scan_scheduler_wait(scan_scheduler * sched, scan_slack_work work,
+		void * ctx)
+{
+	// call right before a scan starts. Waits for the deadline of the scan, running work in the meantime as long as there is
+	// work and time left. Returns 1 if the deadline had already passed.
+	struct timespec now;
+	double late_us;
+	int overrun = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (sched->armed)
+	{
+		if (work != NULL)
+		{ // stop once the time left is shorter than the last unit of work took, so the work does not push the scan back
+			double unit_us = 0;
+			struct timespec before;
+			while (timespec_diff_us(&sched->next, &now) > unit_us)
+			{
+				before = now;
+				if (!work(ctx))
+				{
+					break;
+				}
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				unit_us = timespec_diff_us(&now, &before);
+			}
+		}
+
+		late_us = timespec_diff_us(&now, &sched->next);
+		if (late_us > 0)
+		{ // start right away, and count the following deadlines from now instead of catching up with a burst of scans
+			overrun = 1;
+			sched->overruns++;
+			if (late_us > sched->worst_overrun_us)
+			{
+				sched->worst_overrun_us = late_us;
+			}
+			sched->next = now;
+		}
+		else
+		{
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sched->next,
+					NULL) == EINTR)
+				;
+		}
+	}
+	else
+	{
+		sched->next = now;
+	}
+
+	// the deadline of the next scan is counted from the deadline of this one, not from whenever it is woken up
+	if (sched->period_us > 0)
+	{
+		timespec_add_us(&sched->next, sched->period_us);
+		sched->armed = 1;
+	}
+	sched->scans++;
+
+	return overrun;
+}
+
+void scan_scheduler_finish(scan_scheduler * sched)
+{
+	// wait out the repetition time of the last scan, so whatever runs next still sees a full recovery time
+	if (sched->armed)
+	{
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sched->next,
+				NULL) == EINTR)
+			;
+		sched->armed = 0;
+	}
+}
+
+void scan_scheduler_report(scan_scheduler * sched)
+{
+	if (sched->overruns)
+	{
+		printf(
+				"\t[WARNING] %d of %d scans started after their deadline: one scan is longer than scan_spacing_us (%ld us). Worst case %.0f us late\n",
+				sched->overruns, sched->scans, sched->period_us,
+				sched->worst_overrun_us);
+	}
+}
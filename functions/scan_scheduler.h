@@ -0,0 +1,36 @@
+/*
+ * scan_scheduler.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_SCAN_SCHEDULER_H_
+#define FUNCTIONS_SCAN_SCHEDULER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// work done while waiting for the next scan. Returns 0 when there is nothing left to do
+typedef unsigned int (*scan_slack_work)(void * ctx);
+
+// starts every scan at an absolute CLOCK_MONOTONIC deadline, period_us after the deadline of the previous scan.
+// The repetition time does not depend on how long the host takes around the scan, and does not drift over the scans.
+typedef struct
+{
+	struct timespec next;	// deadline of the next scan
+	long unsigned period_us;// repetition time (0 starts the scans right away)
+	uint8_t armed;			// next is valid (a scan has started since the reset)
+	uint32_t scans;			// scans started
+	uint32_t overruns;		// scans started after their deadline
+	double worst_overrun_us;
+} scan_scheduler;
+
+void timespec_add_us(struct timespec * t, long unsigned us);
+void scan_scheduler_reset(scan_scheduler * sched);
+void scan_scheduler_set_period(scan_scheduler * sched, long unsigned period_us);
+int scan_scheduler_wait(scan_scheduler * sched, scan_slack_work work,
+		void * ctx);
+void scan_scheduler_finish(scan_scheduler * sched);
+void scan_scheduler_report(scan_scheduler * sched);
+
+#endif /* FUNCTIONS_SCAN_SCHEDULER_H_ */
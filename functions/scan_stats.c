@@ -0,0 +1,330 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "scan_stats.h"
+
+int scan_stats_init(scan_stats * st, uint32_t length, int_accumulator * sum,
+		uint8_t psd)
+{
+	// sum is an int_accumulator of length 14-bit samples the scans are also added to (e.g. the one the "asum" file is
+	// written from), or NULL to keep an own one. The caller's accumulator gets its int_acc_scan_done from the caller.
+	// psd adds the noise spectral density, at the cost of one fft per scan
+	uint32_t i;
+
+	memset(st, 0, sizeof(scan_stats));
+	st->length = length;
+	st->min = 0x3FFF;
+
+	if (length < 2 || length % 2)
+	{
+		printf("\t[ERROR] the scan statistics need an even number of samples (%d)\n", length);
+		return -1;
+	}
+	if (sum == NULL)
+	{
+		if (int_acc_init(&st->own_sum, length, 14) < 0)
+			return -1;
+		sum = &st->own_sum;
+	}
+	st->sum = sum;
+	if (int_acc_init(&st->sumsq, length, 27) < 0) // (x-midscale)^2 <= 2^26
+	{
+		scan_stats_free(st);
+		return -1;
+	}
+
+	if (psd)
+	{
+		st->plan = fft_plan_get(fft_length(length, 1));
+		st->window = (float *) malloc(length * sizeof(float));
+		if (st->plan != NULL)
+			st->psd = (double *) calloc(st->plan->n / 2 + 1, sizeof(double));
+		if (st->plan == NULL || st->window == NULL || st->psd == NULL)
+		{
+			printf("\t[ERROR] cannot allocate the noise spectral density, it is not computed\n");
+			free(st->window);
+			free(st->psd);
+			st->window = NULL;
+			st->psd = NULL;
+			st->plan = NULL;
+		}
+		else
+		{
+			for (i = 0; i < length; i++)
+			{
+				st->window[i] = (float) (0.5
+						- 0.5 * cos(2 * M_PI * i / (length - 1)));
+				st->window_power += (double) st->window[i] * st->window[i];
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void scan_stats_psd(scan_stats * st, const uint32_t * s)
+{
+	// |X|^2 of the windowed scan without its mean, added to the psd bins
+	uint32_t n = st->plan->n, i;
+	float *x = st->plan->work;
+	double mean = 0;
+
+	for (i = 0; i < st->length / 2; i++)
+		mean += (s[i] & 0x3FFF) + ((s[i] >> 16) & 0x3FFF);
+	mean /= st->length;
+
+	for (i = 0; i < st->length / 2; i++)
+	{
+		x[4 * i] = (float) ((s[i] & 0x3FFF) - mean) * st->window[2 * i];
+		x[4 * i + 1] = 0;
+		x[4 * i + 2] = (float) (((s[i] >> 16) & 0x3FFF) - mean)
+				* st->window[2 * i + 1];
+		x[4 * i + 3] = 0;
+	}
+	memset(x + 2 * st->length, 0, 2 * (n - st->length) * sizeof(float));
+	fft_forward(st->plan, x);
+
+	for (i = 0; i <= n / 2; i++)
+		st->psd[i] += (double) x[2 * i] * x[2 * i] + (double) x[2 * i + 1] * x[2 * i + 1];
+}
+
+void scan_stats_add(scan_stats * st, volatile unsigned int * src)
+{
+	// add one scan of length/2 packed adc words (two 14-bit samples per word, like buf32_to_buf16)
+	const uint32_t *s = (const uint32_t *) src;
+	uint32_t words = st->length / 2, i = 0;
+	uint32_t *a = (uint32_t *) st->sum->acc32; // modulo 2^32, same as int32 two's complement
+	int32_t *q = st->sumsq.acc32;
+	int64_t sum = 0;
+	uint64_t sumsq = 0;
+	uint16_t lo = 0x3FFF, hi = 0, d0, d1;
+	int32_t c0, c1;
+	double mean_b, m2_b, delta;
+
+#ifdef __ARM_NEON
+	// 4 words are 8 samples in sample order. The sums of the scan are kept in 64-bit lanes, the per-sample squares in int32
+	const uint16x8_t mask = vdupq_n_u16(0x3FFF);
+	const int16x8_t mid = vdupq_n_s16(SCAN_STATS_MIDSCALE);
+	uint16x8_t vmin = vdupq_n_u16(0x3FFF), vmax = vdupq_n_u16(0), d;
+	int64x2_t vsum = vdupq_n_s64(0);
+	uint64x2_t vsq = vdupq_n_u64(0);
+	int16x8_t c;
+	int32x4_t q0, q1;
+	uint16_t lanes[16];
+	for (; i + 4 <= words; i += 4)
+	{
+		d = vandq_u16(vreinterpretq_u16_u32(vld1q_u32(s + i)), mask);
+		vmin = vminq_u16(vmin, d);
+		vmax = vmaxq_u16(vmax, d);
+		vst1q_u32(a + 2 * i, vaddw_u16(vld1q_u32(a + 2 * i), vget_low_u16(d)));
+		vst1q_u32(a + 2 * i + 4,
+				vaddw_u16(vld1q_u32(a + 2 * i + 4), vget_high_u16(d)));
+		c = vsubq_s16(vreinterpretq_s16_u16(d), mid);
+		vsum = vpadalq_s32(vsum, vpaddlq_s16(c));
+		q0 = vmull_s16(vget_low_s16(c), vget_low_s16(c));
+		q1 = vmull_s16(vget_high_s16(c), vget_high_s16(c));
+		vst1q_s32(q + 2 * i, vaddq_s32(vld1q_s32(q + 2 * i), q0));
+		vst1q_s32(q + 2 * i + 4, vaddq_s32(vld1q_s32(q + 2 * i + 4), q1));
+		vsq = vpadalq_u32(vsq, vreinterpretq_u32_s32(q0));
+		vsq = vpadalq_u32(vsq, vreinterpretq_u32_s32(q1));
+	}
+	sum = vgetq_lane_s64(vsum, 0) + vgetq_lane_s64(vsum, 1);
+	sumsq = vgetq_lane_u64(vsq, 0) + vgetq_lane_u64(vsq, 1);
+	vst1q_u16(lanes, vmin);
+	vst1q_u16(lanes + 8, vmax);
+	for (c0 = 0; c0 < 8; c0++)
+	{
+		if (lanes[c0] < lo)
+			lo = lanes[c0];
+		if (lanes[8 + c0] > hi)
+			hi = lanes[8 + c0];
+	}
+#endif
+	for (; i < words; i++)
+	{
+		d0 = s[i] & 0x3FFF;
+		d1 = (s[i] >> 16) & 0x3FFF;
+		if (d0 < lo)
+			lo = d0;
+		if (d1 < lo)
+			lo = d1;
+		if (d0 > hi)
+			hi = d0;
+		if (d1 > hi)
+			hi = d1;
+		a[2 * i] += d0;
+		a[2 * i + 1] += d1;
+		c0 = d0 - SCAN_STATS_MIDSCALE;
+		c1 = d1 - SCAN_STATS_MIDSCALE;
+		sum += c0 + c1;
+		q[2 * i] += c0 * c0;
+		q[2 * i + 1] += c1 * c1;
+		sumsq += (uint64_t) (c0 * c0) + (uint64_t) (c1 * c1);
+	}
+
+	if (lo < st->min)
+		st->min = lo;
+	if (hi > st->max)
+		st->max = hi;
+	if (lo == 0 || hi == 0x3FFF)
+	{ // count the clipped samples only for the scans that have some
+		st->clipped_scans++;
+		for (i = 0; i < st->length; i++)
+		{
+			d0 = (s[i >> 1] >> ((i & 1) * 16)) & 0x3FFF;
+			if (d0 == 0)
+				st->clip_low++;
+			else if (d0 == 0x3FFF)
+				st->clip_high++;
+		}
+	}
+
+	// merge the exact moments of the scan into the global mean and m2
+	mean_b = (double) sum / st->length;
+	m2_b = (double) sumsq - (double) sum * mean_b;
+	delta = mean_b - st->mean;
+	st->count += st->length;
+	st->mean += delta * st->length / st->count;
+	st->m2 += m2_b
+			+ delta * delta * (double) (st->count - st->length) * st->length
+					/ st->count;
+
+	if (st->plan != NULL)
+		scan_stats_psd(st, s);
+
+	st->scans++;
+	int_acc_scan_done(&st->sumsq);
+	if (st->sum == &st->own_sum)
+		int_acc_scan_done(&st->own_sum);
+}
+
+int scan_stats_write(scan_stats * st, char * pathname, double samp_freq,
+		scan_stats_header * hdr)
+{
+	// writes the binary summary into pathname and fills hdr. samp_freq in MHz
+	uint32_t n = st->scans, i, bins = 0;
+	double sc, var, noise_var = 0, scale = 0, density = 0;
+	FILE *fp;
+	float *buf;
+
+	int_acc_spill(st->sum);
+	int_acc_spill(&st->sumsq);
+
+	memset(hdr, 0, sizeof(scan_stats_header));
+	hdr->magic = SCAN_STATS_MAGIC;
+	hdr->version = SCAN_STATS_VERSION;
+	hdr->length = st->length;
+	hdr->scans = n;
+	hdr->samp_freq = (float) samp_freq;
+	hdr->mean = (float) (st->mean + SCAN_STATS_MIDSCALE);
+	hdr->std = (st->count > 1) ? (float) sqrt(st->m2 / (st->count - 1)) : 0;
+	hdr->rms = (st->count > 0) ?
+			(float) sqrt(st->m2 / st->count + st->mean * st->mean) : 0;
+	hdr->min = st->min;
+	hdr->max = st->max;
+	hdr->clipped_scans = st->clipped_scans;
+	hdr->clip_low = st->clip_low;
+	hdr->clip_high = st->clip_high;
+	if (st->plan != NULL)
+		hdr->psd_points = st->plan->n / 2 + 1;
+
+	buf = (float *) malloc(
+			((st->length > hdr->psd_points) ? st->length : hdr->psd_points)
+					* sizeof(float));
+	if (buf == NULL || n == 0)
+	{
+		printf("\t[ERROR] no scan statistics to write\n");
+		free(buf);
+		return -1;
+	}
+
+	// the noise numbers go into the header, which is written first
+	for (i = 0; i < st->length; i++)
+	{
+		sc = (double) st->sum->acc64[i] - (double) n * SCAN_STATS_MIDSCALE; // sum of x-midscale
+		var = (n > 1) ? ((double) st->sumsq.acc64[i] - sc * sc / n) / (n - 1) : 0;
+		noise_var += (var > 0) ? var : 0;
+	}
+	hdr->noise_std = (float) sqrt(noise_var / st->length);
+	if (st->plan != NULL)
+	{
+		scale = 1 / ((double) n * samp_freq * 1e6 * st->window_power);
+		for (i = 2; i < hdr->psd_points; i++)
+		{ // the first two bins have the leakage of the mean through the window
+			density += st->psd[i] * scale * 2;
+			bins++;
+		}
+		hdr->noise_density = (bins > 0) ? (float) sqrt(density / bins) : 0;
+	}
+
+	fp = fopen(pathname, "wb");
+	if (fp == NULL)
+	{
+		printf("\t[ERROR] cannot open %s\n", pathname);
+		free(buf);
+		return -1;
+	}
+	fwrite(hdr, sizeof(scan_stats_header), 1, fp);
+
+	for (i = 0; i < st->length; i++)
+		buf[i] = (float) ((double) st->sum->acc64[i] / n);
+	fwrite(buf, sizeof(float), st->length, fp);
+
+	for (i = 0; i < st->length; i++)
+	{
+		sc = (double) st->sum->acc64[i] - (double) n * SCAN_STATS_MIDSCALE;
+		var = (n > 1) ? ((double) st->sumsq.acc64[i] - sc * sc / n) / (n - 1) : 0;
+		buf[i] = (var > 0) ? (float) sqrt(var) : 0;
+	}
+	fwrite(buf, sizeof(float), st->length, fp);
+
+	if (st->plan != NULL)
+	{ // one-sided: every bin but 0 and n/2 also carries its negative frequency
+		for (i = 0; i < hdr->psd_points; i++)
+			buf[i] = (float) (st->psd[i] * scale
+					* ((i == 0 || i == hdr->psd_points - 1) ? 1 : 2));
+		fwrite(buf, sizeof(float), hdr->psd_points, fp);
+	}
+
+	fclose(fp);
+	free(buf);
+	return 0;
+}
+
+void scan_stats_print(FILE * fp, const scan_stats_header * hdr)
+{
+	// the summary as "key = value" lines, like acqu.par
+	fprintf(fp, "statScans = %d\n", hdr->scans);
+	fprintf(fp, "statMean = %.4f\n", hdr->mean);
+	fprintf(fp, "statStd = %.4f\n", hdr->std);
+	fprintf(fp, "statRms = %.4f\n", hdr->rms);
+	fprintf(fp, "statNoiseStd = %.4f\n", hdr->noise_std);
+	fprintf(fp, "statMin = %d\n", hdr->min);
+	fprintf(fp, "statMax = %d\n", hdr->max);
+	fprintf(fp, "statClippedScans = %d\n", hdr->clipped_scans);
+	fprintf(fp, "statClipLow = %llu\n", (unsigned long long) hdr->clip_low);
+	fprintf(fp, "statClipHigh = %llu\n", (unsigned long long) hdr->clip_high);
+	if (hdr->psd_points > 0)
+		fprintf(fp, "statNoiseDensity = %g\n", hdr->noise_density);
+}
+
+void scan_stats_free(scan_stats * st)
+{
+	// the plan belongs to the fft plan cache
+	if (st->sum == &st->own_sum)
+		int_acc_free(&st->own_sum);
+	int_acc_free(&st->sumsq);
+	free(st->window);
+	free(st->psd);
+	st->window = NULL;
+	st->psd = NULL;
+	st->plan = NULL;
+	st->sum = NULL;
+}
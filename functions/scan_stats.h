@@ -0,0 +1,79 @@
+/*
+ * scan_stats.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_SCAN_STATS_H_
+#define FUNCTIONS_SCAN_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fft_functions.h"
+#include "int_accumulator.h"
+
+#define SCAN_STATS_MIDSCALE	8192	// the samples are centered on the middle of the 14-bit adc range before they are squared
+#define SCAN_STATS_MAGIC	0x41545353	// "SSTA" at the start of the binary summary
+#define SCAN_STATS_VERSION	1
+
+// statistics of the raw adc scans, updated by one pass over the packed words of every scan:
+// - per sample: exact integer sums of x and of (x-midscale)^2 over the scans, so the mean and the scan-to-scan variance
+//   of every sample come out of the integers at the end without cancellation or overflow (int_accumulator spills to int64)
+// - global: min/max and clipping, and mean/variance of all the samples, merged scan by scan with the parallel form of
+//   welford's update (chan) from the exact moments of every scan
+// - optionally the noise spectral density, averaged over the scans (hann window, one-sided, adc units^2/Hz)
+typedef struct
+{
+	uint32_t length;			// samples per scan
+	uint32_t scans;
+	int_accumulator *sum;		// per-sample sum of x, the caller's accumulator or own_sum
+	int_accumulator own_sum;
+	int_accumulator sumsq;		// per-sample sum of (x-midscale)^2
+
+	uint64_t count;				// samples merged into the global mean and m2
+	double mean;				// relative to the midscale
+	double m2;					// sum of the squared deviations from mean
+	uint16_t min;
+	uint16_t max;
+	uint64_t clip_low;			// samples at 0
+	uint64_t clip_high;			// samples at 0x3FFF
+	uint32_t clipped_scans;
+
+	fft_plan *plan;				// NULL: no noise spectral density. Only valid while fewer than FFT_MAX_PLANS other lengths are used
+	float *window;				// hann window, length samples
+	double window_power;		// sum of window^2
+	double *psd;				// sum over the scans of |X|^2, plan->n/2 + 1 bins
+} scan_stats;
+
+// the binary "stats" file is this header, then float mean[length] and float std[length] (adc units)
+// and float psd[psd_points] (adc units^2/Hz, from 0 to samp_freq/2), all in the byte order of the board
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t length;
+	uint32_t scans;
+	uint32_t psd_points;
+	float samp_freq;			// MHz
+	float mean;					// adc units
+	float std;					// standard deviation of all the samples
+	float rms;					// rms of all the samples around the midscale
+	float noise_std;			// rms over the samples of the scan-to-scan standard deviation
+	float noise_density;		// mean of the psd from its third bin on, as adc units/sqrt(Hz)
+	uint16_t min;
+	uint16_t max;
+	uint32_t clipped_scans;
+	uint64_t clip_low;
+	uint64_t clip_high;
+} scan_stats_header;
+
+int scan_stats_init(scan_stats * st, uint32_t length, int_accumulator * sum,
+		uint8_t psd);
+void scan_stats_add(scan_stats * st, volatile unsigned int * src);
+int scan_stats_write(scan_stats * st, char * pathname, double samp_freq,
+		scan_stats_header * hdr);
+void scan_stats_print(FILE * fp, const scan_stats_header * hdr);
+void scan_stats_free(scan_stats * st);
+
+#endif /* FUNCTIONS_SCAN_STATS_H_ */
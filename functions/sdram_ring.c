@@ -0,0 +1,284 @@
+#include <hwlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "AlteraIP/altera_avalon_fifo_regs.h"
+#include "avalon_dma.h"
+#include "general.h"
+#include "dma_functions.h"
+#include "rt_functions.h"
+#include "sdram_ring.h"
+
+int sdram_ring_init(sdram_ring * ring, volatile unsigned int * dma_addr,
+		volatile unsigned int * sdram_addr, uint32_t fifo_addr,
+		uint32_t sdram_base, uint32_t sdram_span, uint32_t length,
+		unsigned int num_slots, sdram_ring_consumer consume, void * ctx)
+{
+	// sdram_span is in bytes, length is in words
+
+	uint32_t slot_words = (length + SDRAM_RING_ALIGN_WORDS - 1)
+			& ~(SDRAM_RING_ALIGN_WORDS - 1);
+
+	if (num_slots < 2 || num_slots > SDRAM_RING_MAX_SLOTS)
+	{
+		printf("\t[ERROR] sdram ring needs 2 to %d slots (%d given)\n",
+		SDRAM_RING_MAX_SLOTS, num_slots);
+		return -1;
+	}
+	if ((uint64_t) slot_words * num_slots * 4 > sdram_span)
+	{
+		printf(
+				"\t[ERROR] sdram ring of %d slots x %d words does not fit in the sdram window (%d bytes)\n",
+				num_slots, slot_words, sdram_span);
+		return -1;
+	}
+
+	ring->dma_addr = dma_addr;
+	ring->sdram_addr = sdram_addr;
+	ring->fifo_addr = fifo_addr;
+	ring->sdram_base = sdram_base;
+	ring->length = length;
+	ring->slot_words = slot_words;
+	ring->num_slots = num_slots;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->pending = 0;
+	ring->in_flight = 0;
+	ring->seq_started = 0;
+	ring->seq_consumed = 0;
+	ring->consume = consume;
+	ring->ctx = ctx;
+	ring->irq = NULL;
+	ring->slot_held = NULL;
+	ring->hold_ctx = NULL;
+	ring->stalls = 0;
+	ring->fifo_csr = NULL;
+	ring->overruns = 0;
+	ring->words_lost = 0;
+
+	return 0;
+}
+
+volatile unsigned int * sdram_ring_slot(sdram_ring * ring, unsigned int slot)
+{
+	return ring->sdram_addr + slot * ring->slot_words;
+}
+
+static void sdram_ring_consume_one(sdram_ring * ring)
+{
+	if (ring->slot_seq[ring->tail] != ring->seq_consumed)
+	{ // the slot holds a later transfer than the one expected
+		ring->overruns++;
+	}
+	if (ring->consume != NULL)
+	{
+		ring->consume(sdram_ring_slot(ring, ring->tail),
+				ring->slot_len[ring->tail], ring->seq_consumed, ring->ctx);
+	}
+	ring->tail = (ring->tail + 1) % ring->num_slots;
+	ring->pending--;
+	ring->seq_consumed++;
+}
+
+static double sdram_ring_idle_ms(struct timespec * since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - since->tv_sec) * 1e3
+			+ (double) (now.tv_nsec - since->tv_nsec) * 1e-6;
+}
+
+static uint8_t sdram_ring_wait_dma(sdram_ring * ring)
+{
+	// wait_dma, except that a transfer which can no longer finish is given up: the words lost to a fifo overflow never come,
+	// so once the scan has ended the dma would wait for them forever. Returns 1 when the transfer was given up
+	unsigned int dma_status;
+	uint32_t len, last_len = UINT32_MAX;
+	uint32_t polls = 0;
+	struct timespec progress; // last change of the length register
+
+	if (ring->fifo_csr == NULL)
+	{
+		wait_dma(ring->dma_addr, ring->irq, DISABLE_MESSAGE);
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &progress);
+	dma_status = alt_read_word(ring->dma_addr + DMA_STATUS_OFST);
+	while (!(dma_status & DMA_STAT_DONE_MSK) || (dma_status & DMA_STAT_BUSY_MSK))
+	{
+		if (ring->words_lost
+				|| (alt_read_word(ring->fifo_csr + ALTERA_AVALON_FIFO_EVENT_REG)
+						& ALTERA_AVALON_FIFO_EVENT_OVF_MSK))
+		{
+			len = alt_read_word(ring->dma_addr + DMA_LENGTH_OFST);
+			if (len != last_len)
+			{
+				last_len = len;
+				clock_gettime(CLOCK_MONOTONIC, &progress);
+			}
+			else if (sdram_ring_idle_ms(&progress) > SDRAM_RING_STALL_MS)
+			{
+				reset_dma(ring->dma_addr);
+				return 1;
+			}
+		}
+		if (ring->irq != NULL && ring->irq->fd >= 0)
+		{
+			dma_irq_wait(ring->irq); // a timeout only means the status register is checked again
+		}
+		else
+		{
+			rt_backoff(&polls);
+		}
+		dma_status = alt_read_word(ring->dma_addr + DMA_STATUS_OFST);
+	}
+
+	alt_write_word(ring->dma_addr + DMA_STATUS_OFST, 0x0); // clear the DONE bit, which also deasserts the irq
+	if (ring->irq != NULL)
+	{
+		dma_irq_arm(ring->irq);
+	}
+	return 0;
+}
+
+void sdram_ring_wait(sdram_ring * ring)
+{
+	// wait for the dma of the latest scan to finish, and check that it got every word
+	uint8_t lost = 0;
+
+	if (ring->in_flight)
+	{
+		lost = sdram_ring_wait_dma(ring);
+		ring->in_flight = 0;
+
+		if (alt_read_word(ring->dma_addr + DMA_LENGTH_OFST) != 0)
+		{ // the length register counts down to 0 on a complete transfer
+			lost = 1;
+		}
+		if (ring->fifo_csr != NULL
+				&& (alt_read_word(ring->fifo_csr + ALTERA_AVALON_FIFO_EVENT_REG)
+						& ALTERA_AVALON_FIFO_EVENT_OVF_MSK))
+		{ // the dma was started too late (e.g. the consumer of the previous segment took too long)
+			alt_write_word(ring->fifo_csr + ALTERA_AVALON_FIFO_EVENT_REG,
+					ALTERA_AVALON_FIFO_EVENT_OVF_MSK);
+			ring->words_lost = 1;
+			lost = 1;
+		}
+		ring->overruns += lost;
+	}
+}
+
+void sdram_ring_start(sdram_ring * ring)
+{
+	// start the dma of one whole scan into the next free slot. Call this right after the fsm is started.
+	sdram_ring_wait(ring);
+	ring->words_lost = 0; // the words lost in the previous scan do not leave this one short
+	sdram_ring_start_len(ring, ring->length);
+}
+
+void sdram_ring_start_len(sdram_ring * ring, uint32_t length)
+{
+	// start the dma of length words (at most ring->length) into the next free slot.
+	// only one transfer can be in flight as there is only one dma engine
+	uint32_t polls;
+
+	if (length > ring->length)
+	{
+		length = ring->length;
+	}
+
+	sdram_ring_wait(ring);
+
+	// the ring is full: the oldest slot is going to be overwritten, so consume it first
+	while (ring->pending >= ring->num_slots)
+	{
+		sdram_ring_consume_one(ring);
+	}
+
+	// a consumed slot can still be in use by whoever the consumer handed it to
+	if (ring->slot_held != NULL && ring->seq_started >= ring->num_slots
+			&& ring->slot_held(ring->hold_ctx,
+					ring->seq_started - ring->num_slots))
+	{
+		ring->stalls++;
+		polls = 0;
+		while (ring->slot_held(ring->hold_ctx,
+				ring->seq_started - ring->num_slots))
+		{
+			rt_backoff(&polls);
+		}
+	}
+
+	if (ring->fifo_csr != NULL && ring->seq_started == 0)
+	{ // an overflow left from before the ring was used is not counted
+		alt_write_word(ring->fifo_csr + ALTERA_AVALON_FIFO_EVENT_REG,
+				ALTERA_AVALON_FIFO_EVENT_OVF_MSK);
+	}
+	reset_dma(ring->dma_addr);
+	fifo_to_sdram_dma_trf_ctrl(ring->dma_addr, ring->fifo_addr,
+			ring->sdram_base + ring->head * ring->slot_words * 4, length,
+			dma_irq_ctrl(ring->irq)); // *4 is due to byte-addressing
+
+	ring->slot_len[ring->head] = length;
+	ring->slot_seq[ring->head] = ring->seq_started;
+	ring->in_flight = 1;
+	ring->pending++;
+	ring->head = (ring->head + 1) % ring->num_slots;
+	ring->seq_started++;
+}
+
+unsigned int sdram_ring_consume_ready(sdram_ring * ring)
+{
+	// consume every slot whose dma has finished. The slot being written by the dma is left alone.
+	unsigned int consumed = 0;
+
+	while (ring->pending > ring->in_flight)
+	{
+		sdram_ring_consume_one(ring);
+		consumed++;
+	}
+
+	return consumed;
+}
+
+unsigned int sdram_ring_consume_next(sdram_ring * ring)
+{
+	// consume the oldest completed slot, if there is one. Returns the number of slots consumed (0 or 1)
+	if (ring->pending > ring->in_flight)
+	{
+		sdram_ring_consume_one(ring);
+		return 1;
+	}
+	return 0;
+}
+
+void sdram_ring_drain(sdram_ring * ring)
+{
+	sdram_ring_wait(ring);
+	sdram_ring_consume_ready(ring);
+}
+
+void sdram_ring_stream(sdram_ring * ring, uint32_t total_length)
+{
+	// transfer one scan of total_length words. Call this right after the fsm is started.
+	// a scan longer than a slot is split into chained segments across the rotating slots, so neither the
+	// length register nor the sdram window limits the scan. Every segment is consumed while the dma fills the next one.
+	// the dma reads the fifo at a constant address, so the segments continue the same stream as long as the next
+	// segment is started before the fifo fills up.
+	// the last transfer is left in the ring, it is consumed during the next scan or by sdram_ring_drain
+	uint32_t seg_len;
+
+	sdram_ring_wait(ring);
+	ring->words_lost = 0; // the words lost in the previous scan do not leave this one short
+	while (total_length > 0)
+	{
+		seg_len = (total_length > ring->length) ? ring->length : total_length;
+		sdram_ring_start_len(ring, seg_len);
+		sdram_ring_consume_ready(ring);
+		total_length -= seg_len;
+	}
+	sdram_ring_wait(ring);
+}
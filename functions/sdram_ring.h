@@ -0,0 +1,72 @@
+/*
+ * sdram_ring.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_SDRAM_RING_H_
+#define FUNCTIONS_SDRAM_RING_H_
+
+#include <stdint.h>
+
+#include "dma_functions.h"
+
+#define SDRAM_RING_MAX_SLOTS	16
+#define SDRAM_RING_ALIGN_WORDS	8		// every slot starts on a 32-byte boundary in the sdram
+#define SDRAM_RING_STALL_MS		100		// after a fifo overflow, a transfer whose length register stays put this long is given up
+												// (the words lost leave the last transfers of the scan short)
+
+// called once for every completed slot, in the order the slots were written.
+// slot points to the host mapping of the slot, length is the number of words in it and seq is the 0-based transfer number.
+// A transfer is a whole scan, or one segment of it when the scan is longer than a slot (see sdram_ring_stream).
+typedef void (*sdram_ring_consumer)(volatile unsigned int * slot,
+		uint32_t length, uint32_t seq, void * ctx);
+
+// tells if the slot of transfer seq is still in use after it was consumed (e.g. handed to another thread)
+typedef int (*sdram_ring_holder)(void * ctx, uint32_t seq);
+
+// N-slot ping-pong buffer in the fpga sdram.
+// Every scan is transferred by the dma into its own slot, so the previous scan can be consumed by the host while the next one is acquired.
+// Without the fpga, dma_emul stands in for the dma and its fifo (see the sdram ring check at the end of hps_linux.c).
+typedef struct
+{
+	volatile unsigned int *dma_addr;	// dma control/status registers
+	volatile unsigned int *sdram_addr;	// host mapping of the sdram window
+	uint32_t fifo_addr;					// avalon address of the fifo read by the dma read master
+	uint32_t sdram_base;				// avalon address of the sdram seen by the dma write master
+	uint32_t length;					// max words transferred per slot
+	uint32_t slot_words;				// words reserved per slot (length rounded up to SDRAM_RING_ALIGN_WORDS)
+	uint32_t slot_len[SDRAM_RING_MAX_SLOTS];	// words actually transferred into every slot
+	uint32_t slot_seq[SDRAM_RING_MAX_SLOTS];	// transfer written into every slot
+	unsigned int num_slots;
+	unsigned int head;					// slot for the next dma transfer
+	unsigned int tail;					// next slot to be consumed
+	unsigned int pending;				// slots written (or being written) but not yet consumed
+	uint8_t in_flight;					// the dma is running into the slot before head
+	uint32_t seq_started;				// transfers started
+	uint32_t seq_consumed;				// transfers consumed
+	sdram_ring_consumer consume;
+	void *ctx;
+	dma_irq *irq;						// dma completion irq (NULL polls the dma status register)
+	sdram_ring_holder slot_held;		// NULL: a slot is free as soon as it is consumed
+	void *hold_ctx;
+	uint32_t stalls;					// transfers that had to wait for a held slot
+	volatile unsigned int *fifo_csr;	// csr of the fifo read by the dma, checked for overflows (NULL: not checked)
+	uint32_t overruns;					// transfers that lost data: cut short, the fifo overflowed, or the slot was rewritten before it was consumed
+	uint8_t words_lost;					// the fifo overflowed during the current scan, so its transfers can stall (see SDRAM_RING_STALL_MS)
+} sdram_ring;
+
+int sdram_ring_init(sdram_ring * ring, volatile unsigned int * dma_addr,
+		volatile unsigned int * sdram_addr, uint32_t fifo_addr,
+		uint32_t sdram_base, uint32_t sdram_span, uint32_t length,
+		unsigned int num_slots, sdram_ring_consumer consume, void * ctx);
+void sdram_ring_start(sdram_ring * ring);
+void sdram_ring_start_len(sdram_ring * ring, uint32_t length);
+void sdram_ring_stream(sdram_ring * ring, uint32_t total_length);
+void sdram_ring_wait(sdram_ring * ring);
+unsigned int sdram_ring_consume_ready(sdram_ring * ring);
+unsigned int sdram_ring_consume_next(sdram_ring * ring);
+void sdram_ring_drain(sdram_ring * ring);
+volatile unsigned int * sdram_ring_slot(sdram_ring * ring, unsigned int slot);
+
+#endif /* FUNCTIONS_SDRAM_RING_H_ */
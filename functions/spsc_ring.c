@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+int spsc_ring_init(spsc_ring * ring, void * buf, uint32_t elem_size,
+		uint32_t capacity)
+{
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+	{
+		printf("\t[ERROR] spsc ring capacity (%d) is not a power of 2\n",
+				capacity);
+		return -1;
+	}
+
+	ring->buf = (uint8_t *) buf;
+	ring->elem_size = elem_size;
+	ring->capacity = capacity;
+	ring->head = 0;
+	ring->tail = 0;
+
+	return 0;
+}
+
+uint32_t spsc_ring_count(spsc_ring * ring)
+{
+	// exact on either side: the other side can only make it smaller (consumer) or larger (producer) in the meantime
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+			- __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+int spsc_ring_push(spsc_ring * ring, const void * elem)
+{
+	// producer side. Returns -1 when the ring is full
+	uint32_t head = ring->head;
+
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+			>= ring->capacity)
+	{
+		return -1;
+	}
+
+	memcpy(ring->buf + (head & (ring->capacity - 1)) * ring->elem_size, elem,
+			ring->elem_size);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE); // publish the element after it is written
+
+	return 0;
+}
+
+void * spsc_ring_front(spsc_ring * ring)
+{
+	// consumer side. Returns the oldest element (left in the ring until spsc_ring_pop), or NULL when the ring is empty
+	uint32_t tail = ring->tail;
+
+	if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+	{
+		return NULL;
+	}
+
+	return ring->buf + (tail & (ring->capacity - 1)) * ring->elem_size;
+}
+
+void spsc_ring_pop(spsc_ring * ring)
+{
+	// consumer side. Hands the slot of the front element back to the producer
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,31 @@
+/*
+ * spsc_ring.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_SPSC_RING_H_
+#define FUNCTIONS_SPSC_RING_H_
+
+#include <stdint.h>
+
+// lock-free single-producer/single-consumer queue of fixed-size elements.
+// head is only written by the producer and tail only by the consumer, so the two sides never take a lock.
+// capacity has to be a power of 2, and buf has to hold capacity elements of elem_size bytes
+typedef struct
+{
+	uint8_t *buf;
+	uint32_t elem_size;
+	uint32_t capacity;
+	uint32_t head;		// free-running count of pushed elements
+	uint32_t tail;		// free-running count of popped elements
+} spsc_ring;
+
+int spsc_ring_init(spsc_ring * ring, void * buf, uint32_t elem_size,
+		uint32_t capacity);
+uint32_t spsc_ring_count(spsc_ring * ring);
+int spsc_ring_push(spsc_ring * ring, const void * elem);
+void * spsc_ring_front(spsc_ring * ring);
+void spsc_ring_pop(spsc_ring * ring);
+
+#endif /* FUNCTIONS_SPSC_RING_H_ */
@@ -0,0 +1,381 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rt_functions.h"
+#include "spsc_ring.h"
+#include "stream_server.h"
+
+static int stream_srv_write(int fd, const uint8_t * p, uint32_t len)
+{
+	ssize_t done;
+
+	while (len > 0)
+	{
+		done = send(fd, p, len, MSG_NOSIGNAL);
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done <= 0)
+			return -1; // closed by the client, or nothing taken within STREAM_SEND_TIMEOUT_MS
+		p += done;
+		len -= done;
+	}
+	return 0;
+}
+
+static void stream_srv_accept(stream_server * srv)
+{
+	// a new client gets the hello first. Frames queued for the client before it went away are not sent
+	struct
+	{
+		stream_frame fr;
+		stream_hello hello;
+	} msg;
+	struct timeval tv;
+	struct timespec ts;
+	int one = 1;
+	int fd = accept(srv->listen_fd, NULL, NULL);
+
+	if (fd < 0)
+		return;
+	tv.tv_sec = STREAM_SEND_TIMEOUT_MS / 1000;
+	tv.tv_usec = (STREAM_SEND_TIMEOUT_MS % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (srv->unix_path[0] == '\0')
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // every frame goes out as soon as it is queued
+
+	while (spsc_ring_front(&srv->queue) != NULL)
+		spsc_ring_pop(&srv->queue);
+
+	memset(&msg, 0, sizeof(msg));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	msg.fr.magic = STREAM_MAGIC;
+	msg.fr.type = STREAM_HELLO;
+	msg.fr.length = sizeof(stream_hello);
+	msg.fr.timestamp_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	msg.hello = srv->hello;
+	if (stream_srv_write(fd, (const uint8_t *) &msg, sizeof(msg)) != 0)
+	{
+		close(fd);
+		return;
+	}
+	srv->client_fd = fd;
+	srv->clients++;
+	__atomic_store_n(&srv->connected, 1, __ATOMIC_RELEASE);
+}
+
+static void * stream_srv_thread(void * arg)
+{
+	stream_server *srv = (stream_server *) arg;
+	struct pollfd pfd;
+	uint32_t *front;
+	stream_frame *fr;
+
+	while (1)
+	{
+		if (srv->client_fd < 0)
+		{ // waiting for a client, and for the end of the run every 100 ms
+			if (__atomic_load_n(&srv->stop, __ATOMIC_ACQUIRE))
+				break;
+			pfd.fd = srv->listen_fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, 100) > 0)
+				stream_srv_accept(srv);
+			continue;
+		}
+
+		while (sem_wait(&srv->filled) != 0 && errno == EINTR)
+			;
+		while ((front = (uint32_t *) spsc_ring_front(&srv->queue)) != NULL)
+		{
+			fr = (stream_frame *) (srv->pool
+					+ (size_t) (*front & (srv->num_bufs - 1)) * srv->stride);
+			if (srv->client_fd >= 0)
+			{
+				if (stream_srv_write(srv->client_fd, (const uint8_t *) fr,
+						sizeof(stream_frame) + fr->length) == 0)
+				{
+					srv->sent++;
+					srv->bytes_sent += sizeof(stream_frame) + fr->length;
+				}
+				else
+				{ // the rest of the queue is thrown away, and the next client gets the run from where it is
+					srv->send_errors++;
+					__atomic_store_n(&srv->connected, 0, __ATOMIC_RELEASE);
+					close(srv->client_fd);
+					srv->client_fd = -1;
+				}
+			}
+			spsc_ring_pop(&srv->queue);
+		}
+		if (srv->client_fd >= 0 && __atomic_load_n(&srv->stop, __ATOMIC_ACQUIRE))
+			break; // the queue (with STREAM_END) is sent
+	}
+
+	if (srv->client_fd >= 0)
+	{
+		close(srv->client_fd);
+		srv->client_fd = -1;
+	}
+	return NULL;
+}
+
+int stream_srv_open(stream_server * srv, int port, const char * bind_addr, char * unix_path,
+		const stream_hello * hello, uint32_t max_length, uint32_t num_bufs,
+		uint32_t decimation, int io_cpu)
+{
+	// port > 0: tcp on the ipv4 address bind_addr (NULL: loopback only, "0.0.0.0": every interface), otherwise the
+	// unix socket unix_path. max_length: largest payload in bytes.
+	// num_bufs: frames that can wait for the client (rounded up to a power of 2). decimation <= 1: the scans are
+	// dropped instead of decimated when the client falls behind. io_cpu -1 leaves the sender thread unpinned
+	struct sockaddr_in sin;
+	struct sockaddr_un sun;
+	uint32_t capacity = 1;
+	int one = 1, err;
+
+	memset(srv, 0, sizeof(stream_server));
+	srv->listen_fd = -1;
+	srv->client_fd = -1;
+	while (capacity < num_bufs)
+	{
+		capacity <<= 1;
+	}
+	if (capacity > STREAM_MAX_BUFS)
+	{
+		capacity = STREAM_MAX_BUFS;
+	}
+	srv->num_bufs = capacity;
+	srv->preview_level = capacity / 2;
+	srv->decimation = decimation;
+	srv->max_length = max_length;
+	srv->stride = (sizeof(stream_frame) + max_length + 7) & ~7;
+	srv->hello = *hello;
+	srv->hello.version = STREAM_VERSION;
+
+	srv->pool = (uint8_t *) malloc((size_t) capacity * srv->stride);
+	if (srv->pool == NULL
+			|| spsc_ring_init(&srv->queue, srv->items, sizeof(uint32_t), capacity) != 0)
+	{
+		printf("\t[ERROR] cannot allocate the buffers of the stream server\n");
+		free(srv->pool);
+		srv->pool = NULL;
+		return -1;
+	}
+
+	if (port > 0)
+	{
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sin.sin_port = htons(port);
+		if (bind_addr != NULL && inet_pton(AF_INET, bind_addr, &sin.sin_addr) != 1)
+		{
+			printf("\t[ERROR] the stream server address %s is not an ipv4 address\n", bind_addr);
+			free(srv->pool);
+			srv->pool = NULL;
+			return -1;
+		}
+		srv->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (srv->listen_fd >= 0)
+			setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		err = (srv->listen_fd < 0)
+				|| bind(srv->listen_fd, (struct sockaddr *) &sin, sizeof(sin)) != 0;
+	}
+	else
+	{
+		srv->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strncpy(sun.sun_path, unix_path, sizeof(sun.sun_path) - 1);
+		strncpy(srv->unix_path, unix_path, sizeof(srv->unix_path) - 1);
+		unlink(unix_path); // left over by a run that did not close it
+		err = (srv->listen_fd < 0)
+				|| bind(srv->listen_fd, (struct sockaddr *) &sun, sizeof(sun)) != 0;
+	}
+	if (err || listen(srv->listen_fd, 1) != 0)
+	{
+		if (port > 0)
+			printf("\t[ERROR] the stream server cannot listen on %s port %d (error %d)\n",
+					(bind_addr != NULL) ? bind_addr : "loopback", port, errno);
+		else
+			printf("\t[ERROR] the stream server cannot listen on %s (error %d)\n", unix_path, errno);
+		if (srv->listen_fd >= 0)
+			close(srv->listen_fd);
+		free(srv->pool);
+		srv->pool = NULL;
+		return -1;
+	}
+
+	if (sem_init(&srv->filled, 0, 0) != 0)
+	{
+		printf("\t[ERROR] stream server semaphore cannot be created\n");
+		close(srv->listen_fd);
+		free(srv->pool);
+		srv->pool = NULL;
+		return -1;
+	}
+	err = pthread_create(&srv->thread, NULL, stream_srv_thread, srv);
+	if (err != 0)
+	{
+		printf("\t[ERROR] stream server thread cannot be created (error %d)\n", err);
+		sem_destroy(&srv->filled);
+		close(srv->listen_fd);
+		free(srv->pool);
+		srv->pool = NULL;
+		return -1;
+	}
+	if (io_cpu >= 0)
+	{
+		pin_thread_to_cpu(srv->thread, io_cpu);
+	}
+	return 0;
+}
+
+int stream_srv_wait_client(stream_server * srv, unsigned int timeout_ms)
+{
+	// 0 once a client is connected, -1 when none came within timeout_ms
+	unsigned int waited;
+
+	for (waited = 0; waited < timeout_ms; waited++)
+	{
+		if (__atomic_load_n(&srv->connected, __ATOMIC_ACQUIRE))
+			return 0;
+		usleep(1000);
+	}
+	return __atomic_load_n(&srv->connected, __ATOMIC_ACQUIRE) ? 0 : -1;
+}
+
+int stream_srv_send(stream_server * srv, stream_frame_type type, uint32_t seq,
+		uint32_t word_offset, uint32_t flags, volatile void * data,
+		uint32_t length, uint32_t scans)
+{
+	// copies the frame into the next free buffer and queues it, or decimates or drops it (see above). Only one thread may send
+	const uint32_t *src = (const uint32_t *) data;
+	uint32_t queued, k, words;
+	uint32_t *dst;
+	stream_frame *fr;
+	struct timespec ts;
+
+	if (!__atomic_load_n(&srv->connected, __ATOMIC_ACQUIRE))
+	{
+		srv->not_connected++;
+		return -1;
+	}
+	if (length > srv->max_length)
+	{
+		printf("\t[ERROR] frame of %d bytes does not fit in the stream server buffers\n", length);
+		return -1;
+	}
+	queued = spsc_ring_count(&srv->queue);
+	if (queued > srv->max_queued)
+	{
+		srv->max_queued = queued;
+	}
+	if (queued >= srv->num_bufs)
+	{
+		srv->dropped++;
+		return -1;
+	}
+
+	fr = (stream_frame *) (srv->pool
+			+ (size_t) (srv->frames & (srv->num_bufs - 1)) * srv->stride);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	fr->magic = STREAM_MAGIC;
+	fr->type = type;
+	fr->flags = flags;
+	fr->seq = seq;
+	fr->timestamp_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	fr->decimation = 1;
+	fr->scans = scans;
+	fr->word_offset = word_offset;
+	fr->reserved = 0;
+	if (type == STREAM_SCAN && srv->decimation > 1 && queued >= srv->preview_level)
+	{ // the client is behind: every decimation-th word only
+		words = (length / sizeof(uint32_t) + srv->decimation - 1) / srv->decimation;
+		dst = (uint32_t *) (fr + 1);
+		for (k = 0; k < words; k++)
+			dst[k] = src[k * srv->decimation];
+		fr->type = STREAM_PREVIEW;
+		fr->decimation = srv->decimation;
+		fr->length = words * sizeof(uint32_t);
+		srv->scans_preview++;
+	}
+	else
+	{
+		if (length > 0)
+			memcpy(fr + 1, src, length);
+		fr->length = length;
+		if (type == STREAM_SCAN)
+			srv->scans_full++;
+	}
+
+	spsc_ring_push(&srv->queue, &srv->frames);
+	srv->frames++;
+	sem_post(&srv->filled);
+	return 0;
+}
+
+int stream_srv_wait_room(stream_server * srv, unsigned int timeout_ms)
+{
+	// waits up to timeout_ms for a free buffer, e.g. for a frame that must not be dropped once the acquisition is over.
+	// 0 when the next frame is going to be queued
+	unsigned int waited;
+
+	for (waited = 0; waited < timeout_ms
+			&& __atomic_load_n(&srv->connected, __ATOMIC_ACQUIRE)
+			&& spsc_ring_count(&srv->queue) >= srv->num_bufs; waited++)
+		usleep(1000);
+	return (__atomic_load_n(&srv->connected, __ATOMIC_ACQUIRE)
+			&& spsc_ring_count(&srv->queue) < srv->num_bufs) ? 0 : -1;
+}
+
+void stream_srv_close(stream_server * srv)
+{
+	// STREAM_END to the client, once everything queued before it is sent. The run is over, so this may wait (up to
+	// STREAM_SEND_TIMEOUT_MS) for a slow client to make room for it
+	if (srv->pool == NULL)
+	{
+		return;
+	}
+	stream_srv_wait_room(srv, STREAM_SEND_TIMEOUT_MS);
+	stream_srv_send(srv, STREAM_END, 0, 0, 0, NULL, 0, 0);
+	__atomic_store_n(&srv->stop, 1, __ATOMIC_RELEASE);
+	sem_post(&srv->filled);
+	pthread_join(srv->thread, NULL);
+	sem_destroy(&srv->filled);
+
+	close(srv->listen_fd);
+	srv->listen_fd = -1;
+	if (srv->unix_path[0] != '\0')
+		unlink(srv->unix_path);
+	free(srv->pool);
+	srv->pool = NULL;
+}
+
+void stream_srv_report(stream_server * srv, FILE * fp)
+{
+	// "key = value" lines, like acqu.par
+	fprintf(fp, "streamClients = %d\n", srv->clients);
+	fprintf(fp, "streamScansFull = %d\n", srv->scans_full);
+	fprintf(fp, "streamScansPreview = %d\n", srv->scans_preview);
+	fprintf(fp, "streamPreviewDecimation = %d\n", srv->decimation);
+	fprintf(fp, "streamDropped = %d\n", srv->dropped);
+	fprintf(fp, "streamNotConnected = %d\n", srv->not_connected);
+	fprintf(fp, "streamMaxQueued = %d\n", srv->max_queued);
+	fprintf(fp, "streamFramesSent = %d\n", srv->sent);
+	fprintf(fp, "streamBytesSent = %llu\n", (unsigned long long) srv->bytes_sent);
+	fprintf(fp, "streamSendErrors = %d\n", srv->send_errors);
+}
@@ -0,0 +1,114 @@
+/*
+ * stream_server.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_STREAM_SERVER_H_
+#define FUNCTIONS_STREAM_SERVER_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "spsc_ring.h"
+
+#define STREAM_MAGIC		0x53524D4E	// "NMRS" at the start of every frame
+#define STREAM_VERSION		2
+#define STREAM_MAX_BUFS		64
+#define STREAM_SEND_TIMEOUT_MS	2000	// a client that takes no data for this long is disconnected
+
+// live data of a run to one analysis client, over tcp or a unix socket. Every message is a stream_frame followed by
+// length bytes of payload, in the byte order of the board (little endian):
+//   STREAM_HELLO    once per connection: stream_hello
+//   STREAM_SCAN     the words of a scan (or segment) as acquired, seq is the 0-based scan
+//   STREAM_PREVIEW  every decimation-th word of a scan, instead of the scan when the client falls behind
+//   STREAM_AVERAGE  float running average of the first scans scans (or a part of it)
+// A scan or an average longer than the buffers comes in several frames of the same seq, word_offset tells where each goes.
+//   STREAM_END      the run is over
+// The acquisition copies a frame into the next free buffer of a pool and goes on, and a sender thread writes the
+// queued frames to the socket (which blocks when the client does not keep up). The queue is the backpressure: above
+// preview_level queued frames the scans go out decimated, and when it is full they are dropped. The acquisition never
+// waits for the client, and nothing is queued while no client is connected.
+// There is no authentication: over tcp the server listens on loopback unless it is given another address.
+typedef enum
+{
+	STREAM_HELLO = 1,
+	STREAM_SCAN = 2,
+	STREAM_PREVIEW = 3,
+	STREAM_AVERAGE = 4,
+	STREAM_END = 5
+} stream_frame_type;
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t type;				// stream_frame_type
+	uint16_t flags;				// SCAN_LOG_NEGATED for a scan of the inverted phase
+	uint32_t seq;
+	uint32_t length;			// bytes of payload after this header
+	uint64_t timestamp_ns;		// CLOCK_REALTIME when the frame was queued
+	uint32_t decimation;		// STREAM_PREVIEW: every decimation-th word of the scan
+	uint32_t scans;				// STREAM_AVERAGE: scans in the average
+	uint32_t word_offset;		// words (floats for STREAM_AVERAGE) of seq before this frame
+	uint32_t reserved;
+} stream_frame;
+
+typedef struct
+{
+	uint32_t version;
+	char kind[16];				// e.g. "cpmg_raw"
+	uint32_t word_format;		// scan_codec_type of the scan words (SCAN_CODEC_RAW14 or SCAN_CODEC_I32)
+	uint32_t scan_words;
+	uint32_t avg_points;		// floats in an average
+	uint32_t echoes;
+	uint32_t scans;				// scans the run is set up for
+	double freq;				// MHz
+} stream_hello;
+
+typedef struct
+{
+	int listen_fd;
+	int client_fd;				// only touched by the sender thread
+	char unix_path[108];		// removed at the end (empty for tcp)
+	uint32_t connected;			// set by the sender thread, read by the acquisition
+	uint32_t stop;
+	stream_hello hello;
+
+	uint32_t max_length;		// largest payload
+	uint32_t stride;			// bytes per buffer
+	uint32_t num_bufs;			// power of 2
+	uint32_t preview_level;		// queued frames from which the scans are decimated
+	uint32_t decimation;
+	uint8_t *pool;
+	spsc_ring queue;
+	uint32_t items[STREAM_MAX_BUFS];
+	uint32_t frames;			// frames queued (the next buffer)
+	pthread_t thread;
+	sem_t filled;
+
+	// statistics
+	uint32_t clients;
+	uint32_t scans_full;
+	uint32_t scans_preview;
+	uint32_t dropped;			// frames not queued because the queue was full
+	uint32_t not_connected;		// frames not queued because no client was connected
+	uint32_t max_queued;
+	uint32_t sent;
+	uint64_t bytes_sent;
+	uint32_t send_errors;
+} stream_server;
+
+int stream_srv_open(stream_server * srv, int port, const char * bind_addr, char * unix_path,
+		const stream_hello * hello, uint32_t max_length, uint32_t num_bufs,
+		uint32_t decimation, int io_cpu);
+int stream_srv_wait_client(stream_server * srv, unsigned int timeout_ms);
+int stream_srv_send(stream_server * srv, stream_frame_type type, uint32_t seq,
+		uint32_t word_offset, uint32_t flags, volatile void * data,
+		uint32_t length, uint32_t scans);
+int stream_srv_wait_room(stream_server * srv, unsigned int timeout_ms);
+void stream_srv_close(stream_server * srv);
+void stream_srv_report(stream_server * srv, FILE * fp);
+
+#endif /* FUNCTIONS_STREAM_SERVER_H_ */
@@ -0,0 +1,327 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "t2_dist.h"
+
+// the last kernel built. Repeated runs with the same echo time, echo count and grid reuse it
+static t2_kernel *t2_kernel_cache = NULL;
+
+static void t2_kernel_free(t2_kernel * ker)
+{
+	free(ker->t2);
+	free(ker->K);
+	free(ker->KtK);
+	free(ker);
+}
+
+void t2_kernel_release(void)
+{
+	// frees the cached kernel (at program exit; t2_kernel_get replaces it itself when the echo train changes)
+	if (t2_kernel_cache != NULL)
+	{
+		t2_kernel_free(t2_kernel_cache);
+		t2_kernel_cache = NULL;
+	}
+}
+
+t2_kernel *t2_kernel_get(double echo_time, unsigned int echoes, double t2_min,
+		double t2_max, unsigned int points)
+{
+	// returns the kernel of the grid of points T2 from t2_min to t2_max (log-spaced), for echoes at echo_time spacing
+	t2_kernel *ker = t2_kernel_cache;
+	unsigned int i, j, n;
+	double r, k, a, sum;
+
+	if (ker != NULL && ker->echo_time == echo_time && ker->echoes == echoes
+			&& ker->t2_min == t2_min && ker->t2_max == t2_max
+			&& ker->points == points)
+	{
+		return ker;
+	}
+	t2_kernel_release();
+
+	if (points < 2 || points > T2_DIST_MAX_POINTS || echoes == 0
+			|| echo_time <= 0 || t2_min <= 0 || t2_max <= t2_min)
+	{
+		printf("\t[ERROR] invalid T2 grid (%d points from %g to %g) or echo train (%d echoes at %g)\n",
+				points, t2_min, t2_max, echoes, echo_time);
+		return NULL;
+	}
+
+	ker = (t2_kernel *) malloc(sizeof(t2_kernel));
+	if (ker == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the T2 kernel\n");
+		return NULL;
+	}
+	ker->echo_time = echo_time;
+	ker->echoes = echoes;
+	ker->t2_min = t2_min;
+	ker->t2_max = t2_max;
+	ker->points = points;
+	ker->t2 = (double *) malloc(points * sizeof(double));
+	ker->K = (float *) malloc((size_t) points * echoes * sizeof(float));
+	ker->KtK = (double *) malloc(points * points * sizeof(double));
+	if (ker->t2 == NULL || ker->K == NULL || ker->KtK == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the T2 kernel (%d x %d)\n", points,
+				echoes);
+		t2_kernel_free(ker);
+		return NULL;
+	}
+
+	for (i = 0; i < points; i++)
+	{
+		ker->t2[i] = t2_min * pow(t2_max / t2_min, (double) i / (points - 1));
+
+		// exp(-t/T2) at t = echo_time, 2*echo_time, .. is a geometric sequence
+		r = exp(-echo_time / ker->t2[i]);
+		k = 1;
+		for (n = 0; n < echoes; n++)
+		{
+			k *= r;
+			ker->K[(size_t) i * echoes + n] = (float) k;
+		}
+	}
+
+	// K'K[i][j] = sum_n q^(n+1) with q = exp(-echo_time*(1/T2i + 1/T2j)), in closed form
+	for (i = 0; i < points; i++)
+	{
+		for (j = 0; j <= i; j++)
+		{
+			a = echo_time * (1 / ker->t2[i] + 1 / ker->t2[j]);
+			sum = exp(-a) * -expm1(-a * echoes) / -expm1(-a);
+			ker->KtK[i * points + j] = sum;
+			ker->KtK[j * points + i] = sum;
+		}
+	}
+
+	t2_kernel_cache = ker;
+	return ker;
+}
+
+static double t2_dot(const float * k, const float * y, unsigned int n)
+{
+	// float products, summed in double every block so long echo trains do not lose precision
+	unsigned int i = 0, blk;
+	double sum = 0;
+	float s;
+
+	while (i < n)
+	{
+		blk = (n - i > 256) ? i + 256 : n;
+#ifdef __ARM_NEON
+		float32x4_t acc = vdupq_n_f32(0);
+		for (; i + 4 <= blk; i += 4)
+			acc = vmlaq_f32(acc, vld1q_f32(k + i), vld1q_f32(y + i));
+		s = vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)
+				+ vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3);
+#else
+		s = 0;
+#endif
+		for (; i < blk; i++)
+			s += k[i] * y[i];
+		sum += s;
+	}
+	return sum;
+}
+
+static int t2_solve_passive(const double * G, const double * b,
+		const unsigned char * passive, unsigned int m, double * z, double * L,
+		unsigned int * idx)
+{
+	// z = G_PP^-1 b_P on the passive set (cholesky), 0 elsewhere
+	unsigned int np = 0, i, j, k;
+	double s;
+
+	for (i = 0; i < m; i++)
+	{
+		z[i] = 0;
+		if (passive[i])
+			idx[np++] = i;
+	}
+	for (j = 0; j < np; j++)
+	{
+		for (i = j; i < np; i++)
+		{
+			s = G[idx[i] * m + idx[j]];
+			for (k = 0; k < j; k++)
+				s -= L[i * np + k] * L[j * np + k];
+			if (i == j)
+			{
+				if (s <= 0)
+					return -1;
+				L[j * np + j] = sqrt(s);
+			}
+			else
+			{
+				L[i * np + j] = s / L[j * np + j];
+			}
+		}
+	}
+	for (i = 0; i < np; i++)
+	{
+		s = b[idx[i]];
+		for (k = 0; k < i; k++)
+			s -= L[i * np + k] * z[idx[k]];
+		z[idx[i]] = s / L[i * np + i];
+	}
+	for (i = np; i-- > 0;)
+	{
+		s = z[idx[i]];
+		for (k = i + 1; k < np; k++)
+			s -= L[k * np + i] * z[idx[k]];
+		z[idx[i]] = s / L[i * np + i];
+	}
+	return 0;
+}
+
+static int t2_nnls(t2_kernel * ker, const double * y, const float * yf,
+		double * G, double * L, double * z, double * w, double * b,
+		unsigned int * idx, t2_dist_result * res)
+{
+	// lawson-hanson on the normal equations G f = b with G = K'K + alpha I (res->alpha), b = K'y
+	unsigned int m = ker->points, N = ker->echoes;
+	unsigned int i, j, n, jmax, jstep, max_iter = 3 * m;
+	unsigned char passive[T2_DIST_MAX_POINTS];
+	double tol, bmax = 0, step, ratio, s, fit;
+
+	memset(passive, 0, sizeof(passive));
+	memcpy(G, ker->KtK, m * m * sizeof(double));
+	for (i = 0; i < m; i++)
+		G[i * m + i] += res->alpha;
+	for (i = 0; i < m; i++)
+	{
+		b[i] = t2_dot(ker->K + (size_t) i * N, yf, N);
+		if (fabs(b[i]) > bmax)
+			bmax = fabs(b[i]);
+	}
+	tol = 1e-10 * (bmax > 0 ? bmax : 1);
+
+	// move the T2 with the steepest descent into the passive set, and back out whenever it goes negative
+	while (res->iterations < max_iter)
+	{
+		jmax = m;
+		for (i = 0; i < m; i++)
+		{ // gradient w = b - G f
+			s = b[i];
+			for (j = 0; j < m; j++)
+				s -= G[i * m + j] * res->f[j];
+			w[i] = s;
+			if (!passive[i] && w[i] > tol && (jmax == m || w[i] > w[jmax]))
+				jmax = i;
+		}
+		if (jmax == m)
+			break; // optimal
+		passive[jmax] = 1;
+		res->iterations++;
+
+		while (1)
+		{
+			if (t2_solve_passive(G, b, passive, m, z, L, idx) < 0)
+			{
+				printf("\t[ERROR] the T2 distribution is singular, increase the regularization\n");
+				return -1;
+			}
+			step = 1;
+			jstep = m;
+			for (i = 0; i < m; i++)
+			{
+				if (passive[i] && z[i] <= 0)
+				{
+					ratio = res->f[i] / (res->f[i] - z[i]);
+					if (ratio < step)
+					{
+						step = ratio;
+						jstep = i;
+					}
+				}
+			}
+			if (step >= 1)
+			{
+				memcpy(res->f, z, m * sizeof(double));
+				break;
+			}
+			for (i = 0; i < m; i++)
+			{ // the step stops where the first T2 reaches 0 (jstep, exactly 0 even with the rounding): it leaves the passive set,
+			  // with any other that reached 0 in the same step
+				if (passive[i])
+				{
+					res->f[i] += step * (z[i] - res->f[i]);
+					if (i == jstep || res->f[i] <= 0)
+					{
+						res->f[i] = 0;
+						passive[i] = 0;
+					}
+				}
+			}
+		}
+	}
+
+	// residual of the decay, only over the T2 that are not 0
+	s = 0;
+	for (n = 0; n < N; n++)
+	{
+		fit = 0;
+		for (i = 0; i < m; i++)
+			if (res->f[i] > 0)
+				fit += res->f[i] * ker->K[(size_t) i * N + n];
+		s += (fit - y[n]) * (fit - y[n]);
+	}
+	res->rms = sqrt(s / N);
+
+	return 0;
+}
+
+int t2_dist(t2_kernel * ker, const double * y, double alpha,
+		t2_dist_result * res)
+{
+	// alpha is relative to the mean diagonal of K'K, so the same value fits any echo count and grid
+	unsigned int m = ker->points, N = ker->echoes;
+	unsigned int i, n;
+	double trace = 0;
+	int ret = -1;
+
+	double *G = (double *) malloc(m * m * sizeof(double));
+	double *L = (double *) malloc(m * m * sizeof(double));
+	double *z = (double *) malloc(m * sizeof(double));
+	double *w = (double *) malloc(m * sizeof(double));
+	double *b = (double *) malloc(m * sizeof(double));
+	unsigned int *idx = (unsigned int *) malloc(m * sizeof(unsigned int));
+	float *yf = (float *) malloc(N * sizeof(float));
+
+	res->points = m;
+	res->iterations = 0;
+	memcpy(res->t2, ker->t2, m * sizeof(double));
+	memset(res->f, 0, sizeof(res->f));
+	for (i = 0; i < m; i++)
+		trace += ker->KtK[i * m + i];
+	res->alpha = alpha * trace / m;
+
+	if (G == NULL || L == NULL || z == NULL || w == NULL || b == NULL
+			|| idx == NULL || yf == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the T2 distribution buffers\n");
+	}
+	else
+	{
+		for (n = 0; n < N; n++)
+			yf[n] = (float) y[n];
+		ret = t2_nnls(ker, y, yf, G, L, z, w, b, idx, res);
+	}
+
+	free(G);
+	free(L);
+	free(z);
+	free(w);
+	free(b);
+	free(idx);
+	free(yf);
+	return ret;
+}
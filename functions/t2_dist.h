@@ -0,0 +1,44 @@
+/*
+ * t2_dist.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_T2_DIST_H_
+#define FUNCTIONS_T2_DIST_H_
+
+#define T2_DIST_MAX_POINTS	512
+
+// T2 distribution by inverse laplace transform of the decay y[n] at the echo times t[n] = (n+1)*echo_time:
+// min |K f - y|^2 + alpha |f|^2 with f >= 0 and K[n][i] = exp(-t[n]/T2[i]) on a log-spaced T2 grid.
+// The problem is solved in its normal form (K'K + alpha I) f = K'y with the lawson-hanson active set, so after K'y the cost
+// only depends on the grid size and not on the number of echoes.
+typedef struct
+{
+	double echo_time;
+	unsigned int echoes;
+	double t2_min;
+	double t2_max;
+	unsigned int points;
+	double *t2;			// the T2 grid (points)
+	float *K;			// kernel, one row of echoes per T2 (points x echoes)
+	double *KtK;		// K'K (points x points)
+} t2_kernel;
+
+typedef struct
+{
+	unsigned int points;
+	double t2[T2_DIST_MAX_POINTS];
+	double f[T2_DIST_MAX_POINTS];	// amplitude of every T2 of the grid
+	double alpha;					// regularization used (absolute)
+	double rms;						// rms of the residual of the decay
+	unsigned int iterations;		// active set changes
+} t2_dist_result;
+
+t2_kernel *t2_kernel_get(double echo_time, unsigned int echoes, double t2_min,
+		double t2_max, unsigned int points);
+void t2_kernel_release(void);
+int t2_dist(t2_kernel * ker, const double * y, double alpha,
+		t2_dist_result * res);
+
+#endif /* FUNCTIONS_T2_DIST_H_ */
@@ -0,0 +1,433 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t2_fit.h"
+
+static const char *t2_model_names[T2_NUM_MODELS] =
+{ "mono", "bi", "stretched" };
+static const unsigned int t2_model_params[T2_NUM_MODELS] =
+{ 3, 5, 4 };
+static const char *t2_param_names[T2_NUM_MODELS][T2_FIT_MAX_PARAMS] =
+{
+{ "A", "T2", "C" },
+{ "A1", "T21", "A2", "T22", "C" },
+{ "A", "T2", "Beta", "C" } };
+
+double t2_fit_phase(const float * decay, unsigned int echoes, double * y)
+{
+	// rotate the complex echo amplitudes (interleaved re,im) so the signal is in the real part, which goes into y.
+	// Returns the phase removed, in radians
+	unsigned int e;
+	double re = 0, im = 0, ph, c, s;
+
+	for (e = 0; e < echoes; e++)
+	{
+		re += decay[2 * e];
+		im += decay[2 * e + 1];
+	}
+	ph = atan2(im, re);
+	c = cos(ph);
+	s = sin(ph);
+	for (e = 0; e < echoes; e++)
+	{
+		y[e] = decay[2 * e] * c + decay[2 * e + 1] * s;
+	}
+
+	return ph;
+}
+
+static int t2_params_valid(t2_model model, const double * p)
+{
+	switch (model)
+	{
+	case T2_MONO:
+		return p[1] > 0;
+	case T2_BI:
+		return p[1] > 0 && p[3] > 0;
+	case T2_STRETCHED:
+		return p[1] > 0 && p[2] > 0.05 && p[2] <= 3;
+	default:
+		return 0;
+	}
+}
+
+static double t2_even_spacing(const double * t, unsigned int n)
+{
+	// the echo spacing when the echo times are evenly spaced (t[i] = t[0] + i*dt), 0 otherwise
+	unsigned int i;
+	double dt = (n > 1) ? (t[n - 1] - t[0]) / (n - 1) : 0;
+
+	if (dt <= 0)
+	{
+		return 0;
+	}
+	for (i = 1; i < n; i++)
+	{
+		if (fabs(t[i] - t[0] - i * dt) > 1e-9 * (fabs(t[i]) + dt))
+		{
+			return 0;
+		}
+	}
+	return dt;
+}
+
+static void t2_exp_series(const double * t, unsigned int n, double dt,
+		double T2, double * e)
+{
+	// e[i] = exp(-t[i]/T2). With evenly spaced echoes (dt > 0) only every T2_EXP_ANCHOR-th point takes an exp, the others
+	// are the previous one times exp(-dt/T2), so the rounding of the recurrence stays near 1e-14
+	unsigned int i, anchor = 0;
+	double step;
+
+	if (dt <= 0)
+	{
+		for (i = 0; i < n; i++)
+			e[i] = exp(-t[i] / T2);
+		return;
+	}
+	step = exp(-dt / T2);
+	for (i = 0; i < n; i++)
+	{
+		if (i == anchor)
+		{
+			e[i] = exp(-t[i] / T2);
+			anchor += T2_EXP_ANCHOR;
+		}
+		else
+			e[i] = e[i - 1] * step;
+	}
+}
+
+static void t2_eval(t2_model model, const double * p, const double * t,
+		unsigned int n, double dt, double * f, double * J, double * e)
+{
+	// model values f and, when J is not NULL, the analytic jacobian stored column by column (J[k*n+i] = df_i/dp_k).
+	// dt: see t2_even_spacing. e is scratch of n points.
+	// Scalar on purpose, unlike the __ARM_NEON paths of fft_functions.c and scan_codec.c: the fit needs double precision and
+	// the NEON of the Cortex-A9 (ARMv7) has no float64 lanes. The exp recurrence of t2_exp_series is the speed-up instead
+	unsigned int i;
+	double e1, e2, u, lg;
+
+	switch (model)
+	{
+	case T2_MONO:
+		t2_exp_series(t, n, dt, p[1], e);
+		for (i = 0; i < n; i++)
+		{
+			e1 = e[i];
+			f[i] = p[0] * e1 + p[2];
+			if (J != NULL)
+			{
+				J[i] = e1;
+				J[n + i] = p[0] * e1 * t[i] / (p[1] * p[1]);
+				J[2 * n + i] = 1;
+			}
+		}
+		break;
+	case T2_BI:
+		t2_exp_series(t, n, dt, p[1], e);
+		t2_exp_series(t, n, dt, p[3], f); // overwritten by the model value of the same point
+		for (i = 0; i < n; i++)
+		{
+			e1 = e[i];
+			e2 = f[i];
+			f[i] = p[0] * e1 + p[2] * e2 + p[4];
+			if (J != NULL)
+			{
+				J[i] = e1;
+				J[n + i] = p[0] * e1 * t[i] / (p[1] * p[1]);
+				J[2 * n + i] = e2;
+				J[3 * n + i] = p[2] * e2 * t[i] / (p[3] * p[3]);
+				J[4 * n + i] = 1;
+			}
+		}
+		break;
+	case T2_STRETCHED:
+		for (i = 0; i < n; i++)
+		{
+			lg = (t[i] > 0) ? log(t[i] / p[1]) : 0;
+			u = (t[i] > 0) ? exp(p[2] * lg) : 0; // (t/T2)^Beta
+			e1 = exp(-u);
+			f[i] = p[0] * e1 + p[3];
+			if (J != NULL)
+			{
+				J[i] = e1;
+				J[n + i] = p[0] * e1 * u * p[2] / p[1];
+				J[2 * n + i] = -p[0] * e1 * u * lg;
+				J[3 * n + i] = 1;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static int t2_cholesky_solve(double * A, const double * b, double * x,
+		unsigned int np)
+{
+	// solves A x = b for a symmetric positive definite A (np x np), which is overwritten by its cholesky factor
+	unsigned int i, j, k;
+	double s;
+
+	for (j = 0; j < np; j++)
+	{
+		s = A[j * np + j];
+		for (k = 0; k < j; k++)
+			s -= A[j * np + k] * A[j * np + k];
+		if (s <= 0)
+			return -1;
+		A[j * np + j] = sqrt(s);
+		for (i = j + 1; i < np; i++)
+		{
+			s = A[i * np + j];
+			for (k = 0; k < j; k++)
+				s -= A[i * np + k] * A[j * np + k];
+			A[i * np + j] = s / A[j * np + j];
+		}
+	}
+	for (i = 0; i < np; i++)
+	{ // L y = b
+		s = b[i];
+		for (k = 0; k < i; k++)
+			s -= A[i * np + k] * x[k];
+		x[i] = s / A[i * np + i];
+	}
+	for (i = np; i-- > 0;)
+	{ // L' x = y
+		s = x[i];
+		for (k = i + 1; k < np; k++)
+			s -= A[k * np + i] * x[k];
+		x[i] = s / A[i * np + i];
+	}
+	return 0;
+}
+
+static double t2_normal_eq(const double * J, const double * r, unsigned int n,
+		unsigned int np, double * JtJ, double * Jtr)
+{
+	// JtJ = J'J, Jtr = J'r. Returns the sum of squared residuals
+	unsigned int i, j, k;
+	double s, ssr = 0;
+
+	for (j = 0; j < np; j++)
+	{
+		for (k = 0; k <= j; k++)
+		{
+			s = 0;
+			for (i = 0; i < n; i++)
+				s += J[j * n + i] * J[k * n + i];
+			JtJ[j * np + k] = s;
+			JtJ[k * np + j] = s;
+		}
+		s = 0;
+		for (i = 0; i < n; i++)
+			s += J[j * n + i] * r[i];
+		Jtr[j] = s;
+	}
+	for (i = 0; i < n; i++)
+		ssr += r[i] * r[i];
+	return ssr;
+}
+
+static void t2_initial_guess(t2_model model, const double * t, const double * y,
+		unsigned int n, double * p)
+{
+	// A from the first echo, T2 from the first echo below A/e, no baseline
+	unsigned int i;
+	double A = y[0], T2 = t[n - 1];
+
+	for (i = 1; i < n; i++)
+	{
+		if (y[i] < A / M_E)
+		{
+			T2 = t[i];
+			break;
+		}
+	}
+	if (T2 <= 0)
+	{
+		T2 = 1;
+	}
+
+	switch (model)
+	{
+	case T2_MONO:
+		p[0] = A;
+		p[1] = T2;
+		p[2] = 0;
+		break;
+	case T2_BI:
+		p[0] = A / 2;
+		p[1] = T2 / 3;
+		p[2] = A / 2;
+		p[3] = T2 * 2;
+		p[4] = 0;
+		break;
+	case T2_STRETCHED:
+		p[0] = A;
+		p[1] = T2;
+		p[2] = 1;
+		p[3] = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+int t2_fit(t2_model model, const double * t, const double * y, unsigned int n,
+		t2_fit_result * res)
+{
+	// levenberg-marquardt fit of the decay y at the echo times t
+	unsigned int np, i, k;
+	double lambda = 1e-3, ssr, ssr_try = 0, dt;
+	double p_try[T2_FIT_MAX_PARAMS], delta[T2_FIT_MAX_PARAMS];
+	double JtJ[T2_FIT_MAX_PARAMS * T2_FIT_MAX_PARAMS], Jtr[T2_FIT_MAX_PARAMS];
+	double A[T2_FIT_MAX_PARAMS * T2_FIT_MAX_PARAMS], unit[T2_FIT_MAX_PARAMS];
+	double *f, *r, *J, *e;
+	int accepted, small;
+
+	memset(res, 0, sizeof(t2_fit_result));
+	if (model >= T2_NUM_MODELS)
+	{
+		printf("\t[ERROR] unknown decay model %d\n", model);
+		return -1;
+	}
+	np = t2_model_params[model];
+	res->model = model;
+	res->num_params = np;
+	if (n <= np)
+	{
+		printf("\t[ERROR] %d echoes are not enough to fit the %s-exponential decay\n",
+				n, t2_model_names[model]);
+		return -1;
+	}
+
+	f = (double *) malloc(n * sizeof(double));
+	r = (double *) malloc(n * sizeof(double));
+	J = (double *) malloc(n * np * sizeof(double));
+	e = (double *) malloc(n * sizeof(double));
+	if (f == NULL || r == NULL || J == NULL || e == NULL)
+	{
+		printf("\t[ERROR] cannot allocate the t2 fit buffers\n");
+		free(f);
+		free(r);
+		free(J);
+		free(e);
+		return -1;
+	}
+
+	dt = t2_even_spacing(t, n);
+	t2_initial_guess(model, t, y, n, res->p);
+	t2_eval(model, res->p, t, n, dt, f, J, e);
+	for (i = 0; i < n; i++)
+		r[i] = y[i] - f[i];
+	ssr = t2_normal_eq(J, r, n, np, JtJ, Jtr);
+
+	for (res->iterations = 0; res->iterations < T2_FIT_MAX_ITER;
+			res->iterations++)
+	{
+		accepted = 0;
+		while (!accepted && lambda < 1e12)
+		{
+			// (J'J + lambda*diag(J'J)) delta = J'r
+			memcpy(A, JtJ, sizeof(double) * np * np);
+			for (k = 0; k < np; k++)
+				A[k * np + k] += lambda * (JtJ[k * np + k] > 0 ? JtJ[k * np + k] : 1);
+			if (t2_cholesky_solve(A, Jtr, delta, np) == 0)
+			{
+				for (k = 0; k < np; k++)
+					p_try[k] = res->p[k] + delta[k];
+				if (t2_params_valid(model, p_try))
+				{
+					t2_eval(model, p_try, t, n, dt, f, NULL, e);
+					ssr_try = 0;
+					for (i = 0; i < n; i++)
+						ssr_try += (y[i] - f[i]) * (y[i] - f[i]);
+					accepted = (ssr_try < ssr);
+				}
+			}
+			if (!accepted)
+				lambda *= 10;
+		}
+		if (!accepted)
+		{ // no step lowers the residual any more: at the minimum
+			res->converged = 1;
+			break;
+		}
+
+		small = 1;
+		for (k = 0; k < np; k++)
+		{
+			if (fabs(delta[k]) > 1e-8 * (fabs(res->p[k]) + 1e-12))
+				small = 0;
+			res->p[k] = p_try[k];
+		}
+		lambda = (lambda > 1e-12) ? lambda / 10 : lambda;
+
+		t2_eval(model, res->p, t, n, dt, f, J, e);
+		for (i = 0; i < n; i++)
+			r[i] = y[i] - f[i];
+		small |= (ssr - ssr_try) <= 1e-12 * ssr;
+		ssr = t2_normal_eq(J, r, n, np, JtJ, Jtr);
+		if (small)
+		{
+			res->converged = 1;
+			break;
+		}
+	}
+
+	// covariance = s^2 (J'J)^-1, one column at a time
+	res->rms = sqrt(ssr / n);
+	for (k = 0; k < np; k++)
+	{
+		memset(unit, 0, sizeof(unit));
+		unit[k] = 1;
+		memcpy(A, JtJ, sizeof(double) * np * np);
+		if (t2_cholesky_solve(A, unit, delta, np) == 0)
+			res->sigma[k] = sqrt(ssr / (n - np) * delta[k]);
+		else
+			res->sigma[k] = NAN; // the parameters are degenerate
+	}
+
+	if (model == T2_BI && res->p[1] > res->p[3])
+	{ // the short component first
+		double tmp[2] =
+		{ res->p[0], res->p[1] };
+		res->p[0] = res->p[2];
+		res->p[1] = res->p[3];
+		res->p[2] = tmp[0];
+		res->p[3] = tmp[1];
+		tmp[0] = res->sigma[0];
+		tmp[1] = res->sigma[1];
+		res->sigma[0] = res->sigma[2];
+		res->sigma[1] = res->sigma[3];
+		res->sigma[2] = tmp[0];
+		res->sigma[3] = tmp[1];
+	}
+
+	free(f);
+	free(r);
+	free(J);
+	free(e);
+	return 0;
+}
+
+void t2_fit_print(FILE * fp, const t2_fit_result * res)
+{
+	// writes the fit as "key = value" lines, like acqu.par (e.g. monoT2 = .., monoT2Err = ..)
+	const char *m = t2_model_names[res->model];
+	unsigned int k;
+
+	for (k = 0; k < res->num_params; k++)
+	{
+		fprintf(fp, "%s%s = %g\n", m, t2_param_names[res->model][k], res->p[k]);
+		fprintf(fp, "%s%sErr = %g\n", m, t2_param_names[res->model][k],
+				res->sigma[k]);
+	}
+	fprintf(fp, "%sRms = %g\n", m, res->rms);
+	fprintf(fp, "%sIterations = %d\n", m, res->iterations);
+	fprintf(fp, "%sConverged = %d\n", m, res->converged);
+}
@@ -0,0 +1,41 @@
+/*
+ * t2_fit.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FUNCTIONS_T2_FIT_H_
+#define FUNCTIONS_T2_FIT_H_
+
+#include <stdio.h>
+
+#define T2_FIT_MAX_PARAMS	5
+#define T2_FIT_MAX_ITER		200
+#define T2_EXP_ANCHOR		64	// with evenly spaced echoes, exp is evaluated exactly every this many echoes (see t2_exp_series)
+
+// decay models, all with a constant baseline C:
+// mono:		A*exp(-t/T2) + C
+// bi:			A1*exp(-t/T21) + A2*exp(-t/T22) + C, with T21 <= T22
+// stretched:	A*exp(-(t/T2)^Beta) + C
+typedef enum
+{
+	T2_MONO = 0, T2_BI, T2_STRETCHED, T2_NUM_MODELS
+} t2_model;
+
+typedef struct
+{
+	t2_model model;
+	unsigned int num_params;
+	double p[T2_FIT_MAX_PARAMS];		// in the order of the model above
+	double sigma[T2_FIT_MAX_PARAMS];	// 1-sigma uncertainty, from the covariance scaled by the residual variance
+	double rms;							// residual rms
+	unsigned int iterations;
+	int converged;
+} t2_fit_result;
+
+double t2_fit_phase(const float * decay, unsigned int echoes, double * y);
+int t2_fit(t2_model model, const double * t, const double * y, unsigned int n,
+		t2_fit_result * res);
+void t2_fit_print(FILE * fp, const t2_fit_result * res);
+
+#endif /* FUNCTIONS_T2_FIT_H_ */
@@ -671,110 +671,11 @@ void wr_dac_ad5724r(volatile unsigned int * dac_addr, unsigned int dac_id,
 	}
 }
 
-void check_dma(volatile unsigned int * dma_addr, uint8_t en_mesg)
-{
-	// this function waits until the dma addressed finishes its operation
-	unsigned int dma_status;
-	do
-	{
-		dma_status = alt_read_word(dma_addr + DMA_STATUS_OFST);
-		if (en_mesg)
-		{
-			printf("\tDMA Status reg: 0x%x\n", dma_status);
-			if (!(dma_status & DMA_STAT_DONE_MSK))
-			{
-				printf("\tDMA transaction is not done.\n");
-			}
-			if (dma_status & DMA_STAT_BUSY_MSK)
-			{
-				printf("\tDMA is busy.\n");
-
-				// print length register
-				printf("\t--> DMA length register: %d\n",
-						alt_read_word(dma_addr + DMA_LENGTH_OFST));	// set transfer length (in byte, so multiply by 4 to get word-addressing));
-
-				// wait time in case of DMA busy. Only valid under ENABLE_MESSAGE because the loop needs to be fast otherwise
-				unsigned int wait_time_ms = 500;
-				usleep(wait_time_ms * 1000); // wait time to prevent overloading the DMA bus arbitration request only if the dma is busy
-				printf("\t---> waiting for %d ms ...\n", wait_time_ms);
-			}
-		}
-	} while (!(dma_status & DMA_STAT_DONE_MSK)
-			|| (dma_status & DMA_STAT_BUSY_MSK)); // keep in the loop when the 'DONE' bit is '0' and 'BUSY' bit is '1'
-	if (en_mesg)
-	{
-		if (dma_status & DMA_STAT_REOP_MSK)
-		{
-			printf(
-					"\tDMA transaction completed due to end-of-packet on read side.\n");
-		}
-		if (dma_status & DMA_STAT_WEOP_MSK)
-		{
-			printf(
-					"\tDMA transaction completed due to end-of-packet on write side.\n");
-		}
-		if (dma_status & DMA_STAT_LEN_MSK)
-		{
-			printf(
-					"\tDMA transaction completed due to length-register decrements to 0.\n");
-		}
-	}
-}
-
-void fifo_to_sdram_dma_trf(volatile unsigned int * dma_addr, uint32_t rd_addr,
-		uint32_t wr_addr, uint32_t transfer_length)
-{
-	// the original conventional code
-	alt_write_word(dma_addr + DMA_CONTROL_OFST, DMA_CTRL_SWRST_MSK); // write twice to do software reset
-	alt_write_word(dma_addr + DMA_CONTROL_OFST, DMA_CTRL_SWRST_MSK); // software resetted
-	alt_write_word(dma_addr + DMA_STATUS_OFST, 0x0); 	// clear the DONE bit
-	alt_write_word(dma_addr + DMA_READADDR_OFST, rd_addr); // set DMA read address
-	alt_write_word(dma_addr + DMA_WRITEADDR_OFST, wr_addr);	// set DMA write address
-	alt_write_word(dma_addr + DMA_LENGTH_OFST, transfer_length * 4);// set transfer length (in byte, so multiply by 4 to get word-addressing)
-	alt_write_word(dma_addr + DMA_CONTROL_OFST,
-			(DMA_CTRL_WORD_MSK | DMA_CTRL_LEEN_MSK | DMA_CTRL_RCON_MSK)); // set settings for transfer
-	alt_write_word(dma_addr + DMA_CONTROL_OFST,
-			(DMA_CTRL_WORD_MSK | DMA_CTRL_LEEN_MSK | DMA_CTRL_RCON_MSK
-					| DMA_CTRL_GO_MSK)); // set settings & also enable transfer
-	//
-
-	/* burst method (tested. Doesn't really work with large data due to slow reinitialization. Generally burst mode only works and faster when the amount of data is less than max burst size. Otherwise It doesn't work)
-	 uint32_t burst_size = 1024; // the max burst size is set in QSYS in DMA section
-	 uint32_t transfer_remain = transfer_length*4; // multiplied by 4 to get word-addressing
-	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	DMA_CTRL_SWRST_MSK); 	// write twice to do software reset
-	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	DMA_CTRL_SWRST_MSK); 	// software resetted
-	 alt_write_word(dma_addr+DMA_READADDR_OFST,	rd_addr); 				// set DMA read address (fifo)
-	 uint32_t iaddr = 0;
-	 while (transfer_remain>burst_size) { // transfer with burst_size when remaining data is larger than burst_size
-	 alt_write_word(dma_addr+DMA_WRITEADDR_OFST,	wr_addr + iaddr);		// set DMA write address
-	 alt_write_word(dma_addr+DMA_LENGTH_OFST, burst_size);				// set transfer length (in byte, so multiply by 4 to get word-addressing)
-	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	(DMA_CTRL_WORD_MSK|DMA_CTRL_LEEN_MSK|DMA_CTRL_RCON_MSK)); // set settings for transfer
-	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	(DMA_CTRL_WORD_MSK|DMA_CTRL_LEEN_MSK|DMA_CTRL_RCON_MSK|DMA_CTRL_GO_MSK)); // set settings & also enable transfer
-	 transfer_remain -= burst_size;
-	 iaddr += (burst_size/4);
-	 check_dma(dma_addr, DISABLE_MESSAGE); // wait for the dma operation to complete
-	 }
-	 if (transfer_remain>0) { // transfer with the remaining data
-	 alt_write_word(dma_addr+DMA_WRITEADDR_OFST,	wr_addr + iaddr);		// set DMA write address
-	 alt_write_word(dma_addr+DMA_LENGTH_OFST, transfer_remain);			// set transfer length (in byte, so multiply by 4 to get word-addressing)
-	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	(DMA_CTRL_WORD_MSK|DMA_CTRL_LEEN_MSK|DMA_CTRL_RCON_MSK)); // set settings for transfer
-	 alt_write_word(dma_addr+DMA_CONTROL_OFST,	(DMA_CTRL_WORD_MSK|DMA_CTRL_LEEN_MSK|DMA_CTRL_RCON_MSK|DMA_CTRL_GO_MSK)); // set settings & also enable transfer
-	 check_dma(dma_addr, DISABLE_MESSAGE); // wait for the dma operation to complete
-	 }
-	 */
-}
-
-void reset_dma(volatile unsigned int * dma_addr)
-{
-	alt_write_word(dma_addr + DMA_CONTROL_OFST, DMA_CTRL_SWRST_MSK); // write twice to do software reset
-	alt_write_word(dma_addr + DMA_CONTROL_OFST, DMA_CTRL_SWRST_MSK); // software resetted
-}
-
 #ifdef GET_RAW_DATA
 void datawrite_with_dma (uint32_t transfer_length, uint8_t en_mesg)
 {
-	fifo_to_sdram_dma_trf (h2p_dma_addr, ADC_FIFO_MEM_OUT_BASE, SDRAM_BASE, transfer_length);
-	check_dma(h2p_dma_addr, DISABLE_MESSAGE); // wait for the dma operation to complete. POSSIBLE_ISSUES: DEPENDING ON THE LENGTH OF CPMG, THIS SCRIPT MIGHT BREAK IF ENABLE_MESSAGE
+	fifo_to_sdram_dma_trf_ctrl (h2p_dma_addr, ADC_FIFO_MEM_OUT_BASE, SDRAM_BASE, transfer_length, dma_irq_ctrl(&dma_fifo_irq));
+	wait_dma(h2p_dma_addr, &dma_fifo_irq, DISABLE_MESSAGE); // wait for the dma operation to complete. POSSIBLE_ISSUES: DEPENDING ON THE LENGTH OF CPMG, THIS SCRIPT MIGHT BREAK IF ENABLE_MESSAGE
 
 	/*
 	 int i_sd = 0;
@@ -794,51 +695,56 @@ void datawrite_with_dma (uint32_t transfer_length, uint8_t en_mesg)
 	 */
 
 	memcpy(rddata,(int*)h2p_sdram_addr,transfer_length*sizeof(int));
-	buf32_to_buf16 (rddata, rddata_16, transfer_length );// transfer data from 32-bit buffer to 16-bit buffer
+	if (unpack_raw_scan)
+		buf32_to_buf16 (rddata, rddata_16, transfer_length );// transfer data from 32-bit buffer to 16-bit buffer
 
 }
 #endif
 
 #ifdef GET_DCONV_DATA
-void data_dconv_write_with_dma(uint32_t transfer_length, uint8_t en_mesg)
+void data_dconv_write_with_dma(uint32_t transfer_length, uint8_t copy_to_dconv, uint8_t en_mesg)
 {
+	// copy_to_dconv copies the scan from the sdram into dconv. It is not needed when the scan is accumulated straight from the sdram window with accumulate_scan
+
 	int i_sd = 0;
 	int fifo_data_read;
 
 	reset_dma(h2p_dconvi_dma_addr);
-	fifo_to_sdram_dma_trf (h2p_dconvi_dma_addr, DCONV_FIFO_MEM_OUT_BASE, SDRAM_BASE, transfer_length); // add data_len offset due to raw data before. (*4 factor is due to byte-addressing)
+	fifo_to_sdram_dma_trf_ctrl (h2p_dconvi_dma_addr, DCONV_FIFO_MEM_OUT_BASE, SDRAM_BASE, transfer_length, dma_irq_ctrl(&dma_dconvi_irq)); // add data_len offset due to raw data before. (*4 factor is due to byte-addressing)
 
 	// process dconvi
-	check_dma(h2p_dconvi_dma_addr, DISABLE_MESSAGE);// check and wait until dma is done
+	wait_dma(h2p_dconvi_dma_addr, &dma_dconvi_irq, DISABLE_MESSAGE);// check and wait until dma is done (sleeps on the irq when it is available)
 	//for (i_sd = 0; i_sd < transfer_length; i_sd++)
 	//{
 	//	fifo_data_read = alt_read_word(h2p_sdram_addr + i_sd);
 	//	dconv[i_sd] = fifo_data_read;
 	//}
 
-	memcpy(dconv,(int*)h2p_sdram_addr,transfer_length*sizeof(int));
+	if (copy_to_dconv)
+	{
+		memcpy(dconv,(int*)h2p_sdram_addr,transfer_length*sizeof(int));
+	}
 
 }
 #endif
 
-void runFSM(double nmr_fsm_clkfreq, uint32_t ph_cycl_en,
-		unsigned int acq_length, char * filename, uint8_t sav_indv_scan,
-		uint8_t store_to_sdram_noread, uint8_t rd_sdram_OR_n_rd_fifo)
+unsigned int scan_ring_slack_work(void * ctx)
 {
+	// scan scheduler slack: consume a completed sdram ring slot while waiting for the next scan
+	if (scan_ring != NULL)
+	{
+		return sdram_ring_consume_next(scan_ring);
+	}
+	return 0;
+}
 
-	// read settings
-	// uint8_t store_to_sdram_noread = 0; // do not write the data from fifo to text file (external reading mechanism should be implemented)
-	//uint8_t rd_sdram_OR_rd_fifo = 0; // store data to sdram (increasing memory limit). Or else the program reads data directly from the fifo
+void start_fsm(uint32_t ph_cycl_en)
+{
+	// start one scan with the parameters and the pll that are already set
 
 	// read the current ctrl_out
 	ctrl_out = alt_read_word(h2p_ctrl_out_addr);
 
-	// set pll for CPMG
-	Set_PLL(h2p_nmr_sys_pll_addr, 0, nmr_fsm_clkfreq, 0.5, DISABLE_MESSAGE);
-	Reset_PLL(h2p_ctrl_out_addr, PLL_NMR_SYS_RST_ofst, ctrl_out);
-	Set_DPS(h2p_nmr_sys_pll_addr, 0, 0, DISABLE_MESSAGE);
-	Wait_PLL_To_Lock(h2p_ctrl_in_addr, PLL_NMR_SYS_lock_ofst);
-
 	// cycle phase for CPMG measurement (in the case of fix phase_cycle state, this code will just generate the negation of it.
 	if (ph_cycl_en == ENABLE)
 	{
@@ -867,8 +773,37 @@ void runFSM(double nmr_fsm_clkfreq, uint32_t ph_cycl_en,
 	// the pll_rst_dly should be longer than the delay coming from changing the phase
 	// otherwise, the fsm will start with wrong relationship between 4 pll output clocks (1/2 pi difference between clock)
 	// alt_write_word( (h2p_nmr_pll_rst_dly_addr) , 1000000 );	// set the amount of delay for pll reset (with 50MHz system clock, every tick means 20ns) -> default: 100000
+	scan_scheduler_wait(&scan_sched, scan_ring_slack_work, NULL); // wait for the deadline of this scan, accumulating the previous scans meanwhile
+	if (scan_jitter_rec != NULL)
+	{
+		scan_jitter_record(scan_jitter_rec);
+	}
 	alt_write_word((h2p_ctrl_out_addr), ctrl_out | (0x01 << FSM_START_ofst)); // POTENTIAL ISSUE: this line and DMA needs to be almost atomic
 	alt_write_word((h2p_ctrl_out_addr), ctrl_out & ~(0x01 << FSM_START_ofst));
+}
+
+void runFSM(double nmr_fsm_clkfreq, uint32_t ph_cycl_en,
+		unsigned int acq_length, char * filename, uint8_t sav_indv_scan,
+		uint8_t store_to_sdram_noread, uint8_t rd_sdram_OR_n_rd_fifo)
+{
+	// with the sdram ring the scan stays in its ring slot and rddata/dconv are not filled, so only the ring consumer can save it
+	uint8_t sav_from_buf = sav_indv_scan && !(rd_sdram_OR_n_rd_fifo && scan_ring != NULL);
+
+	// read settings
+	// uint8_t store_to_sdram_noread = 0; // do not write the data from fifo to text file (external reading mechanism should be implemented)
+	//uint8_t rd_sdram_OR_rd_fifo = 0; // store data to sdram (increasing memory limit). Or else the program reads data directly from the fifo
+
+	// read the current ctrl_out
+	ctrl_out = alt_read_word(h2p_ctrl_out_addr);
+
+	// set pll for CPMG
+	Set_PLL(h2p_nmr_sys_pll_addr, 0, nmr_fsm_clkfreq, 0.5, DISABLE_MESSAGE);
+	Reset_PLL(h2p_ctrl_out_addr, PLL_NMR_SYS_RST_ofst, ctrl_out);
+	Set_DPS(h2p_nmr_sys_pll_addr, 0, 0, DISABLE_MESSAGE);
+	Wait_PLL_To_Lock(h2p_ctrl_in_addr, PLL_NMR_SYS_lock_ofst);
+
+	// cycle the phase, reset the fifo and start the fsm
+	start_fsm(ph_cycl_en);
 
 #ifdef GET_RAW_DATA
 	// WARNING: PUT ATTENTION TO DMA DELAY IF both raw data and dconv data are processed at the same time
@@ -883,23 +818,40 @@ void runFSM(double nmr_fsm_clkfreq, uint32_t ph_cycl_en,
 	{ // write data to text via c-programming
 		if (rd_sdram_OR_n_rd_fifo)
 		{ // if read with dma is intended.
-			datawrite_with_dma(acq_length/2,DISABLE_MESSAGE);
-			while ( alt_read_word(h2p_ctrl_in_addr) & (0x01<<NMR_SEQ_run_ofst) );// wait until fsm stops, just in case the DMA is too fast.
+			if (scan_ring != NULL)
+			{ // this scan lands in its own ring slot(s) and the previous slots are consumed while this one is acquired
+				sdram_ring_stream(scan_ring, acq_length/2);
+			}
+			else
+			{
+				datawrite_with_dma(acq_length/2,DISABLE_MESSAGE);
+			}
+			uint32_t polls = 0; // see rt_backoff
+			while ( alt_read_word(h2p_ctrl_in_addr) & (0x01<<NMR_SEQ_run_ofst) )// wait until fsm stops, just in case the DMA is too fast.
+				rt_backoff(&polls);
 		}
 		else
-		{ // if read from fifo is intended
-			while ( alt_read_word(h2p_ctrl_in_addr) & (0x01<<NMR_SEQ_run_ofst) );// wait until fsm stops
-			usleep(300);
-			unsigned int datacaptured = rd_FIFO (h2p_adc_fifo_status_addr, h2p_adc_fifo_addr, rddata);
+		{ // if read from fifo is intended. The fifo is drained while the fsm is running
+			uint8_t fifo_ovf;
+			unsigned int datacaptured = rd_FIFO_stream (h2p_adc_fifo_status_addr, h2p_adc_fifo_addr, rddata, acq_length>>1, ADC_FIFO_MEM_OUT_FIFO_DEPTH/2, h2p_ctrl_in_addr, NMR_SEQ_run, FSM_TIMEOUT_MS, &fifo_ovf);
+			if (fifo_ovf)
+			{
+				printf("[ERROR] ADC FIFO overflowed during the scan: the host did not drain it fast enough\n");
+			}
 			if ((datacaptured<<1) != acq_length)
 			{
 				printf("[ERROR] number of data in the FIFO (%d) and data ordered (%d): NOT MATCHED\nData are flushed!\nReconfigure the FPGA immediately\n", datacaptured<<1, acq_length);
 				return;
 			}
-			buf32_to_buf16 (rddata, rddata_16, acq_length>>1 ); // transfer data from 32-bit buffer to 16-bit buffer
+			if (unpack_raw_scan)
+				buf32_to_buf16 (rddata, rddata_16, acq_length>>1 ); // transfer data from 32-bit buffer to 16-bit buffer
 		}
 
-		if (sav_indv_scan)
+		if (sav_from_buf && scan_writer != NULL)
+		{ // queued for the background writer, the packed words as acquired
+			async_wr_submit(scan_writer, rddata, acq_length / 2 * sizeof(int), scan_writer->records, 0, 0);
+		}
+		else if (sav_from_buf)
 		{ // put the individual scan data into a file
 
 			// save as binary file
@@ -926,14 +878,24 @@ void runFSM(double nmr_fsm_clkfreq, uint32_t ph_cycl_en,
 	{
 		if (rd_sdram_OR_n_rd_fifo)
 		{ // read from sdram
-			data_dconv_write_with_dma (acq_length, DISABLE_MESSAGE);
+			if (scan_ring != NULL)
+			{ // this scan lands in its own ring slot(s) and the previous slots are consumed while this one is acquired
+				sdram_ring_stream(scan_ring, acq_length);
+			}
+			else
+			{
+				data_dconv_write_with_dma (acq_length, sav_indv_scan, DISABLE_MESSAGE); // without sav_indv_scan the scan is left in the sdram for accumulate_scan
+			}
 			//while ( alt_read_word(h2p_ctrl_in_addr) & (0x01<<NMR_SEQ_run_ofst) ); // might not be needed as the system will wait until data is available anyway
 		}
 		else
-		{ // read directly from fifo
-			while ( alt_read_word(h2p_ctrl_in_addr) & (0x01<<NMR_SEQ_run_ofst) );// wait until the scan is done
-			usleep(1);
-			unsigned int datacaptured = rd_FIFO (h2p_dconvi_csr_addr, h2p_dconvi_addr, dconv);
+		{ // read directly from fifo. The fifo is drained while the fsm is running
+			uint8_t fifo_ovf;
+			unsigned int datacaptured = rd_FIFO_stream (h2p_dconvi_csr_addr, h2p_dconvi_addr, dconv, acq_length, DCONV_FIFO_MEM_OUT_FIFO_DEPTH/2, h2p_ctrl_in_addr, NMR_SEQ_run, FSM_TIMEOUT_MS, &fifo_ovf);
+			if (fifo_ovf)
+			{
+				printf("[ERROR] DCONV FIFO overflowed during the scan: the host did not drain it fast enough\n");
+			}
 			if (datacaptured != acq_length)
 			{
 				printf("[ERROR] number of data in the FIFO (%d) and data ordered (%d): NOT MATCHED\nData are flushed!\nReconfigure the FPGA immediately\n", datacaptured, acq_length);
@@ -941,7 +903,11 @@ void runFSM(double nmr_fsm_clkfreq, uint32_t ph_cycl_en,
 			}
 		}
 
-		if (sav_indv_scan)
+		if (sav_from_buf && scan_writer != NULL)
+		{ // queued for the background writer
+			async_wr_submit(scan_writer, dconv, acq_length * sizeof(int), scan_writer->records, 0, 0);
+		}
+		else if (sav_from_buf)
 		{ // put the individual scan data into an individual file
 			{ // put the individual scan data into a file
 				sprintf(pathname,"%s/%s",foldername,filename);// create a filename
@@ -962,11 +928,6 @@ void CPMG_Sequence(double cpmg_freq, double pulse1_us, double pulse2_us,
 		uint32_t enable_message)
 {
 
-	clock_t start, end;
-
-	// measure the start time
-	start = clock(); // measure time
-
 	unsigned int cpmg_param[5];
 	double adc_ltc1746_freq = cpmg_freq * 4;
 	double nmr_fsm_clkfreq = cpmg_freq * 16;
@@ -1069,9 +1030,13 @@ void CPMG_Sequence(double cpmg_freq, double pulse1_us, double pulse2_us,
 		return;
 	}
 
+	// the scan starts scan_spacing_us after the start of the previous one (see scan_scheduler_reset)
+	scan_scheduler_set_period(&scan_sched, scan_spacing_us);
+
 #ifdef GET_RAW_DATA
 	runFSM(nmr_fsm_clkfreq, ph_cycl_en, samples_per_echo * echoes_per_scan,
-			filename, NO_SAV_INDV_SCAN, RD_DATA_VIA_SDRAM_OR_FIFO, RD_FIFO);
+			filename, NO_SAV_INDV_SCAN, RD_DATA_VIA_SDRAM_OR_FIFO,
+			(scan_ring != NULL) ? RD_SDRAM : RD_FIFO); // the sdram ring needs the dma path
 #endif
 #ifdef GET_DCONV_DATA
 	unsigned int dconv_data_len = samples_per_echo * echoes_per_scan * 2 / dconv_fact; // *2 is because the IQ data is combined into 1 stream
@@ -1079,33 +1044,199 @@ void CPMG_Sequence(double cpmg_freq, double pulse1_us, double pulse2_us,
 			filename, NO_SAV_INDV_SCAN, RD_DATA_VIA_SDRAM_OR_FIFO, RD_SDRAM);
 #endif
 
-	// measure the end and elapsed time
-	end = clock(); // measure time
-	double elapsed = (double) (end - start) * 1000000 / CLOCKS_PER_SEC; // measure time in us
+}
+
+void CPMG_Sequence_batch(uint32_t ph_cycl_en, unsigned int num_of_scans)
+{
+	// run num_of_scans back-to-back with the fsm parameters and the pll left by the previous CPMG_Sequence.
+	// Every scan starts at its deadline (see scan_sched) and lands in its own scan_ring slot.
+	// The completed slots are harvested at the end of the batch (or in the slack before a deadline), so between scans the
+	// host only restarts the fsm and the dma.
+	// scan_ring must have a free slot for every scan of the batch, and a whole scan has to fit in one slot
+
+	unsigned int n;
+	uint32_t polls;
 
-	// if necessary, put delay so that the total delay of the sequence is scan_spacing_us
-	if (scan_spacing_us > (unsigned long) elapsed)
+	for (n = 0; n < num_of_scans; n++)
 	{
+		// the previous scan has to be finished before the fsm is restarted
+		sdram_ring_wait(scan_ring);
+		polls = 0;
+		while (alt_read_word(h2p_ctrl_in_addr) & (0x01 << NMR_SEQ_run_ofst))
+			rt_backoff(&polls);
+
+		start_fsm(ph_cycl_en); // waits for the deadline of the scan
+		sdram_ring_start(scan_ring); // DMA should be started as fast as possible after FSM is started
+	}
+	sdram_ring_wait(scan_ring);
+	polls = 0;
+	while (alt_read_word(h2p_ctrl_in_addr) & (0x01 << NMR_SEQ_run_ofst))
+		rt_backoff(&polls);
 
-		unsigned long scan_added_delay_us = scan_spacing_us
-				- (unsigned long) elapsed;
-		usleep(scan_added_delay_us);
+	// harvest the batch
+	sdram_ring_consume_ready(scan_ring);
+}
 
-		if (enable_message)
-		{
-			printf(
-					"\t Added %ld us at the end of the scan to account for scan_spacing_us.\n",
-					scan_added_delay_us);
-		}
+uint8_t scan_negate(uint32_t ph_cycl_en, uint32_t seq)
+{
+	// phase-cycle sign of one scan. seq is 0-based, so the odd seq is the even (subtracted) iterate
+	return (ph_cycl_en && (seq % 2)) ? 1 : 0;
+}
+
+float scan_scale(uint32_t ph_cycl_en, uint32_t seq, float number_of_iteration)
+{
+	// phase-cycle sign and averaging factor of one scan
+	return (scan_negate(ph_cycl_en, seq) ? -1.0f : 1.0f) / number_of_iteration;
+}
+
+void scan_decay_done(scan_accumulator * acc)
+{
+	// the scan is complete: append its echo amplitudes to the decay_scans file and to the running decay of the adaptive averaging
+	if (acc->decay_scans != NULL)
+		fwrite(acc->scan_decay, sizeof(float), 2 * acc->ei->echoes, acc->decay_scans);
+	if (acc->adapt != NULL)
+		adapt_add_scan(acc->adapt, acc->scan_decay);
+	if (acc->container != NULL)
+		exp_cont_write(acc->container, EXP_CHUNK_SCAN_DECAY, EXP_DT_CF32,
+				acc->decays_done, acc->scan_decay,
+				2 * acc->ei->echoes * sizeof(float));
+	acc->decays_done++;
+	memset(acc->scan_decay, 0, 2 * acc->ei->echoes * sizeof(float));
+}
+
+void stream_floats(stream_server * srv, uint32_t seq, float * avg,
+		uint32_t length, uint32_t scans, uint8_t wait)
+{
+	// an average of length floats to the stream client, in frames of at most srv->max_length bytes.
+	// wait: the frames wait for room instead of being dropped (after the acquisition)
+	uint32_t pos, n;
+
+	for (pos = 0; pos < length; pos += n)
+	{
+		n = length - pos;
+		if (n > srv->max_length / sizeof(float))
+			n = srv->max_length / sizeof(float);
+		if (wait)
+			stream_srv_wait_room(srv, STREAM_SEND_TIMEOUT_MS);
+		stream_srv_send(srv, STREAM_AVERAGE, seq, pos, 0, avg + pos,
+				n * sizeof(float), scans);
+	}
+}
+
+void stream_average(scan_accumulator * acc, uint32_t scans)
+{
+	// the average of the first scans scans to the stream client
+	uint32_t i;
+
+	if (acc->iacc != NULL)
+	{
+		int_acc_result(acc->iacc, acc->stream_avg, 1.0 / scans);
 	}
 	else
+	{ // every scan was scaled by 1/number_of_iteration
+		for (i = 0; i < acc->avg_length; i++)
+			acc->stream_avg[i] = acc->sum[i] * acc->number_of_iteration / scans;
+	}
+	stream_floats(acc->stream, scans - 1, acc->stream_avg, acc->avg_length,
+			scans, 0);
+}
+
+void scan_accumulator_advance(scan_accumulator * acc, uint32_t length, uint8_t dropped)
+{
+	// a slot holds either a whole scan or one segment of it: move to the next scan once the current one is complete.
+	// dropped words (see scan_pipeline) are whole scans, which are counted but not added
+	acc->pos += length;
+	while (acc->pos >= acc->scan_length)
 	{
-		printf(
-				"\t[WARNING] One scan duration is longer than scan_spacing_us parameter (%ld us) and is measured to be approx. %ld us\n",
-				scan_spacing_us, (unsigned long) elapsed);
+		acc->pos -= acc->scan_length;
+		acc->scan_idx++;
+		if (dropped)
+		{
+			acc->scans_dropped++;
+			continue;
+		}
+		if (acc->iacc != NULL)
+		{
+			int_acc_scan_done(acc->iacc);
+		}
+		if (acc->ddc != NULL)
+		{
+			int_acc_scan_done(&acc->ddc->acc);
+		}
+		if (acc->ei != NULL)
+		{
+			scan_decay_done(acc);
+		}
+		if (acc->stream != NULL && acc->scan_idx % acc->stream_every == 0
+				&& acc->scan_idx > acc->scans_dropped)
+		{
+			stream_average(acc, acc->scan_idx - acc->scans_dropped);
+		}
 	}
+}
 
+#ifdef GET_RAW_DATA
+void accumulate_raw_slot(volatile unsigned int * slot, uint32_t length,
+		uint32_t seq, void * ctx)
+{
+	// sdram ring consumer: unpack one raw scan (or segment) straight from its slot into the running sum
+	scan_accumulator *acc = (scan_accumulator *) ctx;
+	if (slot != NULL && acc->writer != NULL)
+		async_wr_submit(acc->writer, slot, length * sizeof(int), acc->scan_idx, acc->pos,
+				scan_negate(acc->ph_cycl_en, acc->scan_idx) ? SCAN_LOG_NEGATED : 0);
+	if (slot != NULL && acc->stream != NULL)
+		stream_srv_send(acc->stream, STREAM_SCAN, acc->scan_idx, acc->pos,
+				scan_negate(acc->ph_cycl_en, acc->scan_idx) ? SCAN_LOG_NEGATED : 0,
+				slot, length * sizeof(int), 0);
+	if (slot != NULL && acc->scan_chunks != NULL)
+		exp_cont_write_at(acc->scan_chunks, EXP_CHUNK_SCAN, EXP_DT_RAW14,
+				acc->scan_idx, acc->pos, slot, length * sizeof(int));
+	if (slot == NULL)
+		; // the words were dropped
+	else if (acc->iacc != NULL)
+		int_acc_add_raw(acc->iacc, slot, acc->pos, length,
+				scan_negate(acc->ph_cycl_en, acc->scan_idx));
+	else
+		accumulate_scan_raw(slot, acc->sum + acc->pos * 2, length,
+				scan_scale(acc->ph_cycl_en, acc->scan_idx, acc->number_of_iteration)); // *2 because every word has 2 samples
+	if (slot != NULL && acc->ddc != NULL)
+		ddc_sum_add(acc->ddc, slot, acc->pos, length,
+				scan_negate(acc->ph_cycl_en, acc->scan_idx));
+	scan_accumulator_advance(acc, length, slot == NULL);
+}
+#endif
+
+#ifdef GET_DCONV_DATA
+void accumulate_dconv_slot(volatile unsigned int * slot, uint32_t length,
+		uint32_t seq, void * ctx)
+{
+	// sdram ring consumer: add one downconverted scan (or segment) straight from its slot to the running sum
+	scan_accumulator *acc = (scan_accumulator *) ctx;
+	if (slot != NULL && acc->writer != NULL)
+		async_wr_submit(acc->writer, slot, length * sizeof(int), acc->scan_idx, acc->pos,
+				scan_negate(acc->ph_cycl_en, acc->scan_idx) ? SCAN_LOG_NEGATED : 0);
+	if (slot != NULL && acc->stream != NULL)
+		stream_srv_send(acc->stream, STREAM_SCAN, acc->scan_idx, acc->pos,
+				scan_negate(acc->ph_cycl_en, acc->scan_idx) ? SCAN_LOG_NEGATED : 0,
+				slot, length * sizeof(int), 0);
+	if (slot != NULL && acc->scan_chunks != NULL)
+		exp_cont_write_at(acc->scan_chunks, EXP_CHUNK_SCAN, EXP_DT_I32,
+				acc->scan_idx, acc->pos, slot, length * sizeof(int));
+	if (slot == NULL)
+		; // the words were dropped
+	else if (acc->iacc != NULL)
+		int_acc_add_words(acc->iacc, slot, acc->pos, length,
+				scan_negate(acc->ph_cycl_en, acc->scan_idx));
+	else
+		accumulate_scan(slot, acc->sum + acc->pos, length,
+				scan_scale(acc->ph_cycl_en, acc->scan_idx, acc->number_of_iteration));
+	if (slot != NULL && acc->ei != NULL)
+		echo_int_add_words(acc->ei, slot, acc->pos, length,
+				scan_negate(acc->ph_cycl_en, acc->scan_idx) ? -1.0f : 1.0f,
+				acc->scan_decay);
+	scan_accumulator_advance(acc, length, slot == NULL);
 }
+#endif
 
 void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 		double pulse1_dtcl, double pulse2_dtcl, double echo_spacing_us,
@@ -1117,6 +1248,49 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 // settings
 	char progress_verbose = 1; // print progress
 	char binary_OR_ascii = 1; // save binary output into the text file (1). Otherwise, it'll be ASCII output (0)
+	char use_sdram_ring = 0; // land every scan in its own sdram slot and accumulate the previous scan while the next one is acquired
+	unsigned int sdram_ring_slots = 2; // number of slots in the sdram ring (2 is ping-pong)
+	uint32_t sdram_seg_words = 1 << 20; // max words per dma transfer. Longer scans are split into chained segments, each consumed as soon as it completes
+	char rt_mode = 0; // real-time acquisition: SCHED_FIFO on acq_cpu, with the memory locked and the scan buffers prefaulted (needs root)
+	int rt_priority = 80; // SCHED_FIFO priority of the acquisition in rt_mode
+	int acq_cpu = 0; // cpu running the acquisition. The scan pipeline worker runs on the other one
+	char record_jitter = 0; // record the start-to-start interval of every scan into the "scan_jitter" file
+	char use_scan_pipeline = 0; // acquire on acq_cpu and accumulate the sdram ring slots in a worker thread on the other cpu (needs the sdram ring)
+	char pipeline_drop_when_full = 0; // drop scans instead of stalling the acquisition when the worker falls behind (the dropped scans are missing from the sum)
+	char integer_accumulation = 0; // exact integer sum of the scans, scaled to the average only once at the end (otherwise every scan is scaled and added in float)
+	char save_scans = 0; // write every scan as acquired (packed raw words or dconv words) into the "scans" file through the background writer (see async_writer.h)
+	unsigned int save_scans_bufs = 8; // scans that can wait for the writer before the acquisition stalls
+	char save_scans_direct = 0; // write the "scans" file with O_DIRECT
+	char save_scans_compress = 1; // encode the saved scans losslessly (see scan_codec.h) on the writer thread
+	char stream_output = 0; // stream every scan as acquired and the running average to an analysis client (see stream_server.h)
+	int stream_port = 5011; // tcp port of the stream server (0: the unix socket "stream.sock" in the data folder)
+	char stream_bind_addr[] = "127.0.0.1"; // address the tcp stream server listens on. The stream has no authentication: "0.0.0.0" (every interface) lets anyone on the network take the live data
+	unsigned int stream_avg_every = 16; // scans between two running averages on the stream
+	unsigned int stream_preview_decimation = 8; // every n-th word of a scan only, when the client falls behind (<= 1: the scans are dropped instead)
+	unsigned int stream_wait_client_ms = 0; // wait this long for a client before the first scan (0: the run starts right away)
+	char write_container = 0; // write the parameters, the echo amplitudes of every scan and the average into the "experiment.nmrx" container (see exp_container.h)
+	char container_scan_data = 0; // also write every scan as acquired (packed raw words or dconv words) into the container
+	unsigned int scans_per_batch = 1; // >1: after the first scan, run this many scans back-to-back from the same fsm/pll setup and harvest them from the sdram ring in one batch (short T1, where the host overhead is comparable to scan_spacing_us)
+#ifdef GET_DCONV_DATA
+	char echo_integration = 0; // reduce every echo of the average to one complex amplitude and write them into the "decay" file (echoes_per_scan IQ pairs)
+	char echo_matched_filter = 0; // weight the echo window with the shape of the averaged echo. Otherwise the window is averaged
+	unsigned int echo_win_start = 0; // first downconverted point of the echo window
+	unsigned int echo_win_width = 0; // downconverted points in the echo window (0: up to the end of the echo)
+	char echo_per_scan = 0; // also write the echo amplitudes of every scan into the "decay_scans" file (window averaged, as the matched filter needs the final average)
+	char container_scan_decays = 0; // write the echo amplitudes of every scan into the container, so a reader can go to any scan (with echo_integration)
+	char save_full_dconv = 0; // write the full dconv sum next to the decay. Otherwise only the decay is written (with echo_integration)
+	char t2_fitting = 0; // fit the decay with the mono, bi and stretched exponential and write the parameters into the "t2_fit" file (with echo_integration)
+	char t2_distribution = 0; // invert the decay into a T2 distribution and write it into the "t2_dist" file (with echo_integration)
+	unsigned int t2_dist_points = 100; // points of the log-spaced T2 grid
+	double t2_dist_min_fact = 1; // shortest T2 of the grid, in echo times
+	double t2_dist_max_fact = 10; // longest T2 of the grid, in echo train lengths
+	double t2_dist_alpha = 1e-3; // tikhonov regularization, relative to the mean diagonal of K'K
+	char adaptive_averaging = 0; // stop before number_of_iteration (the maximum) once a target below is reached (with echo_integration)
+	double adapt_snr_target = 100; // snr of the first echoes against the quadrature noise of the decay (0: not used)
+	double adapt_t2_rel_target = 0; // relative uncertainty of the mono-exponential T2, e.g. 0.01 (0: not used)
+	unsigned int adapt_min_scans = 4; // never stop before this many scans
+	unsigned int adapt_check_every = 2; // scans between the checks, a phase-cycle pair
+#endif
 
 	double nmr_fsm_clkfreq = 16 * cpmg_freq;
 	double adc_ltc1746_freq = 4 * cpmg_freq;
@@ -1179,6 +1353,46 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 #endif
 	fclose (fptr);
 
+// the same settings, typed, as the first chunk of the container
+	exp_container cont;
+	exp_container *container = NULL;
+	sprintf(pathname, "%s/%s", foldername, "experiment.nmrx");// put the data into the data folder
+	if (write_container && exp_cont_open(&cont, pathname, "cpmg") == 0)
+	{
+		container = &cont;
+		exp_cont_param_d(container, "b1Freq", cpmg_freq);
+		exp_cont_param_d(container, "fsmFreq", nmr_fsm_clkfreq);
+		exp_cont_param_d(container, "adcFreq", adc_ltc1746_freq);
+		exp_cont_param_d(container, "p90LengthGiven", pulse1_us);
+		exp_cont_param_i(container, "p90LengthCnt", cpmg_param[PULSE1_OFFST]);
+		exp_cont_param_d(container, "p90Dtcl", pulse1_dtcl);
+		exp_cont_param_i(container, "d90LengthCnt", cpmg_param[DELAY1_OFFST]);
+		exp_cont_param_d(container, "p180LengthGiven", pulse2_us);
+		exp_cont_param_i(container, "p180LengthCnt", cpmg_param[PULSE2_OFFST]);
+		exp_cont_param_d(container, "p180Dtcl", pulse2_dtcl);
+		exp_cont_param_i(container, "d180LengthCnt", cpmg_param[DELAY2_OFFST]);
+		exp_cont_param_i(container, "initAdcDelayCnt", cpmg_param[INIT_DELAY_ADC_OFFST]);
+		exp_cont_param_d(container, "echoTimeGiven", echo_spacing_us);
+		exp_cont_param_d(container, "echoTimeRun",
+				(double) (cpmg_param[PULSE2_OFFST] + cpmg_param[DELAY2_OFFST])
+						/ nmr_fsm_clkfreq);
+		exp_cont_param_i(container, "scanSpacing", scan_spacing_us);
+		exp_cont_param_i(container, "nrPnts", samples_per_echo);
+		exp_cont_param_i(container, "nrEchoes", echoes_per_scan);
+		exp_cont_param_d(container, "echoShift", init_adc_delay_compensation);
+		exp_cont_param_i(container, "nrIterations", number_of_iteration);
+		exp_cont_param_i(container, "usePhaseCycle", ph_cycl_en);
+#ifdef GET_RAW_DATA
+		exp_cont_param_i(container, "fpgaDconv", 0);
+		exp_cont_param_i(container, "dconvFact", 1);
+#endif
+#ifdef GET_DCONV_DATA
+		exp_cont_param_i(container, "fpgaDconv", 1);
+		exp_cont_param_i(container, "dconvFact", dconv_fact);
+#endif
+		exp_cont_flush_params(container); // on the disk before the first scan
+	}
+
 // print matlab script to analyze datas
 	sprintf(pathname, "measurement_history_matlab_script.txt");
 	fptr = fopen(pathname, "a");
@@ -1201,17 +1415,311 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 
 // amplitude sum
 #ifdef GET_RAW_DATA
-	float Asum[samples_per_echo*echoes_per_scan];
-	for (i=0; i<samples_per_echo*echoes_per_scan; i++) Asum[i] = 0;
+	float *Asum = (float*) calloc(samples_per_echo*echoes_per_scan, sizeof(float)); // on the heap, so it can be locked and is not limited by the stack size
 #endif
 
 #ifdef GET_DCONV_DATA
 // downconverted sum
 	int dconv_size = samples_per_echo*echoes_per_scan/dconv_fact*2;
 // printf ("dconv_size = %d\n", dconv_size); // print the buffer size
-	float dconv_sum[dconv_size];
-	for (i=0; i < dconv_size; i++) dconv_sum[i] = 0;
+	float *dconv_sum = (float*) calloc(dconv_size, sizeof(float)); // on the heap, so it can be locked and is not limited by the stack size
+#endif
+	if (name == NULL || nameavg == NULL
+#ifdef GET_RAW_DATA
+			|| Asum == NULL
+#endif
+#ifdef GET_DCONV_DATA
+			|| dconv_sum == NULL
+#endif
+			)
+	{ // nothing is acquired
+		printf("\t[ERROR] cannot allocate the sum of the scans\n");
+		free(name);
+		free(nameavg);
+#ifdef GET_RAW_DATA
+		free(Asum);
+#endif
+#ifdef GET_DCONV_DATA
+		free(dconv_sum);
+#endif
+		if (container != NULL)
+			exp_cont_close(container);
+		return;
+	}
+
+// sdram ring: the accumulation is done by the ring consumer instead of after every CPMG_Sequence
+	sdram_ring ring;
+	memset(&ring, 0, sizeof(ring)); // the counters are reported even when the ring is not used
+	scan_accumulator acc;
+	int_accumulator iacc;
+	acc.iacc = NULL;
+	if (integer_accumulation)
+	{
+#ifdef GET_RAW_DATA
+		if (int_acc_init(&iacc, samples_per_echo * echoes_per_scan, 14) == 0) // 14-bit adc samples
+			acc.iacc = &iacc;
+#endif
+#ifdef GET_DCONV_DATA
+		if (int_acc_init(&iacc, dconv_size, 32) == 0) // full 32-bit downconverted samples
+			acc.iacc = &iacc;
+#endif
+	}
+	acc.number_of_iteration = (float) number_of_iteration;
+	acc.ph_cycl_en = ph_cycl_en;
+	acc.pos = 0;
+	acc.scan_idx = 0;
+	acc.ei = NULL;
+	acc.scan_decay = NULL;
+	acc.decay_scans = NULL;
+	acc.adapt = NULL;
+	acc.container = NULL;
+	acc.scan_chunks = (container_scan_data) ? container : NULL;
+	acc.decays_done = 0;
+	acc.scans_dropped = 0;
+	acc.ddc = NULL;
+	acc.writer = NULL;
+	acc.stream = NULL;
+	acc.stream_avg = NULL;
+#ifdef GET_RAW_DATA
+	acc.avg_length = samples_per_echo * echoes_per_scan;
+#endif
+#ifdef GET_DCONV_DATA
+	acc.avg_length = dconv_size;
+#endif
+	async_writer writer;
+	if (save_scans)
+	{ // on the other cpu, like the scan pipeline worker. A slot never holds more than a whole scan
+		sprintf(pathname, "%s/%s", foldername, "scans"); // put the data into the data folder
+#ifdef GET_RAW_DATA
+		if (async_wr_open(&writer, pathname, "cpmg_raw", samples_per_echo * echoes_per_scan / 2 * sizeof(int),
+				save_scans_bufs, number_of_iteration, save_scans_direct, 0, acq_cpu ^ 1) == 0)
+#endif
+#ifdef GET_DCONV_DATA
+		if (async_wr_open(&writer, pathname, "cpmg_dconv", dconv_size * sizeof(int),
+				save_scans_bufs, number_of_iteration, save_scans_direct, 0, acq_cpu ^ 1) == 0)
+#endif
+		{
+			writer.freq = cpmg_freq;
+			acc.writer = &writer;
+			if (save_scans_compress)
+			{ // the echo predictors of the codec line up with the echoes of a whole scan
+#ifdef GET_RAW_DATA
+				async_wr_compress(&writer, SCAN_CODEC_RAW14, samples_per_echo);
+#endif
+#ifdef GET_DCONV_DATA
+				async_wr_compress(&writer, SCAN_CODEC_I32, dconv_size / echoes_per_scan);
+#endif
+			}
+		}
+	}
+#ifdef GET_DCONV_DATA
+	double echo_time_us = (double) (cpmg_param[PULSE2_OFFST] + cpmg_param[DELAY2_OFFST]) / nmr_fsm_clkfreq;
+	echo_integrator ei;
+	adaptive_avg adapt;
+	char ei_ready = 0;
+	if (echo_integration
+			&& echo_int_init(&ei, samples_per_echo / dconv_fact, echoes_per_scan,
+					echo_win_start, echo_win_width) == 0)
+	{
+		ei_ready = 1;
+		if (echo_per_scan)
+		{
+			sprintf(pathname, "%s/%s", foldername, "decay_scans"); // put the data into the data folder
+			acc.decay_scans = fopen(pathname, "w");
+		}
+		if (adaptive_averaging
+				&& adapt_init(&adapt, echoes_per_scan, echo_time_us,
+						adapt_snr_target, adapt_t2_rel_target, adapt_min_scans,
+						adapt_check_every, ph_cycl_en) == 0)
+		{
+			acc.adapt = &adapt;
+		}
+		if (echo_per_scan || container_scan_decays)
+		{ // the echo amplitudes of every scan go into the container as well
+			acc.container = container;
+		}
+		if (acc.decay_scans != NULL || acc.adapt != NULL || acc.container != NULL)
+		{
+			acc.scan_decay = (float*) calloc(2 * echoes_per_scan, sizeof(float));
+			if (acc.scan_decay != NULL)
+			{ // every scan is integrated as it is accumulated
+				acc.ei = &ei;
+			}
+			else
+			{
+				printf("\t[WARNING] the echoes of the individual scans are not integrated, every scan is run\n");
+				if (acc.decay_scans != NULL)
+					fclose(acc.decay_scans);
+				if (acc.adapt != NULL)
+					adapt_free(acc.adapt);
+				acc.decay_scans = NULL;
+				acc.adapt = NULL;
+				acc.container = NULL;
+			}
+		}
+	}
+#endif
+	if (use_scan_pipeline && sdram_ring_slots < 4)
+	{ // room for the worker to fall a few slots behind before the acquisition stalls
+		sdram_ring_slots = 4;
+	}
+	if (scans_per_batch > 1)
+	{ // a slot for every scan of the batch, plus the one left in the ring by the scan before it
+		if (ph_cycl_en && scans_per_batch % 2)
+		{ // a batch covers whole phase-cycle pairs
+			scans_per_batch++;
+		}
+		if (scans_per_batch > SDRAM_RING_MAX_SLOTS - 1)
+		{
+			scans_per_batch = (SDRAM_RING_MAX_SLOTS - 1) & ~(ph_cycl_en ? 1 : 0);
+		}
+		if (sdram_ring_slots < scans_per_batch + 1)
+		{
+			sdram_ring_slots = scans_per_batch + 1;
+		}
+	}
+	if (sdram_seg_words > SDRAM_SPAN / 4 / sdram_ring_slots)
+	{ // every slot has to fit in the sdram window
+		sdram_seg_words = (SDRAM_SPAN / 4 / sdram_ring_slots)
+				& ~(SDRAM_RING_ALIGN_WORDS - 1);
+	}
+	if (use_sdram_ring)
+	{
+#ifdef GET_RAW_DATA
+		acc.sum = Asum;
+		acc.scan_length = samples_per_echo * echoes_per_scan / 2;
+		if (sdram_ring_init(&ring, h2p_dma_addr, h2p_sdram_addr,
+				ADC_FIFO_MEM_OUT_BASE, SDRAM_BASE, SDRAM_SPAN,
+				(acc.scan_length < sdram_seg_words) ? acc.scan_length : sdram_seg_words,
+				sdram_ring_slots, accumulate_raw_slot, &acc) == 0)
+		{
+			ring.irq = &dma_fifo_irq;
+			ring.fifo_csr = h2p_adc_fifo_status_addr;
+			scan_ring = &ring;
+		}
+#endif
+#ifdef GET_DCONV_DATA
+		acc.sum = dconv_sum;
+		acc.scan_length = dconv_size;
+		if (sdram_ring_init(&ring, h2p_dconvi_dma_addr, h2p_sdram_addr,
+				DCONV_FIFO_MEM_OUT_BASE, SDRAM_BASE, SDRAM_SPAN,
+				(acc.scan_length < sdram_seg_words) ? acc.scan_length : sdram_seg_words,
+				sdram_ring_slots, accumulate_dconv_slot, &acc) == 0)
+		{
+			ring.irq = &dma_dconvi_irq;
+			ring.fifo_csr = h2p_dconvi_csr_addr;
+			scan_ring = &ring;
+		}
+#endif
+	}
+	if (scans_per_batch > 1
+			&& (scan_ring == NULL || acc.scan_length > scan_ring->length))
+	{ // a batch needs the ring with every scan in a single slot
+		printf("\t[WARNING] scans are not batched: the scan does not fit in one sdram ring slot\n");
+		scans_per_batch = 1;
+	}
+	unsigned int batch;
+#ifdef GET_RAW_DATA
+	ddc_sum ddc;
+	uint32_t ddc_words = (scan_ring != NULL) ?
+			scan_ring->length : samples_per_echo * echoes_per_scan / 2;
+	if (sw_ddc_fact > 0
+			&& (samples_per_echo < 2 || ddc_words % (samples_per_echo / 2) != 0))
+	{ // every slot is downconverted on its own
+		printf("\t[WARNING] no host ddc: the sdram ring slots do not hold whole echoes\n");
+	}
+	else if (sw_ddc_init(&ddc, samples_per_echo, echoes_per_scan, ddc_words) == 0)
+	{
+		acc.ddc = &ddc;
+	}
+#endif
+
+	stream_server stream;
+	if (stream_output)
+	{ // the sender runs on the other cpu as well. It only takes the data of a scan once a client is connected.
+	  // The buffers hold a ring slot (a segment of a long scan), and the averages go out in pieces of that size
+		stream_hello hello;
+		memset(&hello, 0, sizeof(hello));
+#ifdef GET_RAW_DATA
+		strcpy(hello.kind, "cpmg_raw");
+		hello.word_format = SCAN_CODEC_RAW14;
+		hello.scan_words = samples_per_echo * echoes_per_scan / 2;
+#endif
+#ifdef GET_DCONV_DATA
+		strcpy(hello.kind, "cpmg_dconv");
+		hello.word_format = SCAN_CODEC_I32;
+		hello.scan_words = dconv_size;
+#endif
+		hello.avg_points = acc.avg_length;
+		hello.echoes = echoes_per_scan;
+		hello.scans = number_of_iteration;
+		hello.freq = cpmg_freq;
+		sprintf(pathname, "%s/%s", foldername, "stream.sock");
+		acc.stream_avg = (float*) malloc(acc.avg_length * sizeof(float));
+		if (acc.stream_avg != NULL
+				&& stream_srv_open(&stream, stream_port, stream_bind_addr, pathname, &hello,
+						((scan_ring != NULL) ? scan_ring->length : hello.scan_words) * 4, // a frame is never more than a ring slot
+						16, stream_preview_decimation, acq_cpu ^ 1) == 0)
+		{
+			acc.stream = &stream;
+			acc.stream_every = (stream_avg_every > 0) ? stream_avg_every : 1;
+			if (ph_cycl_en && acc.stream_every % 2)
+			{ // only whole phase cycles are averaged
+				acc.stream_every++;
+			}
+			if (stream_wait_client_ms > 0
+					&& stream_srv_wait_client(&stream, stream_wait_client_ms) != 0)
+				printf("\t[WARNING] no stream client within %d ms, the run starts anyway\n", stream_wait_client_ms);
+		}
+		else
+		{
+			free(acc.stream_avg);
+			acc.stream_avg = NULL;
+		}
+	}
+
+	scan_pipeline pipe;
+	char pipe_running = 0;
+	if (use_scan_pipeline && scan_ring != NULL)
+	{ // this thread only runs the fsm and the dma from now on
+		pin_thread_to_cpu(pthread_self(), acq_cpu);
+		if (scan_pipeline_start(&pipe, scan_ring, scan_ring->consume, &acc,
+				acq_cpu ^ 1, pipeline_drop_when_full,
+				acc.scan_length * (ph_cycl_en ? 2 : 1)) == 0) // a pair of the phase cycle is dropped as a whole
+		{
+			pipe_running = 1;
+		}
+	}
+
+	scan_jitter jit;
+	if (record_jitter
+			&& scan_jitter_init(&jit, number_of_iteration, scan_spacing_us,
+					scan_spacing_us / 10) == 0)
+	{ // every scan start is recorded in start_fsm
+		scan_jitter_rec = &jit;
+	}
+
+	if (rt_mode)
+	{ // after the worker is created, so only the acquisition thread is SCHED_FIFO
+		rt_enter(acq_cpu, rt_priority);
+#ifdef GET_RAW_DATA
+		rt_prefault(rddata, samples_per_echo * echoes_per_scan / 2 * sizeof(int));
+		if (acc.iacc == NULL)
+			rt_prefault(rddata_16, samples_per_echo * echoes_per_scan * sizeof(unsigned int));
+		rt_prefault(Asum, samples_per_echo * echoes_per_scan * sizeof(float));
+#endif
+#ifdef GET_DCONV_DATA
+		rt_prefault(dconv, dconv_size * sizeof(int));
+		rt_prefault(dconv_sum, dconv_size * sizeof(float));
 #endif
+	}
+
+#ifdef GET_RAW_DATA
+	if (acc.iacc != NULL)
+		unpack_raw_scan = 0; // the scans are summed straight from the packed rddata
+#endif
+
+	scan_scheduler_reset(&scan_sched); // the first scan starts right away
 
 	if (progress_verbose)
 	{
@@ -1220,10 +1728,30 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 
 	for (iterate = 1; iterate <= number_of_iteration; iterate++)
 	{
+		if (acc.adapt != NULL && (!ph_cycl_en || (iterate - 1) % 2 == 0)
+				&& adapt_reached(acc.adapt))
+		{ // only after whole phase-cycle pairs. The scans still in the ring or the pipeline are added to the average as well
+			break;
+		}
+
 		// printf("\n*** RUN %d ***\n",iterate);
-		if (progress_verbose)
+		if (progress_verbose && !(scans_per_batch > 1 && iterate > (ph_cycl_en ? 2 : 1)))
 			print_progress(iterate, number_of_iteration);
 
+		if (scans_per_batch > 1 && iterate > (ph_cycl_en ? 2 : 1))
+		{ // the fsm parameters and the pll are already set by the first scan (pair), so every batch starts on a pair boundary
+			batch = number_of_iteration - iterate + 1;
+			if (batch > scans_per_batch)
+			{
+				batch = scans_per_batch;
+			}
+			CPMG_Sequence_batch(ph_cycl_en, batch);
+			iterate += batch - 1;
+			if (progress_verbose) // every scan of the batch is done
+				print_progress(iterate, number_of_iteration);
+			continue;
+		}
+
 		snprintf(name, FILENAME_LENGTH, "dat_%03d", iterate);
 		snprintf(nameavg, FILENAME_LENGTH, "avg_%03d", iterate);
 
@@ -1242,9 +1770,55 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 				nameavg,				//filename for average data
 				DISABLE_MESSAGE);
 
+		if (scan_ring != NULL)
+			continue; // the scan is accumulated by the sdram ring consumer
+
+		if (acc.writer != NULL)
+		{ // the copy is queued before the scan is processed
+#ifdef GET_RAW_DATA
+			async_wr_submit(acc.writer, rddata, samples_per_echo * echoes_per_scan / 2 * sizeof(int), iterate - 1, 0,
+					scan_negate(ph_cycl_en, iterate - 1) ? SCAN_LOG_NEGATED : 0);
+#endif
+#ifdef GET_DCONV_DATA
+			async_wr_submit(acc.writer, h2p_sdram_addr, dconv_size * sizeof(int), iterate - 1, 0,
+					scan_negate(ph_cycl_en, iterate - 1) ? SCAN_LOG_NEGATED : 0);
+#endif
+		}
+		if (acc.stream != NULL)
+		{
+#ifdef GET_RAW_DATA
+			stream_srv_send(acc.stream, STREAM_SCAN, iterate - 1, 0,
+					scan_negate(ph_cycl_en, iterate - 1) ? SCAN_LOG_NEGATED : 0,
+					rddata, samples_per_echo * echoes_per_scan / 2 * sizeof(int), 0);
+#endif
+#ifdef GET_DCONV_DATA
+			stream_srv_send(acc.stream, STREAM_SCAN, iterate - 1, 0,
+					scan_negate(ph_cycl_en, iterate - 1) ? SCAN_LOG_NEGATED : 0,
+					h2p_sdram_addr, dconv_size * sizeof(int), 0);
+#endif
+		}
+		if (acc.scan_chunks != NULL)
+		{
+#ifdef GET_RAW_DATA
+			exp_cont_write_at(acc.scan_chunks, EXP_CHUNK_SCAN, EXP_DT_RAW14, iterate - 1, 0,
+					rddata, samples_per_echo * echoes_per_scan / 2 * sizeof(int));
+#endif
+#ifdef GET_DCONV_DATA
+			exp_cont_write_at(acc.scan_chunks, EXP_CHUNK_SCAN, EXP_DT_I32, iterate - 1, 0,
+					h2p_sdram_addr, dconv_size * sizeof(int));
+#endif
+		}
+
 #ifdef GET_RAW_DATA
 		// process the data
-		if (ph_cycl_en)
+		if (acc.iacc != NULL)
+		{ // straight from the packed words
+			int_acc_add_raw(acc.iacc, (volatile unsigned int *) rddata, 0,
+					samples_per_echo * echoes_per_scan / 2,
+					scan_negate(ph_cycl_en, iterate - 1));
+			int_acc_scan_done(acc.iacc);
+		}
+		else if (ph_cycl_en)
 		{
 			if (iterate % 2 == 0)
 			{
@@ -1263,33 +1837,151 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 			for (i = 0; i < samples_per_echo * echoes_per_scan; i++)
 			Asum[i] += (double)rddata_16[i]/(float)number_of_iteration;
 		}
+		if (acc.ddc != NULL)
+		{ // the same scan, downconverted on the host
+			ddc_sum_add(acc.ddc, (volatile unsigned int *) rddata, 0,
+					samples_per_echo * echoes_per_scan / 2,
+					scan_negate(ph_cycl_en, iterate - 1));
+			int_acc_scan_done(&acc.ddc->acc);
+		}
 
 #endif
 
 #ifdef GET_DCONV_DATA
-		if (ph_cycl_en)
+		// accumulate straight from the sdram window
+		if (acc.iacc != NULL)
 		{
-			if (iterate % 2 == 0)
-			{
-				for (i = 0;
-						i < dconv_size;
-						i++)
-				dconv_sum[i] -= (float)dconv[i] / (float)number_of_iteration;
-			}
-			else
-			{
-				for (i = 0;
-						i < dconv_size;
-						i++)
-				dconv_sum[i] += (float)dconv[i] / (float)number_of_iteration;
-			}
+			int_acc_add_words(acc.iacc, h2p_sdram_addr, 0, dconv_size,
+					scan_negate(ph_cycl_en, iterate - 1));
+			int_acc_scan_done(acc.iacc);
 		}
 		else
+		{ // phase-cycle sign and averaging in the same pass
+			accumulate_scan(h2p_sdram_addr, dconv_sum, dconv_size,
+					scan_scale(ph_cycl_en, iterate - 1, (float) number_of_iteration));
+		}
+		if (acc.ei != NULL)
 		{
-			for (i = 0; i < dconv_size;
-					i++)
-			dconv_sum[i] += (float)dconv[i] / (float)number_of_iteration;
+			echo_int_add_words(acc.ei, h2p_sdram_addr, 0, dconv_size,
+					scan_negate(ph_cycl_en, iterate - 1) ? -1.0f : 1.0f,
+					acc.scan_decay);
+			scan_decay_done(&acc);
 		}
+#endif
+		if (acc.stream != NULL && iterate % acc.stream_every == 0)
+		{
+			stream_average(&acc, iterate);
+		}
+	}
+
+	unsigned int scans_run = iterate - 1; // less than number_of_iteration when the adaptive averaging stopped early
+
+	if (rt_mode)
+	{
+		rt_leave();
+	}
+	if (rt_mode || (use_scan_pipeline && scan_ring != NULL))
+	{ // pinned by rt_enter or for the scan pipeline
+		unpin_thread(pthread_self());
+	}
+#ifdef GET_RAW_DATA
+	unpack_raw_scan = 1;
+#endif
+	if (scan_jitter_rec != NULL)
+	{
+		sprintf(pathname, "%s/%s", foldername, "scan_jitter"); // put the data into the data folder
+		scan_jitter_report(scan_jitter_rec, pathname);
+		scan_jitter_free(scan_jitter_rec);
+		scan_jitter_rec = NULL;
+	}
+
+	if (pipe_running)
+	{ // hand the last scan to the worker and wait until every scan is accumulated
+		scan_pipeline_stop(&pipe, scan_ring, progress_verbose);
+	}
+	if (scan_ring != NULL)
+	{ // consume the last scan left in the ring
+		sdram_ring_drain(scan_ring);
+		scan_ring = NULL;
+	}
+	if (acc.writer != NULL)
+	{ // every scan is queued: wait until it is in the file
+		async_wr_close(acc.writer);
+	}
+
+	unsigned int scans_avg = scans_run - acc.scans_dropped; // scans actually in the sum
+	if (acc.iacc != NULL)
+	{ // the average, scaled once
+#ifdef GET_RAW_DATA
+		int_acc_result(acc.iacc, Asum, 1.0 / scans_avg);
+#endif
+#ifdef GET_DCONV_DATA
+		int_acc_result(acc.iacc, dconv_sum, 1.0 / scans_avg);
+#endif
+		int_acc_free(acc.iacc);
+	}
+	else if (scans_avg < number_of_iteration)
+	{ // every scan was scaled by 1/number_of_iteration
+#ifdef GET_RAW_DATA
+		for (i = 0; i < samples_per_echo * echoes_per_scan; i++)
+			Asum[i] *= (float) number_of_iteration / scans_avg;
+#endif
+#ifdef GET_DCONV_DATA
+		for (i = 0; i < dconv_size; i++)
+			dconv_sum[i] *= (float) number_of_iteration / scans_avg;
+#endif
+	}
+	if (acc.stream != NULL)
+	{ // the final average, then STREAM_END
+#ifdef GET_RAW_DATA
+		stream_floats(acc.stream, scans_run - 1, Asum, acc.avg_length, scans_avg, 1);
+#endif
+#ifdef GET_DCONV_DATA
+		stream_floats(acc.stream, scans_run - 1, dconv_sum, acc.avg_length, scans_avg, 1);
+#endif
+		stream_srv_close(acc.stream);
+		free(acc.stream_avg);
+		acc.stream_avg = NULL;
+	}
+
+	sprintf(pathname, "%s/acqu.par", foldername);
+	fptr = fopen(pathname, "a");
+	fprintf(fptr, "nrIterationsRun = %d\n", scans_run);
+	fprintf(fptr, "nrScansAveraged = %d\n", scans_avg);
+	if (use_sdram_ring)
+	{ // transfers that lost words, e.g. a segment started after the fifo overflowed
+		fprintf(fptr, "sdramRingOverruns = %d\n", ring.overruns);
+		if (ring.overruns)
+			printf("\t[WARNING] %d sdram ring transfers lost data\n", ring.overruns);
+	}
+	if (acc.writer != NULL)
+	{ // how well the writer kept up with the acquisition
+		async_wr_report(acc.writer, fptr);
+		if (progress_verbose && (writer.stalls || writer.drops || writer.errors))
+			printf("\t[WARNING] scan writer: %d stalls, %d drops, %d write errors\n",
+					writer.stalls, writer.drops, writer.errors);
+		acc.writer = NULL;
+	}
+	if (acc.stream != NULL)
+	{ // how well the client kept up with the acquisition
+		stream_srv_report(acc.stream, fptr);
+		if (progress_verbose && (stream.dropped || stream.scans_preview || stream.send_errors))
+			printf("\t[WARNING] stream client: %d scans as previews, %d frames dropped, %d send errors\n",
+					stream.scans_preview, stream.dropped, stream.send_errors);
+		acc.stream = NULL;
+	}
+	fclose(fptr);
+	if (container != NULL)
+	{
+		exp_cont_param_i(container, "nrIterationsRun", scans_run);
+		exp_cont_param_i(container, "nrScansAveraged", scans_avg);
+#ifdef GET_RAW_DATA
+		exp_cont_write(container, EXP_CHUNK_AVERAGE, EXP_DT_F32, 0, Asum,
+				samples_per_echo * echoes_per_scan * sizeof(float));
+#endif
+#ifdef GET_DCONV_DATA
+		exp_cont_write(container, EXP_CHUNK_AVERAGE, EXP_DT_CF32, 0, dconv_sum,
+				dconv_size * sizeof(float));
 #endif
 	}
 
@@ -1299,7 +1991,7 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 	fptr = fopen(pathname, "w");
 	if (binary_OR_ascii)
 	{ // binary output
-		fwrite(&Asum, sizeof(float), samples_per_echo * echoes_per_scan, fptr);
+		fwrite(Asum, sizeof(float), samples_per_echo * echoes_per_scan, fptr);
 	}
 	else
 	{ // ascii output
@@ -1307,23 +1999,206 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 		fprintf(fptr, "%d\n", (int)Asum[i]);
 	}
 	fclose(fptr);
+
+	if (acc.ddc != NULL)
+	{
+// write the average downconverted on the host (interleaved IQ, in adc units)
+		float *ddc_avg = (float*) malloc(acc.ddc->acc.length * sizeof(float));
+		if (ddc_avg != NULL)
+		{
+			ddc_sum_result(acc.ddc, ddc_avg, 1.0 / scans_avg);
+			sprintf(pathname, "%s/%s", foldername, "dconv");// put the data into the data folder
+			fptr = fopen(pathname, "w");
+			if (binary_OR_ascii)
+			{ // binary output
+				fwrite(ddc_avg, sizeof(float), acc.ddc->acc.length, fptr);
+			}
+			else
+			{ // ascii output
+				for (i = 0; i < acc.ddc->acc.length; i++)
+				fprintf(fptr, "%d\n", (int)ddc_avg[i]);
+			}
+			fclose(fptr);
+			free(ddc_avg);
+		}
+		ddc_sum_free(acc.ddc);
+		acc.ddc = NULL;
+	}
 #endif
 
 #ifdef GET_DCONV_DATA
+	if (save_full_dconv || !ei_ready)
+	{
 // write downconverted data sum in-phase
-	sprintf(pathname, "%s/%s", foldername, "dconv");// put the data into the data folder
-	fptr = fopen(pathname, "w");
-	if (binary_OR_ascii)
-	{ // binary output
-		fwrite(&dconv_sum, sizeof(float), dconv_size, fptr);
+		sprintf(pathname, "%s/%s", foldername, "dconv");// put the data into the data folder
+		fptr = fopen(pathname, "w");
+		if (binary_OR_ascii)
+		{ // binary output
+			fwrite(dconv_sum, sizeof(float), dconv_size, fptr);
+		}
+		else
+		{ // ascii output
+			for (i = 0; i < dconv_size; i++) fprintf(fptr, "%d\n", (int)dconv_sum[i]);
+		}
+		fclose(fptr);
 	}
-	else
-	{ // ascii output
-		for (i = 0; i < dconv_size; i++) fprintf(fptr, "%d\n", (int)dconv_sum[i]);
+
+	if (ei_ready)
+	{
+		if (acc.ei != NULL)
+		{
+			if (acc.decay_scans != NULL)
+				fclose(acc.decay_scans);
+			free(acc.scan_decay);
+			acc.ei = NULL;
+		}
+		if (echo_matched_filter)
+		{
+			echo_int_matched(&ei, dconv_sum);
+		}
+
+// write the echo amplitudes of the average (interleaved IQ, one pair per echo)
+		float *decay = (float*) malloc(2 * echoes_per_scan * sizeof(float));
+		if (decay == NULL)
+		{
+			printf("\t[ERROR] cannot allocate the decay, it is not written\n");
+			if (acc.adapt != NULL)
+				adapt_free(&adapt);
+			acc.adapt = NULL;
+		}
+		else
+		{
+			echo_int_apply(&ei, dconv_sum, decay);
+			sprintf(pathname, "%s/%s", foldername, "decay");// put the data into the data folder
+			fptr = fopen(pathname, "w");
+			if (binary_OR_ascii)
+			{ // binary output
+				fwrite(decay, sizeof(float), 2 * echoes_per_scan, fptr);
+			}
+			else
+			{ // ascii output
+				for (i = 0; i < 2 * echoes_per_scan; i++) fprintf(fptr, "%f\n", decay[i]);
+			}
+			fclose(fptr);
+			if (container != NULL)
+			{
+				exp_cont_write(container, EXP_CHUNK_DECAY, EXP_DT_CF32, 0, decay,
+						2 * echoes_per_scan * sizeof(float));
+				exp_cont_param_i(container, "echoWinStart", ei.start);
+				exp_cont_param_i(container, "echoWinWidth", ei.width);
+				exp_cont_param_i(container, "echoMatchedFilter", echo_matched_filter);
+			}
+
+			if (acc.adapt != NULL)
+			{ // the snr of the final decay (matched filter, when it is on), and the check that stopped the averaging
+				sprintf(pathname, "%s/acqu.par", foldername);
+				fptr = fopen(pathname, "a");
+				fprintf(fptr, "adaptSnrTarget = %g\n", adapt.snr_target);
+				fprintf(fptr, "adaptT2RelTarget = %g\n", adapt.t2_rel_target);
+				fprintf(fptr, "adaptReachedScans = %d\n", adapt_reached(&adapt));
+				fprintf(fptr, "adaptCheckScans = %d\n", adapt.checked_scans);
+				fprintf(fptr, "adaptCheckSnr = %g\n", adapt.snr);
+				if (adapt.t2_rel_target > 0)
+					fprintf(fptr, "adaptCheckT2RelErr = %g\n", adapt.t2_rel_err);
+				double decay_snr = adapt_decay_snr(decay, echoes_per_scan, adapt.y);
+				fprintf(fptr, "decaySnr = %g\n", decay_snr);
+				fclose(fptr);
+				if (container != NULL)
+					exp_cont_param_d(container, "decaySnr", decay_snr);
+				if (progress_verbose)
+					printf("\tSNR = %.1f after %d of %d scans\n", decay_snr,
+							scans_avg, number_of_iteration);
+				adapt_free(&adapt);
+				acc.adapt = NULL;
+			}
+
+			if (t2_fitting || t2_distribution)
+			{ // on the real part of the phase-corrected decay, at the echo times
+				double *t_echo = (double*) malloc(echoes_per_scan * sizeof(double));
+				double *y_echo = (double*) malloc(echoes_per_scan * sizeof(double));
+				if (t_echo == NULL || y_echo == NULL)
+				{
+					printf("\t[ERROR] cannot allocate the echo times, the T2 fit and distribution are skipped\n");
+				}
+				else
+				{
+					double decay_phase = t2_fit_phase(decay, echoes_per_scan, y_echo);
+					t2_fit_result fit;
+					t2_model model;
+
+					for (i = 0; i < echoes_per_scan; i++)
+						t_echo[i] = (i + 1) * echo_time_us;
+
+					if (t2_fitting)
+					{
+						sprintf(pathname, "%s/%s", foldername, "t2_fit");// put the data into the data folder
+						fptr = fopen(pathname, "w");
+						fprintf(fptr, "timeUnit = us\n");
+						fprintf(fptr, "decayPhase = %4.3f\n", decay_phase * 180 / M_PI);
+						for (model = T2_MONO; model < T2_NUM_MODELS; model++)
+						{
+							if (t2_fit(model, t_echo, y_echo, echoes_per_scan, &fit) == 0)
+							{
+								t2_fit_print(fptr, &fit);
+								if (progress_verbose && model == T2_MONO)
+									printf("\tT2 = %.1f +- %.1f us\n", fit.p[1], fit.sigma[1]);
+							}
+						}
+						fclose(fptr);
+					}
+
+					// the kernel is kept for the next run with the same echo train (t2_kernel_get rebuilds it when the train changes)
+					t2_kernel *ker = t2_distribution ? t2_kernel_get(echo_time_us, echoes_per_scan,
+							t2_dist_min_fact * echo_time_us,
+							t2_dist_max_fact * echo_time_us * echoes_per_scan,
+							t2_dist_points) : NULL;
+					t2_dist_result *dist = (t2_dist_result*) malloc(sizeof(t2_dist_result));
+					if (ker != NULL && dist != NULL
+							&& t2_dist(ker, y_echo, t2_dist_alpha, dist) == 0)
+					{
+						// T2 (us) and amplitude, one pair per line
+						sprintf(pathname, "%s/%s", foldername, "t2_dist");// put the data into the data folder
+						fptr = fopen(pathname, "w");
+						for (i = 0; i < dist->points; i++)
+							fprintf(fptr, "%f\t%f\n", dist->t2[i], dist->f[i]);
+						fclose(fptr);
+
+						sprintf(pathname, "%s/acqu.par", foldername);
+						fptr = fopen(pathname, "a");
+						fprintf(fptr, "t2DistPoints = %d\n", dist->points);
+						fprintf(fptr, "t2DistMin = %4.3f\n", dist->t2[0]);
+						fprintf(fptr, "t2DistMax = %4.3f\n", dist->t2[dist->points - 1]);
+						fprintf(fptr, "t2DistAlpha = %g\n", dist->alpha);
+						fprintf(fptr, "t2DistRms = %g\n", dist->rms);
+						fclose(fptr);
+					}
+					free(dist);
+				}
+				free(t_echo);
+				free(y_echo);
+			}
+			free(decay);
+		}
+
+		sprintf(pathname, "%s/acqu.par", foldername);
+		fptr = fopen(pathname, "a");
+		fprintf(fptr, "echoWinStart = %d\n", ei.start);
+		fprintf(fptr, "echoWinWidth = %d\n", ei.width);
+		fprintf(fptr, "echoMatchedFilter = %d\n", echo_matched_filter);
+		fprintf(fptr, "echoPerScan = %d\n", echo_per_scan);
+		fclose(fptr);
+		echo_int_free(&ei);
 	}
-	fclose(fptr);
 #endif
 
+	if (container != NULL)
+	{ // the last parameters and the index
+		exp_cont_close(container);
+	}
+
+	scan_scheduler_finish(&scan_sched); // the next experiment starts after a full scan_spacing_us
+	scan_scheduler_report(&scan_sched);
+
 	if (progress_verbose)
 	{
 		printf("\t done!\n");
@@ -1331,6 +2206,12 @@ void CPMG_iterate(double cpmg_freq, double pulse1_us, double pulse2_us,
 
 	free(name);
 	free(nameavg);
+#ifdef GET_RAW_DATA
+	free(Asum);
+#endif
+#ifdef GET_DCONV_DATA
+	free(dconv_sum);
+#endif
 
 }
 
@@ -1450,8 +2331,14 @@ void CPMG_iterate_jump(double *cpmg_freq, double *pulse1_us, double *pulse2_us,
 	float dconv_sum_all[dconv_size];
 	for (j=0; j< dconv_size; j++)
 		dconv_sum_all[j] = 0;
+
+	char integer_accumulation = 0; // exact integer sum of the scans, scaled to the average only once at the end
+	int_accumulator iacc;
+	uint8_t iacc_en = integer_accumulation && (int_acc_init(&iacc, dconv_size, 32) == 0);
 #endif
 
+	scan_scheduler_reset(&scan_sched); // the first scan starts right away
+
 	if (progress_verbose)
 	{
 		printf("\tPROGRESS: \n");
@@ -1518,25 +2405,21 @@ void CPMG_iterate_jump(double *cpmg_freq, double *pulse1_us, double *pulse2_us,
 #endif
 
 #ifdef GET_DCONV_DATA
-		if (ph_cycl_en)
+		// accumulate straight from the sdram window
+		if (iacc_en)
 		{
-			if (iterate % 2 == 0)
-			{
-				for (i = 0;	i < dconv_size/num_freq; i++)
-					//dconv_sum[i] -= (float)dconv[i] / (float)number_of_iteration;
-					dconv_sum_all[i + (freq_step - 1)*dconv_size/num_freq] -= (float)dconv[i] / (float)number_of_iteration;
-			}
-			else
-			{
-				for (i = 0;	i < dconv_size/num_freq; i++)
-					//dconv_sum[i] += (float)dconv[i] / (float)number_of_iteration;
-					dconv_sum_all[i + (freq_step - 1)*dconv_size/num_freq] += (float)dconv[i] / (float)number_of_iteration;
-			}
+			int_acc_add_words(&iacc, h2p_sdram_addr,
+					(freq_step - 1)*dconv_size/num_freq, dconv_size/num_freq,
+					scan_negate(ph_cycl_en, iterate - 1));
+			if (freq_step == num_freq)
+				int_acc_scan_done(&iacc); // every frequency has been added once more
 		}
 		else
-		{
-			for (i = 0; i < dconv_size/num_freq; i++)
-				dconv_sum_all[i + (freq_step - 1)*dconv_size/num_freq] += (float)dconv[i] / (float)number_of_iteration;
+		{ // phase-cycle sign and averaging in the same pass
+			accumulate_scan(h2p_sdram_addr,
+					dconv_sum_all + (freq_step - 1)*dconv_size/num_freq,
+					dconv_size/num_freq,
+					scan_scale(ph_cycl_en, iterate - 1, (float) number_of_iteration));
 		}
 		//dconv_sum_all[(freq_step - 1)*samples_per_echo*echoes_per_scan] = dconv_sum;
 #endif
@@ -1559,7 +2442,13 @@ void CPMG_iterate_jump(double *cpmg_freq, double *pulse1_us, double *pulse2_us,
 	fclose(fptr);
 #endif
 
-#ifdef GET_DCONV_DATA
+#ifdef GET_DCONV_DATA
+	if (iacc_en)
+	{ // the average, scaled once
+		int_acc_result(&iacc, dconv_sum_all, 1.0 / number_of_iteration);
+		int_acc_free(&iacc);
+	}
+
 // write downconverted data sum in-phase
 	sprintf(pathname, "%s/%s", foldername, "dconv");// put the data into the data folder
 	fptr = fopen(pathname, "w");
@@ -1574,6 +2463,9 @@ void CPMG_iterate_jump(double *cpmg_freq, double *pulse1_us, double *pulse2_us,
 	fclose(fptr);
 #endif
 
+	scan_scheduler_finish(&scan_sched); // the next experiment starts after a full scan_spacing_us
+	scan_scheduler_report(&scan_sched);
+
 	if (progress_verbose)
 	{
 		printf("\t done!\n");
@@ -1592,7 +2484,8 @@ void FID(double cpmg_freq, double pulse2_us, double pulse2_dtcl,
 	double nmr_fsm_clkfreq = cpmg_freq * 16;
 	uint8_t ph_cycl_en = 0;
 
-	usleep(scan_spacing_us);
+	// the scan starts scan_spacing_us after the start of the previous one (see scan_scheduler_reset)
+	scan_scheduler_set_period(&scan_sched, scan_spacing_us);
 
 // read the current ctrl_out
 	ctrl_out = alt_read_word(h2p_ctrl_out_addr);
@@ -1645,10 +2538,162 @@ void FID(double cpmg_freq, double pulse2_us, double pulse2_dtcl,
 
 }
 
+#ifdef GET_RAW_DATA
+int sw_ddc_init(ddc_sum * ds, unsigned int samples_per_echo,
+		unsigned int echoes, uint32_t max_words)
+{
+	// the host downconverter (sw_ddc_fact) of the raw scans, with the taps of the fpga dconv fir when they can be read
+	// (sw_ddc_fpga_coeff). Its settings go into acqu.par. Returns -1 when it is off
+	int16_t coeff[DCONV_FIR_SPAN / 4];
+	int16_t coeff_q[DCONV_FIR_SPAN / 4];
+	unsigned int taps = 0;
+	int ret = -1;
+
+	if (sw_ddc_fact == 0)
+	{
+		return -1;
+	}
+	if (sw_ddc_fpga_coeff)
+	{ // the I and Q firs are loaded with the same taps
+		taps = ddc_read_fir(h2p_dconv_firI_addr, coeff, DCONV_FIR_SPAN / 4);
+		if (taps != ddc_read_fir(h2p_dconv_firQ_addr, coeff_q, DCONV_FIR_SPAN / 4)
+				|| memcmp(coeff, coeff_q, taps * sizeof(int16_t)) != 0)
+			printf("\t[WARNING] the I and Q firs of the fpga have different taps, the host ddc uses the I taps\n");
+		if (taps > 0)
+			ret = ddc_sum_init(ds, sw_ddc_fact, samples_per_echo, echoes, max_words,
+					coeff, taps);
+		if (ret < 0)
+		{
+			printf("\t[WARNING] the taps of the fpga fir are not usable, the host ddc uses its own lowpass\n");
+			taps = 0;
+		}
+	}
+	if (ret < 0
+			&& ddc_sum_init(ds, sw_ddc_fact, samples_per_echo, echoes, max_words,
+					NULL, 0) < 0)
+	{
+		return -1;
+	}
+
+	sprintf(pathname, "%s/acqu.par", foldername);
+	fptr = fopen(pathname, "a");
+	fprintf(fptr, "swDconvFact = %d\n", sw_ddc_fact);
+	fprintf(fptr, "swDconvTaps = %d\n", ds->ddc.taps);
+	fprintf(fptr, "swDconvFpgaTaps = %d\n", (taps > 0) ? 1 : 0);
+	fclose(fptr);
+	return 0;
+}
+
+int raw_sum_init(raw_scan_sum * rs, unsigned int samples_per_echo,
+		char stats_output, char stats_psd)
+{
+	// the sums of FID_iterate and noise_iterate (one echo per scan), straight from the packed rddata
+	rs->samples = samples_per_echo;
+	if (int_acc_init(&rs->iacc, samples_per_echo, 14) < 0) // 14-bit adc samples
+	{
+		return -1;
+	}
+	rs->ddc_on = (sw_ddc_init(&rs->ddc, samples_per_echo, 1,
+			samples_per_echo / 2) == 0);
+	rs->stats_on = (stats_output
+			&& scan_stats_init(&rs->stats, samples_per_echo, &rs->iacc, stats_psd)
+					== 0);
+	unpack_raw_scan = 0;
+	return 0;
+}
+
+void raw_sum_add(raw_scan_sum * rs)
+{
+	// the scan in rddata
+	if (rs->stats_on)
+	{ // the statistics pass also does the sum
+		scan_stats_add(&rs->stats, (volatile unsigned int *) rddata);
+	}
+	else
+	{
+		int_acc_add_raw(&rs->iacc, (volatile unsigned int *) rddata, 0,
+				rs->samples / 2, 0);
+	}
+	int_acc_scan_done(&rs->iacc);
+	if (rs->ddc_on)
+	{
+		ddc_sum_add(&rs->ddc, (volatile unsigned int *) rddata, 0,
+				rs->samples / 2, 0);
+		int_acc_scan_done(&rs->ddc.acc);
+	}
+}
+
+void raw_sum_finish(raw_scan_sum * rs, double adc_freq)
+{
+	// the statistics, and the "asum" (and "dconv") files of the data folder
+	unpack_raw_scan = 1;
+	int_acc_spill(&rs->iacc);
+
+	if (rs->stats_on)
+	{
+		scan_stats_header stats_hdr;
+		sprintf(pathname, "%s/%s", foldername, "stats"); // put the data into the data folder
+		if (scan_stats_write(&rs->stats, pathname, adc_freq, &stats_hdr) == 0)
+		{
+			sprintf(pathname, "%s/acqu.par", foldername);
+			fptr = fopen(pathname, "a");
+			scan_stats_print(fptr, &stats_hdr);
+			fclose(fptr);
+			if (stats_hdr.clipped_scans > 0)
+			{
+				printf("\t[WARNING] %d of %d scans clipped the adc\n",
+						stats_hdr.clipped_scans, stats_hdr.scans);
+			}
+		}
+	}
+
+// write raw data sum
+	sprintf(pathname, "%s/%s", foldername, "asum"); // put the data into the data folder
+	fptr = fopen(pathname, "w");
+	for (i = 0; i < rs->samples; i++)
+		fprintf(fptr, "%d\n", (int) rs->iacc.acc64[i]);
+	fclose(fptr);
+
+	if (rs->ddc_on)
+	{
+// write downconverted data sum (interleaved IQ, in adc units)
+		int_acc_spill(&rs->ddc.acc);
+		sprintf(pathname, "%s/%s", foldername, "dconv"); // put the data into the data folder
+		fptr = fopen(pathname, "w");
+		for (i = 0; i < rs->ddc.acc.length; i++)
+			fprintf(fptr, "%d\n", (int) (rs->ddc.acc.acc64[i] / rs->ddc.ddc.gain));
+		fclose(fptr);
+	}
+}
+
+void raw_sum_free(raw_scan_sum * rs)
+{
+	if (rs->stats_on)
+	{
+		scan_stats_free(&rs->stats);
+	}
+	if (rs->ddc_on)
+	{
+		ddc_sum_free(&rs->ddc);
+	}
+	int_acc_free(&rs->iacc);
+}
+#endif
+
 void FID_iterate(double cpmg_freq, double pulse2_us, double pulse2_dtcl,
 		long unsigned scan_spacing_us, unsigned int samples_per_echo,
 		unsigned int number_of_iteration, uint32_t enable_message)
 {
+// settings
+#ifdef GET_RAW_DATA
+	char spectrum_output = 0; // write the magnitude/phase spectrum of the sum into the "spectrum" file
+	fft_apod spec_apod = FFT_APOD_EXP; // apodization of the spectrum
+	double spec_lb_khz = 1; // line broadening of the apodization (kHz)
+	unsigned int spec_zero_fill = 2; // the spectrum has (at least) this many times the points of the data
+	char stats_output = 0; // per-sample mean and scan-to-scan deviation, global statistics and clipping of the raw scans into the binary "stats" file
+	char stats_psd = 0; // add the noise spectral density of the scans to the "stats" file (one fft per scan, mostly the fid itself here)
+#endif
+
 	double nmr_fsm_clkfreq = 16 * cpmg_freq;
 	double adc_ltc1746_freq = 4 * cpmg_freq;
 
@@ -1717,9 +2762,16 @@ void FID_iterate(double cpmg_freq, double pulse2_us, double pulse2_dtcl,
 	name = (char*) malloc(FILENAME_LENGTH * sizeof(char));
 
 // initialize sum data
-	int Asum[samples_per_echo];
-	for (i = 0; i < samples_per_echo; i++)
-		Asum[i] = 0;
+#ifdef GET_RAW_DATA
+	raw_scan_sum rs;
+	if (raw_sum_init(&rs, samples_per_echo, stats_output, stats_psd) < 0)
+	{
+		free(name);
+		return;
+	}
+#endif
+
+	scan_scheduler_reset(&scan_sched); // the first scan starts right away
 
 	int iterate = 1;
 	for (iterate = 1; iterate <= number_of_iteration; iterate++)
@@ -1738,18 +2790,61 @@ void FID_iterate(double cpmg_freq, double pulse2_us, double pulse2_dtcl,
 				enable_message);
 
 #ifdef GET_RAW_DATA
-		for (i = 0; i < samples_per_echo; i++)
-		Asum[i] += rddata_16[i];
+		raw_sum_add(&rs);
 #endif
 
 	}
 
-// write raw data sum
-	sprintf(pathname, "%s/%s", foldername, "asum"); // put the data into the data folder
-	fptr = fopen(pathname, "w");
-	for (i = 0; i < samples_per_echo; i++)
-		fprintf(fptr, "%d\n", Asum[i]);
-	fclose(fptr);
+#ifdef GET_RAW_DATA
+	raw_sum_finish(&rs, adc_ltc1746_freq);
+	if (spectrum_output && rs.ddc_on)
+	{ // baseband, centered on cpmg_freq
+		unsigned int pairs = rs.ddc.acc.length / 2;
+		float *spec_re = (float*) malloc(pairs * sizeof(float));
+		float *spec_im = (float*) malloc(pairs * sizeof(float));
+		if (spec_re == NULL || spec_im == NULL)
+		{
+			printf("\t[ERROR] cannot allocate the spectrum, it is not written\n");
+		}
+		else
+		{
+			for (i = 0; i < pairs; i++)
+			{
+				spec_re[i] = (float) rs.ddc.acc.acc64[2 * i] / rs.ddc.ddc.gain;
+				spec_im[i] = (float) rs.ddc.acc.acc64[2 * i + 1] / rs.ddc.ddc.gain;
+			}
+			write_spectrum("spectrum", spec_re, spec_im, pairs,
+					adc_ltc1746_freq / sw_ddc_fact, cpmg_freq, spec_apod, spec_lb_khz,
+					spec_zero_fill);
+		}
+		free(spec_re);
+		free(spec_im);
+	}
+	else if (spectrum_output)
+	{ // real samples without the adc offset: the line is at -cpmg_freq and +cpmg_freq
+		float *spec_re = (float*) malloc(samples_per_echo * sizeof(float));
+		if (spec_re == NULL)
+		{
+			printf("\t[ERROR] cannot allocate the spectrum, it is not written\n");
+		}
+		else
+		{
+			double mean = 0;
+			for (i = 0; i < samples_per_echo; i++)
+				mean += rs.iacc.acc64[i];
+			mean /= samples_per_echo;
+			for (i = 0; i < samples_per_echo; i++)
+				spec_re[i] = (float) (rs.iacc.acc64[i] - mean);
+			write_spectrum("spectrum", spec_re, NULL, samples_per_echo,
+					adc_ltc1746_freq, 0, spec_apod, spec_lb_khz, spec_zero_fill);
+		}
+		free(spec_re);
+	}
+	raw_sum_free(&rs);
+#endif
+
+	scan_scheduler_finish(&scan_sched);
+	scan_scheduler_report(&scan_sched);
 
 	free(name);
 
@@ -1762,7 +2857,8 @@ void noise(double cpmg_freq, long unsigned scan_spacing_us,
 	double nmr_fsm_clkfreq = cpmg_freq * 16;
 	uint8_t ph_cycl_en = 0;
 
-	usleep(scan_spacing_us);
+	// the scan starts scan_spacing_us after the start of the previous one (see scan_scheduler_reset)
+	scan_scheduler_set_period(&scan_sched, scan_spacing_us);
 
 // read the current ctrl_out
 	ctrl_out = alt_read_word(h2p_ctrl_out_addr);
@@ -1815,6 +2911,12 @@ void noise_iterate(double cpmg_freq, long unsigned scan_spacing_us,
 		unsigned int samples_per_echo, unsigned int number_of_iteration,
 		uint32_t enable_message)
 {
+// settings
+#ifdef GET_RAW_DATA
+	char stats_output = 0; // per-sample mean and scan-to-scan deviation, global statistics and clipping of the raw scans into the binary "stats" file
+	char stats_psd = 0; // add the noise spectral density of the scans to the "stats" file (one fft per scan)
+#endif
+
 	double nmr_fsm_clkfreq = 16 * cpmg_freq;
 	double adc_ltc1746_freq = 4 * cpmg_freq;
 
@@ -1874,9 +2976,16 @@ void noise_iterate(double cpmg_freq, long unsigned scan_spacing_us,
 	name = (char*) malloc(FILENAME_LENGTH * sizeof(char));
 
 // initialize sum data
-	int Asum[samples_per_echo];
-	for (i = 0; i < samples_per_echo; i++)
-		Asum[i] = 0;
+#ifdef GET_RAW_DATA
+	raw_scan_sum rs;
+	if (raw_sum_init(&rs, samples_per_echo, stats_output, stats_psd) < 0)
+	{
+		free(name);
+		return;
+	}
+#endif
+
+	scan_scheduler_reset(&scan_sched); // the first scan starts right away
 
 	int iterate = 1;
 	for (iterate = 1; iterate <= number_of_iteration; iterate++)
@@ -1893,22 +3002,40 @@ void noise_iterate(double cpmg_freq, long unsigned scan_spacing_us,
 				enable_message);
 
 #ifdef GET_RAW_DATA
-		for (i = 0; i < samples_per_echo; i++)
-		Asum[i] += rddata_16[i];
+		raw_sum_add(&rs);
 #endif
 	}
 
-// write raw data sum
-	sprintf(pathname, "%s/%s", foldername, "asum"); // put the data into the data folder
-	fptr = fopen(pathname, "w");
-	for (i = 0; i < samples_per_echo; i++)
-		fprintf(fptr, "%d\n", Asum[i]);
-	fclose(fptr);
+#ifdef GET_RAW_DATA
+	raw_sum_finish(&rs, adc_ltc1746_freq);
+	raw_sum_free(&rs);
+#endif
+
+	scan_scheduler_finish(&scan_sched);
+	scan_scheduler_report(&scan_sched);
 
 	free(name);
 
 }
 
+void write_spectrum(char * filename, const float * re, const float * im,
+		unsigned int samples, double samp_freq, double center_freq,
+		fft_apod apod, double lb_khz, unsigned int zero_fill)
+{
+	// write the spectrum of samples points of re (and im, NULL for real data) into the filename file of the measurement folder.
+	// samp_freq and center_freq are in MHz
+	fft_plan *plan = fft_plan_get(fft_length(samples, zero_fill));
+	float *spec;
+
+	if (plan == NULL)
+	{
+		return;
+	}
+	spec = fft_spectrum(plan, re, im, samples, apod, lb_khz, 1 / samp_freq);
+	sprintf(pathname, "%s/%s", foldername, filename); // put the data into the data folder
+	fft_write_spectrum(pathname, spec, plan->n, samp_freq, center_freq);
+}
+
 void tx_sampling(double tx_freq, double samp_freq,
 		unsigned int tx_num_of_samples, char * filename)
 {
@@ -1956,7 +3083,8 @@ void tx_sampling(double tx_freq, double samp_freq,
 	usleep(1);
 
 	runFSM(samp_freq * 4, ph_cycl_en, tx_num_of_samples, filename,
-			SAV_INDV_SCAN, RD_DATA_VIA_SDRAM_OR_FIFO, RD_SDRAM);
+			(filename != NULL) ? SAV_INDV_SCAN : NO_SAV_INDV_SCAN,
+			RD_DATA_VIA_SDRAM_OR_FIFO, RD_SDRAM); // without a filename the samples are only left in rddata
 
 // disable PLL_analyzer path and enable the default RF gate path
 	ctrl_out |= NMR_CLK_GATE_AVLN;
@@ -2001,6 +3129,16 @@ void tune_board(double freq)
 void tx_acq(double startfreq, double stopfreq, double spacfreq, double sampfreq,
 		unsigned int nsamples)
 {
+// settings
+#ifdef GET_RAW_DATA
+	char spectrum_output = 0; // write the magnitude/phase spectrum of every frequency point into its "tx_acq_<freq>_spec" file
+	unsigned int spec_zero_fill = 1; // the spectrum has (at least) this many times the points of the data
+	char lockin_output = 0; // lock in on the excitation frequency of every point and write the complex reflection into the "s11" file
+	lockin_window lockin_win = LOCKIN_HANN; // window of the lock-in. LOCKIN_RECT is fine when every point fits a whole number of cycles
+	char save_raw_points = 1; // write the raw samples of every frequency point into its "tx_acq_<freq>" file
+	char async_raw_points = 0; // with save_raw_points, write the points into one "tx_acq_raw" file (a record per point, in sweep order) through the background writer (see async_writer.h)
+	char compress_raw_points = 1; // encode the points of "tx_acq_raw" losslessly (see scan_codec.h)
+#endif
 
 // buffer in the fpga needs to be an even number, therefore the number of samples should be even as well
 	if (nsamples % 2)
@@ -2048,19 +3186,106 @@ void tx_acq(double startfreq, double stopfreq, double spacfreq, double sampfreq,
 	fprintf(fptr, "freqSpa = %4.3f\n", spacfreq);
 	fprintf(fptr, "nSamples = %d\n", nsamples);
 	fprintf(fptr, "freqSamp = %4.3f\n", sampfreq);
+#ifdef GET_RAW_DATA
+	fprintf(fptr, "s11Output = %d\n", lockin_output);
+	fprintf(fptr, "s11Window = %d\n", lockin_win);
+	fprintf(fptr, "rawPointsFile = %d\n", save_raw_points && async_raw_points);
+#endif
 	fclose(fptr);
 
 	char * filename;
 	double ifreq = 0;
 	filename = (char*) malloc(100 * sizeof(char));
+#ifdef GET_RAW_DATA
+	FILE * fs11 = NULL;
+	lockin_result lockin;
+	if (lockin_output)
+	{ // one line per frequency point: freq(MHz) re im mag(adc units) mag(dB of adc full scale) phase(deg)
+		sprintf(pathname, "%s/s11", foldername);
+		fs11 = fopen(pathname, "w");
+		if (fs11 == NULL)
+		{
+			printf("\t[ERROR] cannot open %s, the s11 sweep is not written\n", pathname);
+		}
+	}
+	async_writer writer;
+	if (save_raw_points && async_raw_points)
+	{ // the packed words of a point, 2 samples per word. Only the i/o thread waits for the sd card
+		sprintf(pathname, "%s/%s", foldername, "tx_acq_raw");
+		if (async_wr_open(&writer, pathname, "tx_acq_raw", nsamples * sizeof(uint16_t), 8,
+				(unsigned int) ((stopfreq - startfreq) / spacfreq + 1.5), 0, 0, -1) == 0)
+		{
+			scan_writer = &writer;
+			if (compress_raw_points)
+				async_wr_compress(&writer, SCAN_CODEC_RAW14, 0);
+		}
+	}
+#endif
 	stopfreq += (spacfreq / 2); // the (spacfreq/2) factor is to compensate double comparison error. double cannot be compared with '==' operator !
 	for (ifreq = startfreq; ifreq < stopfreq; ifreq += spacfreq)
 	{
 		snprintf(filename, 100, "tx_acq_%4.3f", ifreq);
+#ifdef GET_RAW_DATA
+		if (scan_writer != NULL)
+		{ // the frequency of the point goes into the header of its record
+			scan_writer->freq = ifreq;
+		}
+#endif
 // printf("freq: %4.3f\n", ifreq);
+#ifdef GET_RAW_DATA
+		tx_sampling(ifreq, sampfreq, nsamples,
+				save_raw_points ? filename : NULL);
+		if (fs11 != NULL)
+		{ // straight from the packed samples in rddata
+			lockin_tone((volatile unsigned int *) rddata, nsamples, ifreq, sampfreq, lockin_win,
+					&lockin);
+			fprintf(fs11, "%4.3f\t%.4f\t%.4f\t%.4f\t%.3f\t%.3f\n", ifreq,
+					lockin.re, lockin.im, lockin.mag, lockin_db(&lockin),
+					lockin.phase);
+		}
+#else
 		tx_sampling(ifreq, sampfreq, nsamples, filename);
+#endif
+#ifdef GET_RAW_DATA
+		if (spectrum_output)
+		{ // the unpacked samples of the point just acquired, without the adc offset
+			float *spec_re = (float*) malloc(nsamples * sizeof(float));
+			if (spec_re == NULL)
+			{
+				printf("\t[ERROR] cannot allocate the spectrum of %4.3f MHz, it is not written\n", ifreq);
+			}
+			else
+			{
+				double mean = 0;
+				for (i = 0; i < nsamples; i++)
+					mean += rddata_16[i];
+				mean /= nsamples;
+				for (i = 0; i < nsamples; i++)
+					spec_re[i] = (float) (rddata_16[i] - mean);
+				snprintf(filename, 100, "tx_acq_%4.3f_spec", ifreq);
+				write_spectrum(filename, spec_re, NULL, nsamples, sampfreq, 0,
+						FFT_APOD_NONE, 0, spec_zero_fill);
+			}
+			free(spec_re);
+		}
+#endif
 		usleep(1); // this delay is necessary. If it's not here, the system will not crash but the i2c will stop working (?), and the reading length is incorrect
 	}
+#ifdef GET_RAW_DATA
+	if (fs11 != NULL)
+	{
+		fclose(fs11);
+	}
+	if (scan_writer != NULL)
+	{
+		async_wr_close(scan_writer);
+		scan_writer = NULL;
+		sprintf(pathname, "%s/acqu.par", foldername);
+		fptr = fopen(pathname, "a");
+		async_wr_report(&writer, fptr);
+		fclose(fptr);
+	}
+#endif
 
 }
 
@@ -2355,6 +3580,10 @@ int main(int argc, char * argv[])
  mmap_peripherals();
  // init_default_system_param();
 
+ // sleep on the dma completion irq instead of spinning on the status register (polls when the uio device is missing)
+ dma_irq_open_uio(&dma_fifo_irq, DMA_FIFO_UIO_DEV, DMA_IRQ_TIMEOUT_MS);
+ dma_irq_open_uio(&dma_dconvi_irq, DMA_DCONVI_UIO_DEV, DMA_IRQ_TIMEOUT_MS);
+
  // write t1-IR measurement parameters (put both to 0 if IR is not desired)
  alt_write_word(h2p_t1_pulse, pulse180_t1_int);
  alt_write_word(h2p_t1_delay, delay180_t1_int);
@@ -2435,6 +3664,10 @@ int main(int argc, char * argv[])
  echo_spacing_us, scan_spacing_us, samples_per_echo, echoes_per_scan,
  init_adc_delay_compensation, number_of_iteration, ph_cycl_en);
 
+ dma_irq_close(&dma_fifo_irq);
+ dma_irq_close(&dma_dconvi_irq);
+ t2_kernel_release();
+
  // close_system();
  munmap_peripherals();
  close_physical_memory_device();
@@ -2767,3 +4000,542 @@ int main(int argc, char * argv[])
 
  }
  */
+
+/* FIFO reader benchmark against a mocked fifo, no fpga needed (rename the output to "fifo_bench")
+ int main(int argc, char * argv[]) {
+
+ unsigned int length = (argc > 1) ? atoi(argv[1]) : 1<<20;	// words to read per run
+ unsigned int runs = (argc > 2) ? atoi(argv[2]) : 20;		// number of runs
+
+ // mocked fifo: the level register always reports a full fifo and the data port is one word
+ volatile unsigned int fifo_csr[8] = {0};
+ volatile unsigned int fifo_port = 0x12345678;
+ fifo_csr[ALTERA_AVALON_FIFO_LEVEL_REG] = ADC_FIFO_MEM_OUT_FIFO_DEPTH;
+
+ int *buf = (int*) malloc(length * sizeof(int));
+ struct timespec t_start, t_end;
+ double elapsed, words_per_sec, bulk_rate = 0;
+ uint32_t fifo_mem_level;
+ unsigned int r, n;
+
+ // per-word loop (the old rd_FIFO)
+ clock_gettime(CLOCK_MONOTONIC, &t_start);
+ for (r = 0; r < runs; r++) {
+ fifo_mem_level = alt_read_word(fifo_csr + ALTERA_AVALON_FIFO_LEVEL_REG);
+ for (n = 0; n < length; n++) {
+ buf[n] = alt_read_word(&fifo_port);
+ fifo_mem_level--;
+ if (fifo_mem_level == 0) {
+ fifo_mem_level = alt_read_word(fifo_csr + ALTERA_AVALON_FIFO_LEVEL_REG);
+ }
+ }
+ }
+ clock_gettime(CLOCK_MONOTONIC, &t_end);
+ elapsed = (double)(t_end.tv_sec - t_start.tv_sec) + (double)(t_end.tv_nsec - t_start.tv_nsec) * 1e-9;
+ printf("per-word loop\t: %.2f Mwords/s\n", (double)length * runs / elapsed * 1e-6);
+
+ // bulk reader
+ for (r = 0; r < runs; r++) {
+ rd_FIFO_bulk(fifo_csr, (void*)&fifo_port, buf, length, &words_per_sec);
+ bulk_rate += words_per_sec / runs;
+ }
+ printf("rd_FIFO_bulk\t: %.2f Mwords/s\n", bulk_rate * 1e-6);
+
+ free(buf);
+ return 0;
+ }
+ */
+
+/* Accumulation benchmark on plain memory, no fpga needed (rename the output to "accum_bench")
+ int main(int argc, char * argv[]) {
+
+ unsigned int samples = (argc > 1) ? atoi(argv[1]) : 64000;	// samples per scan
+ unsigned int scans = (argc > 2) ? atoi(argv[2]) : 200;		// number of scans
+ uint32_t ph_cycl_en = 1;
+
+ unsigned int *words = (unsigned int*) malloc(samples / 2 * sizeof(unsigned int)); // raw adc words, 2 samples each
+ unsigned int *samples_16 = (unsigned int*) malloc(samples * sizeof(unsigned int));
+ float *fsum = (float*) calloc(samples, sizeof(float));
+ float *isum = (float*) calloc(samples, sizeof(float));
+ int_accumulator iacc;
+ struct timespec t_start, t_end;
+ double elapsed;
+ unsigned int n, iterate;
+
+ for (n = 0; n < samples / 2; n++) words[n] = (unsigned int) rand();
+ buf32_to_buf16((int*) words, samples_16, samples / 2);
+
+ // raw: the float loop of CPMG_iterate
+ clock_gettime(CLOCK_MONOTONIC, &t_start);
+ for (iterate = 1; iterate <= scans; iterate++) {
+ if (iterate % 2 == 0) {
+ for (n = 0; n < samples; n++) fsum[n] -= (float)samples_16[n]/(float)scans;
+ }
+ else {
+ for (n = 0; n < samples; n++) fsum[n] += (float)samples_16[n]/(float)scans;
+ }
+ }
+ clock_gettime(CLOCK_MONOTONIC, &t_end);
+ elapsed = (double)(t_end.tv_sec - t_start.tv_sec) + (double)(t_end.tv_nsec - t_start.tv_nsec) * 1e-9;
+ printf("raw float loop\t\t: %.2f Msamples/s\n", (double)samples * scans / elapsed * 1e-6);
+
+ // raw: integer accumulator straight from the packed words
+ int_acc_init(&iacc, samples, 14);
+ clock_gettime(CLOCK_MONOTONIC, &t_start);
+ for (iterate = 1; iterate <= scans; iterate++) {
+ int_acc_add_raw(&iacc, words, 0, samples / 2, scan_negate(ph_cycl_en, iterate - 1));
+ int_acc_scan_done(&iacc);
+ }
+ int_acc_result(&iacc, isum, 1.0 / scans);
+ clock_gettime(CLOCK_MONOTONIC, &t_end);
+ elapsed = (double)(t_end.tv_sec - t_start.tv_sec) + (double)(t_end.tv_nsec - t_start.tv_nsec) * 1e-9;
+ printf("raw integer accumulator\t: %.2f Msamples/s\n", (double)samples * scans / elapsed * 1e-6);
+ int_acc_free(&iacc);
+
+ // downconverted: accumulate_scan vs integer accumulator
+ for (n = 0; n < samples; n++) fsum[n] = 0;
+ clock_gettime(CLOCK_MONOTONIC, &t_start);
+ for (iterate = 1; iterate <= scans / 2; iterate++) {
+ accumulate_scan(samples_16, fsum, samples, scan_scale(ph_cycl_en, iterate - 1, (float)scans));
+ }
+ clock_gettime(CLOCK_MONOTONIC, &t_end);
+ elapsed = (double)(t_end.tv_sec - t_start.tv_sec) + (double)(t_end.tv_nsec - t_start.tv_nsec) * 1e-9;
+ printf("dconv accumulate_scan\t: %.2f Msamples/s\n", (double)samples * (scans / 2) / elapsed * 1e-6);
+
+ int_acc_init(&iacc, samples, 32);
+ clock_gettime(CLOCK_MONOTONIC, &t_start);
+ for (iterate = 1; iterate <= scans / 2; iterate++) {
+ int_acc_add_words(&iacc, samples_16, 0, samples, scan_negate(ph_cycl_en, iterate - 1));
+ int_acc_scan_done(&iacc);
+ }
+ int_acc_result(&iacc, isum, 1.0 / scans);
+ clock_gettime(CLOCK_MONOTONIC, &t_end);
+ elapsed = (double)(t_end.tv_sec - t_start.tv_sec) + (double)(t_end.tv_nsec - t_start.tv_nsec) * 1e-9;
+ printf("dconv integer accumulator\t: %.2f Msamples/s\n", (double)samples * (scans / 2) / elapsed * 1e-6);
+ int_acc_free(&iacc);
+
+ free(words);
+ free(samples_16);
+ free(fsum);
+ free(isum);
+ return 0;
+ }
+ */
+
+/* DMA irq check on an eventfd standing in for the uio device, no fpga needed (rename the output to "dma_irq_check")
+ static volatile unsigned int dma_regs[8];	// mocked dma register map
+ static dma_irq emul_irq;
+ static unsigned int emul_delay_us;
+ static uint8_t emul_notify;
+
+ static void * dma_emul(void * arg) {
+ // the "transfer": busy for emul_delay_us, then DONE and the irq
+ usleep(emul_delay_us);
+ alt_write_word(dma_regs + DMA_STATUS_OFST, DMA_STAT_DONE_MSK);
+ if (emul_notify) dma_irq_notify(&emul_irq);
+ return NULL;
+ }
+
+ int main(int argc, char * argv[]) {
+
+ unsigned int runs = (argc > 1) ? atoi(argv[1]) : 100;		// transfers per case
+ emul_delay_us = (argc > 2) ? atoi(argv[2]) : 2000;		// transfer time
+ int timeout_ms = 50;										// irq timeout of wait_dma
+ pthread_t th;
+ struct timespec t_start, t_end;
+ double elapsed, late_max;
+ unsigned int r, fails;
+
+ if (dma_irq_open_eventfd(&emul_irq, timeout_ms) != 0) return -1;
+
+ // with the irq: wait_dma sleeps until the notify and clears DONE. Without it: the timeout falls back to polling
+ for (emul_notify = 1; ; emul_notify = 0) {
+ late_max = 0;
+ fails = 0;
+ for (r = 0; r < runs; r++) {
+ alt_write_word(dma_regs + DMA_STATUS_OFST, DMA_STAT_BUSY_MSK);
+ clock_gettime(CLOCK_MONOTONIC, &t_start);
+ pthread_create(&th, NULL, dma_emul, NULL);
+ wait_dma(dma_regs, &emul_irq, DISABLE_MESSAGE);
+ clock_gettime(CLOCK_MONOTONIC, &t_end);
+ pthread_join(th, NULL);
+ elapsed = (double)(t_end.tv_sec - t_start.tv_sec) * 1e6 + (double)(t_end.tv_nsec - t_start.tv_nsec) * 1e-3;
+ if (elapsed < emul_delay_us || alt_read_word(dma_regs + DMA_STATUS_OFST) != 0) fails++; // returned before DONE, or DONE not cleared
+ if (elapsed - emul_delay_us > late_max) late_max = elapsed - emul_delay_us;
+ }
+ printf("%s\t: %d of %d transfers wrong, returned at most %.0f us after DONE\n",
+ emul_notify ? "eventfd irq" : "no irq (timeout)", fails, runs, late_max);
+ if (!emul_notify) break;
+ }
+
+ dma_irq_close(&emul_irq);
+ return 0;
+ }
+ */
+
+/* SDRAM ring check on an emulated dma and fifo (see dma_emul.h), no fpga needed (rename the output to "sdram_ring_check")
+ static uint32_t ring_expect;		// stream position of the next word
+ static uint32_t ring_seq_next, ring_lost, ring_stale, ring_order;
+ static unsigned int ring_consume_us;	// time the consumer takes per slot
+ static unsigned int ring_hold_us;		// time every 5th slot stays held after it is consumed (as if handed to a worker)
+ static double ring_held_until[SDRAM_RING_MAX_SLOTS];
+ static unsigned int ring_slots;
+
+ static double ring_now_us(void) {
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+ }
+
+ static void ring_check_consume(volatile unsigned int * slot, uint32_t length, uint32_t seq, void * ctx) {
+ // every word is its stream position: a jump forward is lost data, a jump back is a stale or rewritten slot
+ uint32_t n;
+ if (seq != ring_seq_next) ring_order++;
+ ring_seq_next = seq + 1;
+ for (n = 0; n < length; n++) {
+ if (slot[n] != ring_expect) {
+ if ((int32_t)(slot[n] - ring_expect) > 0) ring_lost += slot[n] - ring_expect;
+ else ring_stale++;
+ }
+ ring_expect = slot[n] + 1;
+ }
+ if (ring_consume_us) usleep(ring_consume_us);
+ ring_held_until[seq % ring_slots] = ring_now_us() + ((seq % 5 == 0) ? ring_hold_us : 0);
+ }
+
+ static int ring_check_held(void * ctx, uint32_t seq) {
+ return ring_now_us() < ring_held_until[seq % ring_slots];
+ }
+
+ static void ring_check_case(const char * name, dma_emul * emu, uint32_t scan_words, uint32_t slot_words,
+ unsigned int slots, unsigned int scans, uint8_t batch) {
+ // batch: the scans go back-to-back into whole slots and are harvested one by one with consume_next
+ // (as CPMG_Sequence_batch and the scan scheduler slack do). Otherwise every scan is streamed in segments
+ sdram_ring ring;
+ unsigned int s, n;
+ if (sdram_ring_init(&ring, emu->dma_addr, emu->sdram_addr, 0, emu->sdram_base, emu->sdram_words * 4,
+ slot_words, slots, ring_check_consume, NULL) != 0) return;
+ ring.irq = emu->irq;
+ ring.fifo_csr = emu->fifo_csr;
+ if (ring_hold_us) ring.slot_held = ring_check_held;
+ ring_slots = slots;
+ for (n = 0; n < SDRAM_RING_MAX_SLOTS; n++) ring_held_until[n] = 0;
+ ring_expect = (uint32_t)(emu->scan_start + emu->scan_words);
+ ring_seq_next = ring_lost = ring_stale = ring_order = 0;
+
+ for (s = 0; s < scans; s += n) {
+ if (batch) {
+ for (n = 0; n < slots - 1 && s + n < scans; n++) {
+ sdram_ring_wait(&ring); // the fsm is restarted once the previous scan is out
+ dma_emul_scan(emu, scan_words);
+ sdram_ring_start(&ring);
+ }
+ sdram_ring_wait(&ring);
+ while (sdram_ring_consume_next(&ring))
+ ;
+ }
+ else {
+ n = 1;
+ dma_emul_scan(emu, scan_words);
+ sdram_ring_stream(&ring, scan_words);
+ }
+ }
+ sdram_ring_drain(&ring);
+
+ printf("%s\t: %d transfers, %d consumed, %d words lost, %d stale, %d out of order, %d overruns, %d stalls\n",
+ name, ring.seq_started, ring.seq_consumed, ring_lost, ring_stale, ring_order, ring.overruns, ring.stalls);
+ // a transfer that lost words is given up and leaves stale words in its slot, which is fine as long as it is reported
+ if (ring_order || ring.seq_consumed != ring.seq_started || ((ring_lost || ring_stale) && !ring.overruns))
+ printf("\t[ERROR] %s: the ring lost track of its slots\n", name);
+ }
+
+ int main(int argc, char * argv[]) {
+
+ double rate = (argc > 1) ? atof(argv[1]) : 4;	// words per us put out by the fsm
+ uint32_t depth = 8192;							// fifo words (about 2 ms at 4 words/us)
+ uint32_t sdram_words = 1 << 16;
+ volatile unsigned int dma_regs[8] = {0};		// mocked dma register map
+ volatile unsigned int fifo_regs[8] = {0};		// mocked fifo csr
+ unsigned int *sdram = (unsigned int*) calloc(sdram_words, sizeof(unsigned int));
+ dma_irq irq = DMA_IRQ_NONE;
+ dma_emul emu;
+
+ dma_irq_open_eventfd(&irq, 100); // polls the status register when it fails
+ if (sdram == NULL || dma_emul_start(&emu, dma_regs, sdram, SDRAM_BASE, sdram_words, fifo_regs, depth, rate,
+ (irq.fd >= 0) ? &irq : NULL) != 0) return -1;
+
+ ring_consume_us = 0;
+ ring_hold_us = 0;
+ ring_check_case("whole scans", &emu, 3000, 4096, 4, 50, 0);
+ ring_check_case("segments, wraparound", &emu, 20000, 4096, 3, 10, 0);
+ ring_check_case("batch, consume_next", &emu, 3000, 3000, 8, 35, 1);
+ ring_hold_us = 3 * 4096 / rate;	// the slot comes back after two segments: the dma waits for it, but less than the fifo can hold
+ ring_check_case("held slots", &emu, 20000, 4096, 3, 10, 0);
+ ring_hold_us = 0;
+ ring_consume_us = 5000;	// longer than the fifo can hold: words are lost, every loss has to be reported and the ring must not hang
+ ring_check_case("slow consumer", &emu, 20000, 4096, 3, 4, 0);
+
+ dma_emul_stop(&emu);
+ printf("emulated dma: %d transfers, %d words lost to fifo overflows\n", emu.transfers, emu.lost);
+ dma_irq_close(&irq);
+ free(sdram);
+ return 0;
+ }
+ */
+
+/* Scan codec round trip check, no fpga needed (rename the output to "scan_codec_check")
+ static unsigned int codec_errors;
+
+ static int codec_noise(void) {
+ // about 6.5 LSB rms, the noise floor of the adc
+ return rand() % 13 + rand() % 13 + rand() % 13 - 18;
+ }
+
+ static double codec_echo(unsigned int echo, unsigned int n, unsigned int echo_len) {
+ // echo shape of a cpmg train: gaussian envelope around the middle of the window, decaying from echo to echo
+ double t = ((double)n - echo_len / 2) / (echo_len / 8);
+ return exp(-(double)echo / 40) * exp(-t * t / 2) * cos(0.7 * n);
+ }
+
+ static void codec_check_case(const char * name, scan_codec * c, uint32_t * in, uint32_t n_words,
+ scan_codec_type type, uint8_t * enc, uint32_t * out) {
+ // encode, decode and compare every word
+ int len, words;
+ memset(out, 0xA5, n_words * sizeof(uint32_t));
+ len = scan_codec_encode(c, in, n_words, type, enc, scan_codec_bound(n_words));
+ words = (len < 0) ? -1 : scan_codec_decode(c, enc, len, out, n_words);
+ printf("%s\t: %d words into %d bytes (%.2fx)\n", name, n_words, len, (double)n_words * sizeof(uint32_t) / len);
+ if (len < 0 || words != (int)n_words || memcmp(in, out, n_words * sizeof(uint32_t)) != 0) {
+ printf("\t[ERROR] %s: the decoded scan differs from the one encoded\n", name);
+ codec_errors++;
+ }
+ }
+
+ int main(int argc, char * argv[]) {
+
+ unsigned int echoes = (argc > 1) ? atoi(argv[1]) : 64;		// echoes per scan
+ unsigned int echo_len = (argc > 2) ? atoi(argv[2]) : 200;	// adc samples per echo (even)
+ unsigned int n_words = echoes * echo_len / 2;				// raw words, 2 samples each. Also the dconv words (I and Q of echo_len/4 samples)
+ uint32_t *in = (uint32_t*) malloc(n_words * sizeof(uint32_t));
+ uint32_t *out = (uint32_t*) malloc(n_words * sizeof(uint32_t));
+ uint8_t *enc = (uint8_t*) malloc(scan_codec_bound(n_words));
+ uint32_t s[2];
+ scan_codec raw_codec, dconv_codec;
+ unsigned int n, e, k;
+
+ if (in == NULL || out == NULL || enc == NULL || scan_codec_init(&raw_codec, n_words, echo_len) != 0
+ || scan_codec_init(&dconv_codec, n_words, echo_len / 2) != 0) return -1;
+
+ // raw adc words: 14-bit offset binary samples, low half first
+ for (n = 0; n < n_words; n++) {
+ for (k = 0; k < 2; k++) {
+ e = (2 * n + k) / echo_len;
+ s[k] = (uint32_t)(8192 + (int)(3000 * codec_echo(e, (2 * n + k) % echo_len, echo_len)) + codec_noise()) & 0x3FFF;
+ }
+ in[n] = s[0] | (s[1] << 16);
+ }
+ codec_check_case("raw14 echoes", &raw_codec, in, n_words, SCAN_CODEC_RAW14, enc, out);
+ for (n = 0; n < n_words; n++) in[n] = ((8192 + codec_noise()) & 0x3FFF) | (((8192 + codec_noise()) & 0x3FFF) << 16);
+ codec_check_case("raw14 noise", &raw_codec, in, n_words, SCAN_CODEC_RAW14, enc, out);
+ codec_check_case("raw14 odd length", &raw_codec, in, n_words - 3, SCAN_CODEC_RAW14, enc, out);
+
+ // raw words with bits above the 14 of a sample: coded as 32-bit words
+ in[n_words / 3] |= 0x8000;
+ codec_check_case("raw14 one bit 15", &raw_codec, in, n_words, SCAN_CODEC_RAW14, enc, out);
+ for (n = 0; n < n_words; n++) in[n] = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+ codec_check_case("raw14 random words", &raw_codec, in, n_words, SCAN_CODEC_RAW14, enc, out);
+
+ // dconv words: signed 32-bit I and Q, interleaved
+ for (n = 0; n < n_words; n += 2) {
+ e = n / (echo_len / 2);
+ in[n] = (uint32_t)(int32_t)(2e6 * codec_echo(e, n % (echo_len / 2), echo_len / 2) + 40 * codec_noise());
+ in[n + 1] = (uint32_t)(int32_t)(-1e6 * codec_echo(e, n % (echo_len / 2), echo_len / 2) + 40 * codec_noise());
+ }
+ codec_check_case("dconv echoes", &dconv_codec, in, n_words, SCAN_CODEC_I32, enc, out);
+ for (n = 0; n < n_words; n++) in[n] = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+ codec_check_case("dconv random words", &dconv_codec, in, n_words, SCAN_CODEC_I32, enc, out);
+
+ printf("%d blocks rice coded, %d verbatim, %d errors\n", raw_codec.blocks_rice + dconv_codec.blocks_rice,
+ raw_codec.blocks_verbatim + dconv_codec.blocks_verbatim, codec_errors);
+ scan_codec_free(&raw_codec);
+ scan_codec_free(&dconv_codec);
+ free(in);
+ free(out);
+ free(enc);
+ return 0;
+ }
+ */
+
+/* Stream server loopback check, no fpga needed (rename the output to "stream_check")
+ #include <arpa/inet.h>
+ #include <sys/socket.h>
+ #include <sys/un.h>
+
+ typedef struct {
+ int port;					// tcp on loopback, 0: the unix socket path
+ char *path;
+ unsigned int delay_us;		// time the client takes per frame
+ uint32_t scan_words, avg_length, scans;
+ unsigned int frames[STREAM_END + 1];
+ unsigned int scans_whole, errors;
+ uint8_t final_avg;			// the average after the last scan came complete
+ } stream_check_client;
+
+ static int stream_check_read(int fd, void * buf, size_t len) {
+ uint8_t *p = (uint8_t*) buf;
+ ssize_t n;
+ while (len > 0) {
+ n = recv(fd, p, len, 0);
+ if (n <= 0) return -1;
+ p += n;
+ len -= n;
+ }
+ return 0;
+ }
+
+ static void * stream_check_client_thread(void * arg) {
+ // reassembles the scans and the averages from their frames by word_offset. Every scan word is its position in the run
+ // (seq * scan_words + word), every float of an average is its index plus the scans in it
+ stream_check_client *cl = (stream_check_client*) arg;
+ static uint32_t buf[1 << 14];
+ float *f = (float*) buf;
+ stream_hello *hello = (stream_hello*) buf;
+ stream_frame fr;
+ struct sockaddr_in sin;
+ struct sockaddr_un sun;
+ uint32_t seq = 0, got = 0, avg_seq = UINT32_MAX, avg_got = 0, k;
+ int fd, err;
+
+ if (cl->port > 0) {
+ fd = socket(AF_INET, SOCK_STREAM, 0);
+ memset(&sin, 0, sizeof(sin));
+ sin.sin_family = AF_INET;
+ sin.sin_port = htons(cl->port);
+ inet_pton(AF_INET, "127.0.0.1", &sin.sin_addr);
+ err = connect(fd, (struct sockaddr*) &sin, sizeof(sin));
+ }
+ else {
+ fd = socket(AF_UNIX, SOCK_STREAM, 0);
+ memset(&sun, 0, sizeof(sun));
+ sun.sun_family = AF_UNIX;
+ strncpy(sun.sun_path, cl->path, sizeof(sun.sun_path) - 1);
+ err = connect(fd, (struct sockaddr*) &sun, sizeof(sun));
+ }
+ if (err != 0) {
+ printf("\t[ERROR] the client cannot connect (error %d)\n", errno);
+ cl->errors++;
+ close(fd);
+ return NULL;
+ }
+
+ while (stream_check_read(fd, &fr, sizeof(fr)) == 0) {
+ if (fr.magic != STREAM_MAGIC || fr.type > STREAM_END || fr.length > sizeof(buf)
+ || (cl->frames[STREAM_HELLO] == 0) != (fr.type == STREAM_HELLO)) {
+ cl->errors++; // out of step with the frames
+ break;
+ }
+ if (stream_check_read(fd, buf, fr.length) != 0) break;
+ cl->frames[fr.type]++;
+ if (fr.type == STREAM_HELLO) {
+ if (hello->version != STREAM_VERSION || hello->scan_words != cl->scan_words || hello->avg_points != cl->avg_length) cl->errors++;
+ }
+ else if (fr.type == STREAM_SCAN || fr.type == STREAM_PREVIEW) {
+ if (fr.seq != seq) { // the next scan (frames can be dropped, but never go back)
+ if (fr.seq < seq) cl->errors++;
+ seq = fr.seq;
+ got = 0;
+ }
+ for (k = 0; k < fr.length / sizeof(uint32_t); k++)
+ if (buf[k] != seq * cl->scan_words + fr.word_offset + k * fr.decimation) cl->errors++;
+ if (fr.type == STREAM_SCAN && fr.word_offset == got) {
+ got += fr.length / sizeof(uint32_t);
+ if (got == cl->scan_words) cl->scans_whole++;
+ }
+ }
+ else if (fr.type == STREAM_AVERAGE) {
+ for (k = 0; k < fr.length / sizeof(float); k++)
+ if (f[k] != (float)(fr.word_offset + k + fr.scans)) cl->errors++;
+ if (fr.seq != avg_seq) {
+ avg_seq = fr.seq;
+ avg_got = 0;
+ }
+ if (fr.word_offset == avg_got) avg_got += fr.length / sizeof(float);
+ }
+ else { // STREAM_END
+ cl->final_avg = (avg_seq == cl->scans - 1 && avg_got == cl->avg_length);
+ break;
+ }
+ if (cl->delay_us) usleep(cl->delay_us);
+ }
+ close(fd);
+ return NULL;
+ }
+
+ static unsigned int stream_check_case(const char * name, int port, char * path, unsigned int delay_us) {
+ // the scans go out in slots of 4096 words, like from the sdram ring, with a running average every 16 scans
+ stream_server srv;
+ stream_hello hello;
+ stream_check_client cl;
+ pthread_t client;
+ uint32_t slot_words = 4096, s, n, len;
+ uint32_t *scan;
+ float *avg;
+
+ memset(&cl, 0, sizeof(cl));
+ cl.port = port;
+ cl.path = path;
+ cl.delay_us = delay_us;
+ cl.scan_words = 10000;
+ cl.avg_length = 20000;
+ cl.scans = 200;
+ memset(&hello, 0, sizeof(hello));
+ strcpy(hello.kind, "stream_check");
+ hello.word_format = SCAN_CODEC_RAW14;
+ hello.scan_words = cl.scan_words;
+ hello.avg_points = cl.avg_length;
+ hello.scans = cl.scans;
+ scan = (uint32_t*) malloc(cl.scan_words * sizeof(uint32_t));
+ avg = (float*) malloc(cl.avg_length * sizeof(float));
+ if (scan == NULL || avg == NULL
+ || stream_srv_open(&srv, port, NULL, path, &hello, slot_words * 4, 16, 8, -1) != 0) return 1;
+ pthread_create(&client, NULL, stream_check_client_thread, &cl);
+ if (stream_srv_wait_client(&srv, 2000) != 0) printf("\t[ERROR] %s: no client\n", name);
+
+ for (s = 0; s < cl.scans; s++) {
+ for (n = 0; n < cl.scan_words; n++) scan[n] = s * cl.scan_words + n;
+ for (n = 0; n < cl.scan_words; n += len) {
+ len = (cl.scan_words - n < slot_words) ? cl.scan_words - n : slot_words;
+ stream_srv_send(&srv, STREAM_SCAN, s, n, 0, scan + n, len * sizeof(uint32_t), 0);
+ }
+ if ((s + 1) % 16 == 0 || s == cl.scans - 1) {
+ for (n = 0; n < cl.avg_length; n++) avg[n] = (float)(n + s + 1);
+ stream_floats(&srv, s, avg, cl.avg_length, s + 1, s == cl.scans - 1); // the last one must not be dropped
+ }
+ usleep(200); // the scan period
+ }
+ stream_srv_close(&srv);
+ pthread_join(client, NULL);
+
+ printf("%s\t: %d scans whole (of %d), %d previews, %d average frames, %d frames dropped, %d errors\n", name,
+ cl.scans_whole, cl.scans, cl.frames[STREAM_PREVIEW], cl.frames[STREAM_AVERAGE], srv.dropped, cl.errors);
+ if (cl.errors || cl.frames[STREAM_HELLO] != 1 || cl.frames[STREAM_END] != 1 || !cl.final_avg) {
+ printf("\t[ERROR] %s: the client did not get the run\n", name);
+ cl.errors++;
+ }
+ free(scan);
+ free(avg);
+ return cl.errors;
+ }
+
+ int main(int argc, char * argv[]) {
+
+ int port = (argc > 1) ? atoi(argv[1]) : 5011;	// tcp port on loopback
+ unsigned int errors = 0;
+
+ errors += stream_check_case("tcp", port, NULL, 0);
+ errors += stream_check_case("unix socket", 0, "stream_check.sock", 0);
+ errors += stream_check_case("tcp, slow client", port, NULL, 300); // falls behind: previews, then dropped frames
+ printf("%d errors\n", errors);
+ return 0;
+ }
+ */
@@ -24,17 +24,37 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "functions/adaptive_averaging.h"
 #include "functions/adc_functions.h"
+#include "functions/async_writer.h"
 #include "functions/AlteraIP/altera_avalon_fifo_regs.h"
 #include "functions/avalon_dma.h"
 #include "functions/avalon_i2c.h"
 #include "functions/avalon_spi.h"
 #include "functions/cpmg_functions.h"
 #include "functions/dac_ad5724r_driver.h"
+#include "functions/ddc_functions.h"
+#include "functions/dma_emul.h"
+#include "functions/dma_functions.h"
+#include "functions/echo_integrator.h"
+#include "functions/exp_container.h"
+#include "functions/fft_functions.h"
 #include "functions/general.h"
+#include "functions/int_accumulator.h"
+#include "functions/lockin_functions.h"
 #include "functions/nmr_table.h"
 #include "functions/pll_param_generator.h"
 #include "functions/reconfig_functions.h"
+#include "functions/rt_functions.h"
+#include "functions/scan_codec.h"
+#include "functions/scan_log.h"
+#include "functions/scan_pipeline.h"
+#include "functions/scan_scheduler.h"
+#include "functions/scan_stats.h"
+#include "functions/sdram_ring.h"
+#include "functions/stream_server.h"
+#include "functions/t2_dist.h"
+#include "functions/t2_fit.h"
 #include "functions/tca9555_driver.h"
 #include "functions/common_functions.h"
 
@@ -141,6 +161,16 @@ volatile unsigned int *h2p_dma_addr = NULL;
 volatile unsigned int *h2p_dconvi_dma_addr = NULL;
 //volatile unsigned int *h2p_dconvq_dma_addr = NULL;
 volatile unsigned int *h2p_sdram_addr = NULL;
+// DMA completion irq. Needs a uio node (uio_pdrv_genirq) for the dma in the device tree, otherwise the dma status register is polled
+#define DMA_FIFO_UIO_DEV	"/dev/uio0"
+#define DMA_DCONVI_UIO_DEV	"/dev/uio1"
+#define DMA_IRQ_TIMEOUT_MS	1000 // fall back to polling if the irq does not come within this time
+dma_irq dma_fifo_irq = DMA_IRQ_NONE;
+dma_irq dma_dconvi_irq = DMA_IRQ_NONE;
+scan_scheduler scan_sched; // start_fsm starts every scan at its deadline
+scan_jitter *scan_jitter_rec = NULL; // when set, start_fsm records the start of every scan
+sdram_ring *scan_ring = NULL; // when set, runFSM lands every scan in its own slot of this ring (RD_SDRAM only)
+async_writer *scan_writer = NULL; // when set, runFSM hands the individual scans (SAV_INDV_SCAN) to this background writer instead of writing a file for each
 
 void open_physical_memory_device();
 void close_physical_memory_device();
@@ -159,8 +189,6 @@ void handle_fpga_leds();
 void create_measurement_folder(); // create a folder in the system for the measurement data
 void init_default_system_param(); // initialize the system with tuned default parameter
 void sweep_matching_network(); // sweep the capacitance in matching network by sweeping the relay (FOREVER LOOP)
-void fifo_to_sdram_dma_trf(volatile unsigned int * dma_addr, uint32_t rd_addr,
-		uint32_t wr_addr, uint32_t transfer_length);
 void datawrite_with_dma(uint32_t transfer_length, uint8_t en_mesg);
 void close_system();
 void CPMG_Sequence(double cpmg_freq, double pulse1_us, double pulse2_us,
@@ -169,8 +197,57 @@ void CPMG_Sequence(double cpmg_freq, double pulse1_us, double pulse2_us,
 		unsigned int echoes_per_scan, double init_adc_delay_compensation,
 		uint32_t ph_cycl_en, char * filename, char * avgname,
 		uint32_t enable_message);
+void CPMG_Sequence_batch(uint32_t ph_cycl_en, unsigned int num_of_scans);
 void tx_sampling(double tx_freq, double sampfreq, unsigned int samples_per_echo,
 		char * filename);
+void write_spectrum(char * filename, const float * re, const float * im,
+		unsigned int samples, double samp_freq, double center_freq,
+		fft_apod apod, double lb_khz, unsigned int zero_fill);
+
+// running sum handed to the sdram ring consumer
+typedef struct
+{
+	float *sum;
+	int_accumulator *iacc;	// exact integer sum, scaled into sum at the end (NULL: every scan is scaled and added to sum)
+	float number_of_iteration;
+	uint32_t ph_cycl_en;
+	uint32_t scan_length;	// words per scan
+	uint32_t pos;			// words of the current scan already accumulated (a slot may hold only a segment of a scan)
+	uint32_t scan_idx;		// 0-based scan being accumulated
+	echo_integrator *ei;	// integrate the echoes of every scan into scan_decay (NULL: only the average is integrated)
+	float *scan_decay;		// echo amplitudes of the scan being accumulated, sign-corrected for the phase cycle
+	FILE *decay_scans;		// scan_decay of every completed scan is appended here (NULL: not written)
+	adaptive_avg *adapt;	// scan_decay of every completed scan is added to the adaptive averaging (NULL: every scan is run)
+	exp_container *container;	// scan_decay of every completed scan is written into a chunk here (NULL: not written)
+	exp_container *scan_chunks;	// every scan (or segment) as acquired is written into a chunk here (NULL: not written)
+	async_writer *writer;	// every scan (or segment) as acquired is queued here (NULL: not written)
+	stream_server *stream;	// every scan (or segment) as acquired and the running average go to the client here (NULL: not streamed)
+	uint32_t stream_every;	// scans between two running averages on the stream
+	float *stream_avg;		// running average being sent, avg_length floats
+	uint32_t avg_length;
+	uint32_t decays_done;	// completed scans integrated into scan_decay
+	uint32_t scans_dropped;	// scans dropped by the scan pipeline, missing from the sum
+	ddc_sum *ddc;			// raw scans only: every scan (or segment) is also downconverted on the host into this sum (NULL: not)
+} scan_accumulator;
+
+// sum of the raw scans of FID_iterate and noise_iterate, with the host downconverter and the per-sample statistics
+typedef struct
+{
+	int_accumulator iacc;	// adc samples
+	ddc_sum ddc;
+	uint8_t ddc_on;
+	scan_stats stats;		// the statistics pass also does the sum of the adc samples
+	uint8_t stats_on;
+	unsigned int samples;
+} raw_scan_sum;
+
+int sw_ddc_init(ddc_sum * ds, unsigned int samples_per_echo,
+		unsigned int echoes, uint32_t max_words);
+int raw_sum_init(raw_scan_sum * rs, unsigned int samples_per_echo,
+		char stats_output, char stats_psd);
+void raw_sum_add(raw_scan_sum * rs);
+void raw_sum_finish(raw_scan_sum * rs, double adc_freq);
+void raw_sum_free(raw_scan_sum * rs);
 
 // global variables
 FILE *fptr;
@@ -180,6 +257,9 @@ unsigned int j;
 #ifdef GET_RAW_DATA
 int *rddata;
 unsigned int *rddata_16;
+uint8_t unpack_raw_scan = 1; // unpack every scan from rddata into rddata_16. Off while the scans are summed straight from the packed rddata
+unsigned int sw_ddc_fact = 0; // >0 (e.g. 4): CPMG_iterate, FID_iterate and noise_iterate also downconvert every scan on the host by this factor and store the IQ sum (dconv) next to the raw sum (asum)
+uint8_t sw_ddc_fpga_coeff = 1; // the host downconverter uses the taps of the fpga dconv fir (its own lowpass when they cannot be read)
 #endif
 
 #ifdef GET_DCONV_DATA